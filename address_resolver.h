@@ -0,0 +1,302 @@
+#ifndef DNS_CLIENT_ADDRESS_RESOLVER_H
+#define DNS_CLIENT_ADDRESS_RESOLVER_H
+
+#include "dns_resolver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// name -> addresses, all of them, as binary asio addresses
+struct address_result {
+    std::string host;
+    std::string canonical_name;// end of the CNAME chain, host itself without one
+    resolve_status status = resolve_status::error;
+    unsigned short rcode = 0;
+    unsigned int ttl = 0;// smallest ttl of the records the addresses came from
+    std::vector<asio::ip::address> addresses;// RFC 6724 destination order
+
+    bool ok() const { return status == resolve_status::ok && !addresses.empty(); }
+};
+
+// getaddrinfo replacement on top of a dns_resolver: A and AAAA are asked in parallel,
+// CNAME chains are followed inside a response and, when the chain stops at a name without
+// data, with a new query for its target. Addresses are read straight from the rdata.
+// Once the preferred family (IPv6 if this host has a route for it) has answered with
+// addresses, the other one gets a short resolution delay (RFC 8305) and whatever has
+// arrived by then is returned; if the other family answers first, the lookup keeps
+// waiting for the preferred one.
+// Like dns_resolver, call it from the thread running the resolver's io_context.
+class address_resolver {
+public:
+    using handler_type = std::function<void(const address_result &)>;
+
+    static constexpr int s_max_cname_queries = 8;
+
+    explicit address_resolver(dns_resolver &resolver) : resolver_(resolver), ipv6_usable_(probe_ipv6()) {}
+
+    void set_resolution_delay(std::chrono::milliseconds delay) { resolution_delay_ = delay; }
+    // overrides the route probe done on construction
+    void set_ipv6_usable(bool usable) { ipv6_usable_ = usable; }
+    bool ipv6_usable() const { return ipv6_usable_; }
+
+    void async_resolve(std::string host, handler_type handler) {
+        if (!host.empty() && host.back() == '.') {
+            host.pop_back();
+        }
+        auto state = std::make_shared<lookup>(resolver_.get_executor());
+        state->result.host = host;
+        state->handler = std::move(handler);
+        query(state, state->families[0], host, 0);
+        query(state, state->families[1], std::move(host), 0);
+    }
+
+    // completion token flavour, e.g. co_await resolver.async_lookup(host, asio::use_awaitable)
+    template<class CompletionToken>
+    auto async_lookup(std::string host, CompletionToken &&token) {
+        return asio::async_initiate<CompletionToken, void(address_result)>(
+                [this](auto handler, std::string host) {
+                    auto shared = std::make_shared<decltype(handler)>(std::move(handler));
+                    auto initiating = std::make_shared<bool>(true);
+                    async_resolve(std::move(host), [this, shared, initiating](const address_result &result) {
+                        auto executor = asio::get_associated_executor(*shared, resolver_.get_executor());
+                        auto call = [shared, result]() mutable { std::move(*shared)(std::move(result)); };
+                        if (*initiating) {
+                            asio::post(executor, std::move(call));
+                        } else {
+                            asio::dispatch(executor, std::move(call));
+                        }
+                    });
+                    *initiating = false;
+                },
+                token, std::move(host));
+    }
+
+    asio::awaitable<address_result> resolve(std::string host) {
+        co_return co_await async_lookup(std::move(host), asio::use_awaitable);
+    }
+
+    // RFC 6724 destination address selection without source addresses: usable families
+    // first (rule 1), then higher policy table precedence (rule 6), then smaller scope
+    // (rule 8), otherwise the order of the answers (rule 10)
+    static void sort_addresses(std::vector<asio::ip::address> &addresses, bool ipv6_usable) {
+        std::stable_sort(addresses.begin(), addresses.end(), [ipv6_usable](const asio::ip::address &a, const asio::ip::address &b) {
+            bool a_usable = ipv6_usable || !a.is_v6();
+            bool b_usable = ipv6_usable || !b.is_v6();
+            if (a_usable != b_usable) {
+                return a_usable;
+            }
+            int a_precedence = precedence(a);
+            int b_precedence = precedence(b);
+            if (a_precedence != b_precedence) {
+                return a_precedence > b_precedence;
+            }
+            return scope(a) < scope(b);
+        });
+    }
+
+private:
+    struct family {
+        unsigned short query_type;
+        bool done = false;
+        resolve_status status = resolve_status::error;
+        unsigned short rcode = 0;
+        unsigned int ttl = UINT32_MAX;
+        std::string canonical_name{};
+        std::vector<asio::ip::address> addresses{};
+    };
+
+    struct lookup {
+        explicit lookup(const dns_resolver::executor_type &executor) : delay(executor) {}
+
+        address_result result;
+        family families[2] = {{.query_type = DNS::DNS_TYPE_AAAA}, {.query_type = DNS::DNS_TYPE_A}};
+        asio::steady_timer delay;
+        bool delaying = false;
+        bool finished = false;
+        handler_type handler;
+    };
+
+    void query(const std::shared_ptr<lookup> &state, family &f, std::string name, int cname_queries) {
+        resolver_.async_resolve(std::move(name), f.query_type, [this, state, &f, cname_queries](const dns_result &result) {
+            if (!state->finished) {
+                on_answer(state, f, result, cname_queries);
+            }
+        });
+    }
+
+    void on_answer(const std::shared_ptr<lookup> &state, family &f, const dns_result &result, int cname_queries) {
+        f.status = result.status;
+        DNS::DnsMessageView msg(result.packet, result.len);
+        if (result.status == resolve_status::ok && !msg.valid()) {
+            f.status = resolve_status::error;
+        }
+        if (f.status != resolve_status::ok) {
+            f.done = true;
+            progress(state);
+            return;
+        }
+        f.rcode = msg.rcode();
+        std::string owner(result.host);
+        bool followed = false;
+        // the chain may come in any order, at most one hop per answer record
+        char buf[256];
+        for (int hops = 0; hops < msg.answers().size(); hops++) {
+            bool moved = false;
+            for (const DNS::DnsRecordView &res : msg.answers()) {
+                DNS::DnsNameView target;
+                if (res.domain_type == DNS::DNS_TYPE_CNAME && res.host.equals(owner) && res.target(target)) {
+                    int len = target.to_string(buf, sizeof(buf));
+                    if (len > 0) {
+                        owner.assign(buf, len);
+                        f.ttl = std::min(f.ttl, res.ttl);
+                        moved = followed = true;
+                    }
+                    break;
+                }
+            }
+            if (!moved) {
+                break;
+            }
+        }
+        for (const DNS::DnsRecordView &res : msg.answers()) {
+            std::array<unsigned char, 4> v4{};
+            std::array<unsigned char, 16> v6{};
+            if (res.domain_type != f.query_type || !res.host.equals(owner)) {
+                continue;
+            }
+            if (res.a(v4)) {
+                f.addresses.emplace_back(asio::ip::address_v4(v4));
+            } else if (res.aaaa(v6)) {
+                f.addresses.emplace_back(asio::ip::address_v6(v6));
+            } else {
+                continue;
+            }
+            f.ttl = std::min(f.ttl, res.ttl);
+        }
+        f.canonical_name = owner;
+        if (f.addresses.empty() && f.rcode == DNS::DNS_RCODE_NOERROR && followed && cname_queries < s_max_cname_queries) {
+            // the server stopped at a CNAME, ask for its target
+            query(state, f, std::move(owner), cname_queries + 1);
+            return;
+        }
+        f.done = true;
+        progress(state);
+    }
+
+    void progress(const std::shared_ptr<lookup> &state) {
+        family &preferred = state->families[ipv6_usable_ ? 0 : 1];
+        family &other = state->families[ipv6_usable_ ? 1 : 0];
+        if (preferred.done && other.done) {
+            finish(state);
+            return;
+        }
+        if (preferred.done && !preferred.addresses.empty() && !state->delaying) {
+            state->delaying = true;
+            state->delay.expires_after(resolution_delay_);
+            state->delay.async_wait([this, state](const asio::error_code &err) {
+                if (!err && !state->finished) {
+                    finish(state);
+                }
+            });
+        }
+    }
+
+    void finish(const std::shared_ptr<lookup> &state) {
+        state->finished = true;
+        state->delay.cancel();
+        address_result &result = state->result;
+        const family &preferred = state->families[ipv6_usable_ ? 0 : 1];
+        const family &other = state->families[ipv6_usable_ ? 1 : 0];
+        // status and rcode come from a family with addresses, else from one that got an answer
+        const family *primary = &preferred;
+        if (preferred.addresses.empty() && other.done &&
+            (!other.addresses.empty() || (preferred.status != resolve_status::ok && other.status == resolve_status::ok))) {
+            primary = &other;
+        }
+        result.status = primary->status;
+        result.rcode = primary->rcode;
+        result.canonical_name = primary->canonical_name.empty() ? result.host : primary->canonical_name;
+        unsigned int ttl = UINT32_MAX;
+        for (const family &f : state->families) {
+            if (!f.done || f.addresses.empty()) {
+                continue;
+            }
+            result.addresses.insert(result.addresses.end(), f.addresses.begin(), f.addresses.end());
+            ttl = std::min(ttl, f.ttl);
+        }
+        result.ttl = result.addresses.empty() ? 0 : ttl;
+        sort_addresses(result.addresses, ipv6_usable_);
+        handler_type handler = std::move(state->handler);
+        handler(result);
+    }
+
+    // RFC 6724 section 2.1 default policy table
+    static int precedence(const asio::ip::address &address) {
+        if (address.is_v4()) {
+            return 35;// ::ffff:0:0/96
+        }
+        asio::ip::address_v6 v6 = address.to_v6();
+        auto bytes = v6.to_bytes();
+        if (v6.is_loopback()) {
+            return 50;
+        }
+        if (v6.is_v4_mapped()) {
+            return 35;
+        }
+        if (bytes[0] == 0x20 && bytes[1] == 0x02) {
+            return 30;// 6to4
+        }
+        if (bytes[0] == 0x20 && bytes[1] == 0x01 && bytes[2] == 0 && bytes[3] == 0) {
+            return 5;// teredo
+        }
+        if ((bytes[0] & 0xfe) == 0xfc) {
+            return 3;// unique local
+        }
+        if (v6.is_site_local() || v6.is_v4_compatible() || (bytes[0] == 0x3f && bytes[1] == 0xfe)) {
+            return 1;
+        }
+        return 40;
+    }
+
+    // RFC 6724 section 3.1 / RFC 4291 scope values
+    static int scope(const asio::ip::address &address) {
+        if (address.is_v4()) {
+            auto bytes = address.to_v4().to_bytes();
+            bool link_local = bytes[0] == 127 || (bytes[0] == 169 && bytes[1] == 254);
+            return link_local ? 2 : 14;
+        }
+        asio::ip::address_v6 v6 = address.to_v6();
+        if (v6.is_multicast()) {
+            return v6.to_bytes()[1] & 0x0f;
+        }
+        if (v6.is_loopback() || v6.is_link_local()) {
+            return 2;
+        }
+        if (v6.is_site_local()) {
+            return 5;
+        }
+        return 14;
+    }
+
+    // the AI_ADDRCONFIG idea: a udp connect only asks the routing table, nothing is sent
+    static bool probe_ipv6() {
+        asio::io_context ios(1);
+        udp::socket sock(ios);
+        asio::error_code err;
+        sock.open(udp::v6(), err);
+        if (!err) {
+            sock.connect(udp::endpoint(asio::ip::make_address("2001:4860:4860::8888", err), DNS::DNS_UDP_PORT), err);
+        }
+        return !err;
+    }
+
+private:
+    dns_resolver &resolver_;
+    bool ipv6_usable_;
+    std::chrono::milliseconds resolution_delay_{50};
+};
+
+#endif//DNS_CLIENT_ADDRESS_RESOLVER_H
@@ -1,44 +1,73 @@
 #ifndef DNS_CLIENT_ASYNC_UDP_CLIENT_H
 #define DNS_CLIENT_ASYNC_UDP_CLIENT_H
 
+#include <utility>
 #include "asio.hpp"
 #include "dns.h"
+#include "dns_message.h"
+#include "dns_printer.h"
+#include "retry_policy.h"
 #include <fmt/format.h>
 #include <iostream>
+#include <random>
 #include <string>
-#include <utility>
+#include <vector>
 
+using asio::ip::tcp;
 using asio::ip::udp;
 using std::string;
 
 class async_udp_client {
 public:
     explicit async_udp_client()
-        : sock_(s_ios, udp::endpoint(udp::v4(), 0)),
-          s_end_point(asio::ip::address::from_string(DNS::DEFAULT_DNS_SERVER_IP), DNS::DNS_UDP_PORT),
-          read_buf_{0},
-          write_buf_{0}
+        : s_end_point(asio::ip::address::from_string(DNS::DEFAULT_DNS_SERVER_IP), DNS::DNS_UDP_PORT),
+          sock_(s_ios, udp::endpoint(udp::v4(), 0)),
+          timer_(s_ios),
+          tcp_sock_(s_ios)
     {}
 
-    explicit async_udp_client(const string& host)
-        : sock_(s_ios, udp::endpoint(udp::v4(), 0)),
-          s_end_point(asio::ip::address::from_string(host), DNS::DNS_UDP_PORT),
-          read_buf_{0},
-          write_buf_{0}
+    explicit async_udp_client(const string& host, unsigned short port = DNS::DNS_UDP_PORT)
+        : s_end_point(asio::ip::address::from_string(host), port),
+          sock_(s_ios, udp::endpoint(udp::v4(), 0)),
+          timer_(s_ios),
+          tcp_sock_(s_ios)
     {}
 
     virtual ~async_udp_client() = default;
 
 public:
-    void query(const string& url, bool verbose=false) {
+    void set_retry_policy(const retry_policy &policy) { retry_ = policy; }
+    // 0 sends a plain query without an OPT record
+    void set_edns_payload(unsigned short payload) { edns_payload_ = std::min(payload, DNS::DNS_MAX_EDNS_PAYLOAD_SIZE); }
+    // anything but OUTPUT_TABLE writes one record to stdout with a single write, status notes go to stderr
+    void set_output_format(DNS::OutputFormat format) { format_ = format; }
+
+    // false if no reply arrived after every attempt
+    bool query(const string& url, bool verbose=false) {
         query_url = url;
         v_ = verbose;
-        do_write(query_url);
+        write_len_ = build_query(query_url);
+        do_write();
         s_ios.run();
+        return !timed_out_;
     }
 
 private:
     void on_read(const asio::error_code &err, size_t bytes) {
+        if (err == asio::error::operation_aborted) {
+            return;
+        }
+        // stray or spoofed datagrams are ignored, the receive stays outstanding
+        if (!err && !matches(read_buf_, bytes)) {
+            do_read();
+            return;
+        }
+        if (!err && DNS::DnsMessageView(read_buf_, bytes).truncated()) {
+            fmt::print(format_ == DNS::OUTPUT_TABLE ? stdout : stderr, "response truncated, asking again over tcp\n");
+            do_tcp_query();
+            return;
+        }
+        timer_.cancel();
         if (!err) {
             if (v_) {
                 fmt::print("{0:=^{1}}\n", "", 80);
@@ -46,28 +75,136 @@ private:
                 DNS::PrintBuffer(read_buf_, bytes);
                 fmt::print("{0:=^{1}}\n", "", 80);
             }
-            DNS::ParseDnsResponsePacket(read_buf_, bytes);
+            print_response(DNS::RESULT_OK, read_buf_, bytes);
         } else {
+            print_response(DNS::RESULT_ERROR, nullptr, 0);
             fmt::print(stderr, "error code: {}\n", err.value());
             fmt::print(stderr, "error value: {}\n", err.message());
         }
     }
 
+    // a reply from the server to this query: same id and question
+    bool matches(const char *data, size_t bytes) const {
+        DNS::DnsMessageView msg(data, (int) bytes);
+        if (sender_end_point_ != s_end_point || !msg.valid() || !msg.response() || msg.id() != query_id_ || msg.questions().size() != 1) {
+            return false;
+        }
+        DNS::DnsQuestionView question = *msg.questions().begin();
+        return question.query_type == DNS::DNS_TYPE_A && question.query_class == DNS::DNS_CLASS_IN && question.host.equals(query_url);
+    }
+
+    // same query with the 2-byte length prefix of DNS over TCP, on a fresh connection
+    void do_tcp_query() {
+        tcp_ = true;
+        tcp_buf_.resize(2 + write_len_);
+        tcp_buf_[0] = (char) (write_len_ >> 8);
+        tcp_buf_[1] = (char) write_len_;
+        std::copy(write_buf_, write_buf_ + write_len_, tcp_buf_.begin() + 2);
+        timer_.expires_after(retry_.timeout_for(retry_.attempts));
+        timer_.async_wait([this](const asio::error_code &err) { on_timeout(err); });
+        tcp_sock_.async_connect(tcp::endpoint(s_end_point.address(), s_end_point.port()), [this](const asio::error_code &err) {
+            if (err) {
+                on_tcp_error(err);
+                return;
+            }
+            asio::async_write(tcp_sock_, asio::buffer(tcp_buf_), [this](const asio::error_code &err, size_t) {
+                if (err) {
+                    on_tcp_error(err);
+                    return;
+                }
+                tcp_buf_.resize(2);
+                asio::async_read(tcp_sock_, asio::buffer(tcp_buf_), [this](const asio::error_code &err, size_t) {
+                    if (err) {
+                        on_tcp_error(err);
+                        return;
+                    }
+                    tcp_buf_.resize(((unsigned char) tcp_buf_[0] << 8) | (unsigned char) tcp_buf_[1]);
+                    asio::async_read(tcp_sock_, asio::buffer(tcp_buf_), [this](const asio::error_code &err, size_t bytes) {
+                        if (err) {
+                            on_tcp_error(err);
+                            return;
+                        }
+                        timer_.cancel();
+                        tcp_sock_.close();
+                        if (v_) {
+                            fmt::print("{0:=^{1}}\n", "", 80);
+                            fmt::print("DNS Response Packet {} bytes over tcp\n", bytes);
+                            DNS::PrintBuffer(tcp_buf_.data(), bytes);
+                            fmt::print("{0:=^{1}}\n", "", 80);
+                        }
+                        print_response(DNS::RESULT_OK, tcp_buf_.data(), bytes);
+                    });
+                });
+            });
+        });
+    }
+
+    void print_response(unsigned char status, const char *packet, size_t bytes) {
+        if (format_ == DNS::OUTPUT_TABLE) {
+            if (status == DNS::RESULT_OK) {
+                DNS::ParseDnsResponsePacket(packet, (int) bytes);
+            }
+            return;
+        }
+        fmt::memory_buffer out;
+        if (DNS::FormatDnsResult(out, format_, query_url, status, packet, (int) bytes) < 0) {
+            DNS::FormatDnsResult(out, format_, query_url, DNS::RESULT_ERROR, nullptr, 0);
+        }
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+    }
+
+    void on_tcp_error(const asio::error_code &err) {
+        if (err == asio::error::operation_aborted) {
+            return;
+        }
+        timer_.cancel();
+        print_response(DNS::RESULT_ERROR, nullptr, 0);
+        fmt::print(stderr, "tcp query failed: {}\n", err.message());
+    }
+
     void do_read() {
         sock_.async_receive_from(asio::buffer(read_buf_), sender_end_point_, [this](auto && PH1, auto && PH2) { on_read(std::forward<decltype(PH1)>(PH1), std::forward<decltype(PH2)>(PH2)); });
     }
 
-    void on_write(const asio::error_code &err, size_t bytes) {
-        do_read();
+    void on_write(const asio::error_code &, size_t) {
+        // one receive stays outstanding across retransmits
+        if (attempts_ == 1) {
+            do_read();
+        }
+        timer_.expires_after(retry_.timeout_for(attempts_));
+        timer_.async_wait([this](const asio::error_code &err) { on_timeout(err); });
+    }
+
+    void on_timeout(const asio::error_code &err) {
+        if (err) {
+            return;
+        }
+        if (tcp_) {
+            print_response(DNS::RESULT_TIMEOUT, nullptr, 0);
+            fmt::print(stderr, "query {} timed out over tcp\n", query_url);
+            timed_out_ = true;
+            tcp_sock_.close();
+            return;
+        }
+        if (attempts_ >= retry_.attempts) {
+            print_response(DNS::RESULT_TIMEOUT, nullptr, 0);
+            fmt::print(stderr, "query {} timed out after {} attempts\n", query_url, attempts_);
+            timed_out_ = true;
+            sock_.close();
+            return;
+        }
+        do_write();
     }
 
-    void do_write(const string &url) {
-        int len = build_query(url);
-        sock_.async_send_to(asio::buffer(write_buf_, len), s_end_point, [this](auto && PH1, auto && PH2) { on_write(std::forward<decltype(PH1)>(PH1), std::forward<decltype(PH2)>(PH2)); });
+    void do_write() {
+        attempts_++;
+        sock_.async_send_to(asio::buffer(write_buf_, write_len_), s_end_point, [this](auto && PH1, auto && PH2) { on_write(std::forward<decltype(PH1)>(PH1), std::forward<decltype(PH2)>(PH2)); });
     }
 
     int build_query(const string& url) {
-        int len = DNS::BuildDnsQueryPacket(url.c_str(), write_buf_, 0, s_buff_size);
+        query_id_ = static_cast<unsigned short>(std::random_device{}());
+        int len = DNS::BuildDnsQueryPacket(url.c_str(), write_buf_, 0, (int) sizeof(write_buf_), query_id_, DNS::DNS_TYPE_A, edns_payload_);
         if (len < 0) {
             fmt::print(stderr, "build dns query packet fail.\n");
             exit(1);
@@ -83,15 +220,26 @@ private:
     }
 
 private:
-    static const size_t s_buff_size = 1024;
     udp::endpoint s_end_point;
     bool v_ = false;
 
 private:
     udp::socket sock_;
+    asio::steady_timer timer_;
+    tcp::socket tcp_sock_;
+    std::vector<char> tcp_buf_;
+    bool tcp_ = false;
+    retry_policy retry_;
+    unsigned int attempts_ = 0;
+    bool timed_out_ = false;
+    int write_len_ = 0;
+    unsigned short query_id_ = 0;
     udp::endpoint sender_end_point_;
-    char read_buf_[s_buff_size];
-    char write_buf_[s_buff_size];
+    // sized for the largest payload we ever advertise
+    char read_buf_[DNS::DNS_MAX_EDNS_PAYLOAD_SIZE];
+    char write_buf_[DNS::DNS_MAX_EDNS_PAYLOAD_SIZE];
+    unsigned short edns_payload_ = DNS::DNS_EDNS_PAYLOAD_SIZE;
+    DNS::OutputFormat format_ = DNS::OUTPUT_TABLE;
     string query_url;
 
 public:
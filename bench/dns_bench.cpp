@@ -0,0 +1,224 @@
+// end to end load generator: dns_resolver against an in-process stub responder on loopback.
+// closed loop keeps `window` queries in flight, open loop (--rate) sends on a fixed schedule
+// and measures latency from the scheduled send time, so a stalled client can not hide its
+// own queueing delay (coordinated omission).
+#include "../resolver_engine.h"
+#include "hdr_histogram.h"
+#include "stub_responder.h"
+#include <cmdline.h>
+#include <fmt/format.h>
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using bench_clock = std::chrono::steady_clock;
+
+struct bench_counters {
+    size_t sent = 0;
+    size_t completed = 0;
+    size_t ok = 0;
+    size_t nxdomain = 0;
+    size_t other_rcode = 0;
+    size_t timeouts = 0;
+    size_t errors = 0;
+    size_t retransmits = 0;
+};
+
+class load_generator {
+public:
+    load_generator(asio::io_context &ios, dns_resolver &resolver, const vector<string> &names, double nx_share,
+                   size_t total, double rate, size_t window, bench_clock::duration duration)
+        : ios_(ios), resolver_(resolver), names_(names), nx_share_(nx_share), total_(total), rate_(rate),
+          window_(window), duration_(duration), timer_(ios), rng_(std::random_device{}()) {}
+
+    void start() {
+        start_ = bench_clock::now();
+        if (rate_ > 0) {
+            tick();
+        } else {
+            fill();
+        }
+    }
+
+    const bench_counters &counters() const { return counters_; }
+    const hdr_histogram &latency() const { return latency_; }
+    double elapsed() const { return std::chrono::duration<double>(last_ - start_).count(); }
+
+private:
+    bool sending() const {
+        return counters_.sent < total_ && (duration_.count() == 0 || bench_clock::now() - start_ < duration_);
+    }
+
+    // closed loop: top the window up again after every completion
+    void fill() {
+        if (filling_) {
+            return;
+        }
+        filling_ = true;
+        while (counters_.sent - counters_.completed < window_ && sending()) {
+            issue(bench_clock::now());
+        }
+        filling_ = false;
+    }
+
+    // open loop: every millisecond send whatever the schedule says is due
+    void tick() {
+        auto now = bench_clock::now();
+        double due = rate_ * std::chrono::duration<double>(now - start_).count();
+        while (counters_.sent < due && sending()) {
+            auto scheduled = start_ + std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(counters_.sent / rate_));
+            issue(scheduled);
+        }
+        if (!sending()) {
+            return;
+        }
+        timer_.expires_after(std::chrono::milliseconds(1));
+        timer_.async_wait([this](const asio::error_code &err) {
+            if (!err) {
+                tick();
+            }
+        });
+    }
+
+    void issue(bench_clock::time_point scheduled) {
+        counters_.sent++;
+        string host;
+        if (nx_share_ > 0 && std::uniform_real_distribution<double>(0, 1)(rng_) < nx_share_) {
+            host = fmt::format("nx{}.missing.test", rng_());
+        } else {
+            host = names_[rng_() % names_.size()];
+        }
+        resolver_.async_resolve(std::move(host), DNS::DNS_TYPE_A, [this, scheduled](const dns_result &result) {
+            last_ = bench_clock::now();
+            latency_.record(std::chrono::duration_cast<std::chrono::microseconds>(last_ - scheduled).count());
+            counters_.completed++;
+            counters_.retransmits += result.attempts > 1 ? result.attempts - 1 : 0;
+            if (result.status == resolve_status::timeout) {
+                counters_.timeouts++;
+            } else if (result.status != resolve_status::ok) {
+                counters_.errors++;
+            } else {
+                unsigned short rcode = DNS::DnsMessageView(result.packet, result.len).rcode();
+                counters_.ok += rcode == DNS::DNS_RCODE_NOERROR;
+                counters_.nxdomain += rcode == DNS::DNS_RCODE_NXDOMAIN;
+                counters_.other_rcode += rcode != DNS::DNS_RCODE_NOERROR && rcode != DNS::DNS_RCODE_NXDOMAIN;
+            }
+            if (rate_ <= 0) {
+                fill();
+            }
+        });
+    }
+
+    asio::io_context &ios_;
+    dns_resolver &resolver_;
+    const vector<string> &names_;
+    double nx_share_;
+    size_t total_;
+    double rate_;
+    size_t window_;
+    bench_clock::duration duration_;
+    asio::steady_timer timer_;
+    std::mt19937 rng_;
+    bench_clock::time_point start_;
+    bench_clock::time_point last_;
+    bool filling_ = false;
+    bench_counters counters_;
+    hdr_histogram latency_;
+};
+
+int main(int argc, char *argv[]) {
+    cmdline::parser parser;
+    parser.add<int>("names", 'n', "generated zone size, host<i>.bench.test", false, 100000);
+    parser.add<string>("zone", '\0', "zone file instead of the generated zone, \"name type ttl data\" per line", false);
+    parser.add<int>("queries", 'q', "queries to send", false, 1000000);
+    parser.add<int>("duration", 'd', "stop sending after this many seconds, 0 for no limit", false, 0);
+    parser.add<int>("rate", 'r', "open loop queries/s, 0 runs closed loop", false, 0);
+    parser.add<int>("window", 'w', "queries in flight (closed loop) / resolver capacity", false, 1000, cmdline::range(1, 65535));
+    parser.add<double>("loss", '\0', "percent of udp queries the responder drops", false, 0);
+    parser.add<int>("delay", '\0', "responder delay per udp reply in microseconds", false, 0);
+    parser.add<double>("truncate", '\0', "percent of udp replies sent truncated", false, 0);
+    parser.add<double>("nx", '\0', "percent of queries for names outside the zone", false, 0);
+    parser.add<int>("timeout", '\0', "first retransmit timeout in ms", false, 1000);
+    parser.add<int>("attempts", '\0', "sends per query before giving up", false, 3);
+    parser.add<int>("batch", '\0', "sendmmsg/recvmmsg batch size, 0 sends one datagram per syscall", false, 0, cmdline::range(0, 1024));
+    parser.add<int>("edns", '\0', "advertised EDNS0 udp payload, 0 disables", false, DNS::DNS_EDNS_PAYLOAD_SIZE, cmdline::range(0, (int) DNS::DNS_MAX_EDNS_PAYLOAD_SIZE));
+    parser.add<int>("cache", '\0', "cache entries, 0 disables the cache", false, 0);
+    parser.add<string>("server", '\0', "address:port to drive instead of the in-process responder, e.g. a dns_client --listen forwarder", false);
+    parser.parse_check(argc, argv);
+
+    stub_responder::options responder_options;
+    responder_options.loss = parser.get<double>("loss") / 100;
+    responder_options.truncate = parser.get<double>("truncate") / 100;
+    responder_options.delay = std::chrono::microseconds(parser.get<int>("delay"));
+    stub_responder responder(responder_options);
+    if (parser.exist("zone")) {
+        if (!responder.load_zone(parser.get<string>("zone"))) {
+            fmt::print(stderr, "can not open zone {}\n", parser.get<string>("zone"));
+            return -1;
+        }
+    } else {
+        responder.generate_zone(parser.get<int>("names"), "bench.test");
+    }
+    if (responder.names().empty()) {
+        fmt::print(stderr, "empty zone\n");
+        return -1;
+    }
+    udp::endpoint server;
+    if (parser.exist("server")) {
+        // the zone only names the queries, the responder stays idle
+        const string &target = parser.get<string>("server");
+        size_t colon = target.rfind(':');
+        asio::error_code err;
+        auto address = asio::ip::make_address(target.substr(0, colon), err);
+        if (err || colon == string::npos) {
+            fmt::print(stderr, "bad server address {}, expected address:port\n", target);
+            return -1;
+        }
+        server = udp::endpoint(address, (unsigned short) std::stoi(target.substr(colon + 1)));
+    } else {
+        responder.start();
+        server = udp::endpoint(asio::ip::make_address("127.0.0.1"), responder.port());
+    }
+
+    asio::io_context ios(1);
+    udp::socket sock(ios, udp::endpoint(server.protocol(), 0));
+    asio::error_code ignored;
+    sock.set_option(asio::socket_base::receive_buffer_size(8 << 20), ignored);
+    dns_resolver resolver(make_udp_transport(std::move(sock), parser.get<int>("batch")), server, parser.get<int>("window"));
+    retry_policy retry;
+    retry.timeout = std::chrono::milliseconds(parser.get<int>("timeout"));
+    retry.attempts = parser.get<int>("attempts");
+    resolver.set_retry_policy(retry);
+    resolver.set_edns_payload(parser.get<int>("edns"));
+    std::unique_ptr<dns_cache> cache;
+    if (parser.get<int>("cache") > 0) {
+        cache = std::make_unique<dns_cache>(parser.get<int>("cache"));
+        resolver.set_cache(cache.get());
+    }
+
+    load_generator load(ios, resolver, responder.names(), parser.get<double>("nx") / 100, parser.get<int>("queries"),
+                        parser.get<int>("rate"), parser.get<int>("window"), std::chrono::seconds(parser.get<int>("duration")));
+    load.start();
+    ios.run();
+    responder.stop();
+
+    const bench_counters &c = load.counters();
+    const hdr_histogram &h = load.latency();
+    const stub_responder::stats &r = responder.counters();
+    fmt::print("mode        {}\n", parser.get<int>("rate") > 0 ? fmt::format("open loop, {} queries/s target", parser.get<int>("rate"))
+                                                               : fmt::format("closed loop, window {}", parser.get<int>("window")));
+    fmt::print("queries     {} sent, {} completed in {:.3f}s, {:.0f} queries/s\n", c.sent, c.completed, load.elapsed(),
+               load.elapsed() > 0 ? c.completed / load.elapsed() : 0.0);
+    fmt::print("results     {} noerror, {} nxdomain, {} other rcode, {} timeout, {} error, {} retransmits\n",
+               c.ok, c.nxdomain, c.other_rcode, c.timeouts, c.errors, c.retransmits);
+    fmt::print("responder   {} received, {} answered, {} dropped, {} truncated, {} over tcp\n",
+               r.received.load(), r.answered.load(), r.dropped.load(), r.truncated.load(), r.tcp_queries.load());
+    fmt::print("latency ms  min {:.3f}  p50 {:.3f}  p90 {:.3f}  p99 {:.3f}  p99.9 {:.3f}  max {:.3f}  mean {:.3f}\n",
+               h.min() / 1e3, h.value_at_percentile(50) / 1e3, h.value_at_percentile(90) / 1e3, h.value_at_percentile(99) / 1e3,
+               h.value_at_percentile(99.9) / 1e3, h.max() / 1e3, h.mean() / 1e3);
+    return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef DNS_CLIENT_HDR_HISTOGRAM_H
+#define DNS_CLIENT_HDR_HISTOGRAM_H
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// High dynamic range histogram in the spirit of HdrHistogram: values below 2^sub_bits are
+// counted exactly, above that every power of two range is split into 2^(sub_bits-1) linear
+// sub buckets, so any recorded value is kept to within 2^-(sub_bits-1) of itself (0.1% for
+// the default 11 bits) over the full 64-bit range with a few tens of KB of counters.
+class hdr_histogram {
+public:
+    explicit hdr_histogram(unsigned int sub_bits = 11)
+        : sub_bits_(sub_bits), half_(uint64_t(1) << (sub_bits - 1)), counts_((64 - sub_bits + 2) * half_, 0) {}
+
+    void record(uint64_t value, uint64_t count = 1) {
+        counts_[index_of(value)] += count;
+        total_ += count;
+        sum_ += value * count;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t min() const { return total_ == 0 ? 0 : min_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ == 0 ? 0 : (double) sum_ / (double) total_; }
+
+    // smallest recorded value v such that `percentile` percent of all values are <= v
+    // (within the histogram's precision)
+    uint64_t value_at_percentile(double percentile) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t) ((percentile / 100.0) * (double) total_ + 0.5);
+        rank = std::clamp<uint64_t>(rank, 1, total_);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(highest_of(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    void reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_ = 0;
+        sum_ = 0;
+        min_ = UINT64_MAX;
+        max_ = 0;
+    }
+
+private:
+    size_t index_of(uint64_t value) const {
+        if (value < 2 * half_) {
+            return (size_t) value;
+        }
+        unsigned int shift = (unsigned int) std::bit_width(value) - sub_bits_;
+        // value >> shift lies in [half, 2 * half)
+        return (size_t) ((shift + 1) * half_ + ((value >> shift) - half_));
+    }
+
+    uint64_t highest_of(size_t index) const {
+        if (index < 2 * half_) {
+            return index;
+        }
+        uint64_t shift = index / half_ - 1;
+        uint64_t sub = index % half_ + half_;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    unsigned int sub_bits_;
+    uint64_t half_;
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
+
+#endif//DNS_CLIENT_HDR_HISTOGRAM_H
@@ -0,0 +1,399 @@
+// per-packet cost of the hot paths: query encoding and response parsing, in ns and heap
+// allocations per packet, over a corpus of real-world shaped responses (long CNAME chains,
+// heavy name compression, large answer / authority / additional sections).
+// The corpus is generated unless --corpus points at a file of 2-byte length prefixed packets
+// (the DNS over TCP framing); --write-corpus saves the generated one in that format.
+#include "../dns.h"
+#include "../dns_message.h"
+#include "../dns_printer.h"
+#include "../dns_query_encoder.h"
+#include <cmdline.h>
+#include <fmt/format.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using bench_clock = std::chrono::steady_clock;
+
+//==========allocation counting==========
+// every replaceable form of new / delete is replaced, so no allocation bypasses the counter
+// and the library's own pairs never meet ours
+static std::atomic<size_t> g_allocations{0};
+
+static void *counted_alloc(size_t size, size_t align = 0) noexcept {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    size = size == 0 ? 1 : size;
+    if (align <= alignof(std::max_align_t)) {
+        return malloc(size);
+    }
+    return aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+static void *counted_new(size_t size, size_t align = 0) {
+    if (void *p = counted_alloc(size, align)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size) { return counted_new(size); }
+void *operator new[](size_t size) { return counted_new(size); }
+void *operator new(size_t size, std::align_val_t align) { return counted_new(size, static_cast<size_t>(align)); }
+void *operator new[](size_t size, std::align_val_t align) { return counted_new(size, static_cast<size_t>(align)); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size); }
+void *operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return counted_alloc(size, static_cast<size_t>(align));
+}
+void *operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return counted_alloc(size, static_cast<size_t>(align));
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { free(p); }
+
+//==========corpus==========
+// response builder with RFC 1035 name compression: every suffix written once is reused
+class packet_builder {
+public:
+    packet_builder(unsigned short id, unsigned short rcode, const string &qname, unsigned short qtype) {
+        put16(id);
+        put16(0x8180 | rcode);
+        put16(1);
+        put16(0);
+        put16(0);
+        put16(0);
+        name(qname);
+        put16(qtype);
+        put16(DNS::DNS_CLASS_IN);
+    }
+
+    // section 0 answer, 1 authority, 2 additional; a SOA takes mname as rdata_name and rname as second_name
+    void record(int section, const string &owner, unsigned short type, unsigned int ttl, const string &rdata_name = "",
+                const string &raw = "", const string &second_name = "") {
+        name(owner);
+        put16(type);
+        put16(DNS::DNS_CLASS_IN);
+        put16(ttl >> 16);
+        put16(ttl & 0xffff);
+        size_t len_pos = out_.size();
+        put16(0);
+        if (type == DNS::DNS_TYPE_MX) {
+            put16(10);
+        }
+        out_ += raw;
+        if (!rdata_name.empty()) {
+            name(rdata_name);
+        }
+        if (!second_name.empty()) {
+            name(second_name);
+        }
+        if (type == DNS::DNS_TYPE_SOA) {
+            for (int i = 0; i < 5; i++) {
+                put16(0);
+                put16(3600);
+            }
+        }
+        size_t len = out_.size() - len_pos - 2;
+        out_[len_pos] = (char) (len >> 8);
+        out_[len_pos + 1] = (char) len;
+        int count_pos = 6 + section * 2;
+        unsigned short count = (unsigned short) (((unsigned char) out_[count_pos] << 8 | (unsigned char) out_[count_pos + 1]) + 1);
+        out_[count_pos] = (char) (count >> 8);
+        out_[count_pos + 1] = (char) count;
+    }
+
+    const string &packet() const { return out_; }
+
+private:
+    void put16(unsigned int value) {
+        out_.push_back((char) (value >> 8));
+        out_.push_back((char) value);
+    }
+
+    void name(const string &host) {
+        size_t begin = 0;
+        while (begin < host.size()) {
+            auto it = suffixes_.find(host.substr(begin));
+            if (it != suffixes_.end()) {
+                put16(0xc000 | it->second);
+                return;
+            }
+            if (out_.size() < 0x3fff) {
+                suffixes_[host.substr(begin)] = (unsigned short) out_.size();
+            }
+            size_t end = min(host.find('.', begin), host.size());
+            out_.push_back((char) (end - begin));
+            out_.append(host, begin, end - begin);
+            begin = end + 1;
+        }
+        out_.push_back(0);
+    }
+
+    string out_;
+    unordered_map<string, unsigned short> suffixes_;
+};
+
+static string v4(int a, int b) { return string{10, 0, (char) a, (char) b}; }
+static string v6(int a) {
+    string addr(16, 0);
+    addr[0] = 0x20;
+    addr[1] = 0x01;
+    addr[15] = (char) a;
+    return addr;
+}
+
+static vector<string> make_corpus() {
+    vector<string> corpus;
+    for (int n = 0; n < 64; n++) {
+        string zone = fmt::format("service{}.example{}.com", n, n % 7);
+        // plain single A answer, the common case
+        {
+            packet_builder b(n, 0, "www." + zone, DNS::DNS_TYPE_A);
+            b.record(0, "www." + zone, DNS::DNS_TYPE_A, 300, "", v4(n, 1));
+            corpus.push_back(b.packet());
+        }
+        // CDN style CNAME chain of 8 hops ending in 4 A records
+        {
+            packet_builder b(n, 0, "img." + zone, DNS::DNS_TYPE_A);
+            string owner = "img." + zone;
+            for (int hop = 0; hop < 8; hop++) {
+                string target = fmt::format("edge{}-{}.cdn{}.akadns-like.net", hop, n, hop % 3);
+                b.record(0, owner, DNS::DNS_TYPE_CNAME, 60, target);
+                owner = target;
+            }
+            for (int i = 0; i < 4; i++) {
+                b.record(0, owner, DNS::DNS_TYPE_A, 20, "", v4(n, i));
+            }
+            corpus.push_back(b.packet());
+        }
+        // many AAAA records
+        {
+            packet_builder b(n, 0, "v6." + zone, DNS::DNS_TYPE_AAAA);
+            for (int i = 0; i < 16; i++) {
+                b.record(0, "v6." + zone, DNS::DNS_TYPE_AAAA, 300, "", v6(i));
+            }
+            corpus.push_back(b.packet());
+        }
+        // referral shaped: 13 NS in authority with A and AAAA glue in additional
+        {
+            packet_builder b(n, 0, "deep.sub." + zone, DNS::DNS_TYPE_A);
+            for (int i = 0; i < 13; i++) {
+                b.record(1, zone, DNS::DNS_TYPE_NS, 172800, fmt::format("{}.ns.{}", (char) ('a' + i), zone));
+            }
+            for (int i = 0; i < 13; i++) {
+                b.record(2, fmt::format("{}.ns.{}", (char) ('a' + i), zone), DNS::DNS_TYPE_A, 172800, "", v4(n, i));
+                b.record(2, fmt::format("{}.ns.{}", (char) ('a' + i), zone), DNS::DNS_TYPE_AAAA, 172800, "", v6(i));
+            }
+            corpus.push_back(b.packet());
+        }
+        // NXDOMAIN with SOA
+        {
+            packet_builder b(n, DNS::DNS_RCODE_NXDOMAIN, "missing." + zone, DNS::DNS_TYPE_A);
+            b.record(1, zone, DNS::DNS_TYPE_SOA, 900, "ns1." + zone, "", "hostmaster." + zone);
+            corpus.push_back(b.packet());
+        }
+        // MX set with A glue
+        {
+            packet_builder b(n, 0, zone, DNS::DNS_TYPE_MX);
+            for (int i = 0; i < 5; i++) {
+                b.record(0, zone, DNS::DNS_TYPE_MX, 3600, fmt::format("mx{}.mail.{}", i, zone));
+                b.record(2, fmt::format("mx{}.mail.{}", i, zone), DNS::DNS_TYPE_A, 3600, "", v4(n, i));
+            }
+            corpus.push_back(b.packet());
+        }
+    }
+    return corpus;
+}
+
+static bool load_corpus(const string &path, vector<string> &corpus) {
+    ifstream in(path, ios::binary);
+    unsigned char len_buf[2];
+    while (in.read((char *) len_buf, 2)) {
+        string packet((len_buf[0] << 8) | len_buf[1], '\0');
+        if (!in.read(packet.data(), (streamsize) packet.size())) {
+            return false;
+        }
+        corpus.push_back(std::move(packet));
+    }
+    return !corpus.empty();
+}
+
+static void save_corpus(const string &path, const vector<string> &corpus) {
+    ofstream out(path, ios::binary);
+    for (const string &packet : corpus) {
+        out.put((char) (packet.size() >> 8));
+        out.put((char) packet.size());
+        out.write(packet.data(), (streamsize) packet.size());
+    }
+}
+
+//==========benchmarks==========
+template<class Body>
+static void run(const char *label, size_t iterations, size_t packets, Body body) {
+    size_t checksum = body();// warm up, and the allocation count below excludes first-touch
+    size_t allocations = g_allocations.load();
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        checksum += body();
+    }
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+    double cnt = (double) iterations * (double) packets;
+    fmt::print(stderr, "{:<34} {:>9.1f} ns/packet  {:>7.2f} allocs/packet  (checksum {})\n", label, secs * 1e9 / cnt,
+               (double) (g_allocations.load() - allocations) / cnt, checksum);
+}
+
+// everything a consumer of the view touches: every name and every rdata decoded
+static size_t walk(const DNS::DnsMessageView &msg) {
+    char buf[512];
+    size_t sum = msg.rcode();
+    for (const DNS::DnsQuestionView &q : msg.questions()) {
+        sum += q.host.to_string(buf, sizeof(buf)) + q.query_type;
+    }
+    for (const DNS::DnsRecordView &res : msg.records()) {
+        sum += res.host.to_string(buf, sizeof(buf)) + res.ttl;
+        sum += DNS::FormatRecordData(res, buf, sizeof(buf));
+    }
+    return sum;
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser parser;
+    parser.add<string>("corpus", '\0', "length prefixed response corpus to load instead of the generated one", false);
+    parser.add<string>("write-corpus", '\0', "save the generated corpus and exit", false);
+    parser.add<int>("iterations", 'i', "passes over the corpus", false, 2000);
+    parser.add("print", '\0', "also time ParseDnsResponsePacket, the interactive table printer, with stdout to /dev/null");
+    parser.parse_check(argc, argv);
+
+    vector<string> corpus;
+    if (parser.exist("corpus")) {
+        if (!load_corpus(parser.get<string>("corpus"), corpus)) {
+            fmt::print(stderr, "can not load corpus {}\n", parser.get<string>("corpus"));
+            return -1;
+        }
+    } else {
+        corpus = make_corpus();
+    }
+    if (parser.exist("write-corpus")) {
+        save_corpus(parser.get<string>("write-corpus"), corpus);
+        return 0;
+    }
+    size_t bytes = 0;
+    size_t records = 0;
+    vector<string> names;
+    for (const string &packet : corpus) {
+        bytes += packet.size();
+        DNS::DnsMessageView msg(packet.data(), (int) packet.size());
+        if (msg.valid() && !msg.questions().empty()) {
+            names.push_back((*msg.questions().begin()).host.str());
+            for (const DNS::DnsRecordView &res : msg.records()) {
+                records += res.host.valid();
+                DNS::DnsSoaView soa{};
+                if (res.domain_type == DNS::DNS_TYPE_SOA && !res.soa(soa)) {
+                    fmt::print(stderr, "malformed SOA record in the corpus\n");
+                    return -1;
+                }
+            }
+        }
+    }
+    if (names.size() != corpus.size()) {
+        fmt::print(stderr, "{} of {} packets in the corpus do not parse\n", corpus.size() - names.size(), corpus.size());
+        return -1;
+    }
+    fmt::print(stderr, "corpus: {} packets, {:.0f} bytes and {:.1f} records on average\n", corpus.size(),
+               (double) bytes / corpus.size(), (double) records / corpus.size());
+    size_t iterations = parser.get<int>("iterations");
+
+    //==========encode==========
+    run("BuildDnsQueryPacket", iterations, names.size(), [&names] {
+        char buf[DNS::DNS_MAX_QUERY_SIZE];
+        size_t sum = 0;
+        for (const string &name : names) {
+            sum += DNS::BuildDnsQueryPacket(name.c_str(), buf, 0, sizeof(buf), 0x1234, DNS::DNS_TYPE_A, DNS::DNS_EDNS_PAYLOAD_SIZE);
+        }
+        return sum;
+    });
+    dns_query_encoder encoder(0, DNS::DNS_EDNS_PAYLOAD_SIZE);
+    run("dns_query_encoder::encode", iterations, names.size(), [&names, &encoder] {
+        char buf[DNS::DNS_MAX_QUERY_SIZE];
+        size_t sum = 0;
+        for (const string &name : names) {
+            sum += encoder.encode(name, DNS::DNS_TYPE_A, 0x1234, buf, sizeof(buf));
+        }
+        return sum;
+    });
+
+    //==========parse==========
+    run("DnsMessageView (header + sections)", iterations, corpus.size(), [&corpus] {
+        size_t sum = 0;
+        for (const string &packet : corpus) {
+            DNS::DnsMessageView msg(packet.data(), (int) packet.size());
+            sum += msg.valid() + msg.length();
+        }
+        return sum;
+    });
+    run("DnsMessageView (every name, rdata)", iterations, corpus.size(), [&corpus] {
+        size_t sum = 0;
+        for (const string &packet : corpus) {
+            sum += walk(DNS::DnsMessageView(packet.data(), (int) packet.size()));
+        }
+        return sum;
+    });
+    run("GetCacheTtl", iterations, corpus.size(), [&corpus] {
+        size_t sum = 0;
+        for (const string &packet : corpus) {
+            unsigned int ttl = 0;
+            sum += DNS::GetCacheTtl(packet.data(), (int) packet.size(), ttl) + ttl;
+        }
+        return sum;
+    });
+    fmt::memory_buffer lines;
+    run("FormatDnsResponseLines", iterations, corpus.size(), [&corpus, &names, &lines] {
+        size_t sum = 0;
+        for (size_t i = 0; i < corpus.size(); i++) {
+            lines.clear();
+            DNS::FormatDnsResponseLines(lines, names[i], DNS::DnsMessageView(corpus[i].data(), (int) corpus[i].size()));
+            sum += lines.size();
+        }
+        return sum;
+    });
+
+    if (parser.exist("print")) {
+        // the table renderer is orders of magnitude slower, a few passes are enough
+        fflush(stdout);
+        int saved = dup(STDOUT_FILENO);
+        FILE *null = freopen("/dev/null", "w", stdout);
+        run("ParseDnsResponsePacket (tables)", std::max<size_t>(iterations / 2000, 1), corpus.size(), [&corpus] {
+            size_t sum = 0;
+            for (const string &packet : corpus) {
+                sum += DNS::ParseDnsResponsePacket(packet.data(), (int) packet.size()) + 1;
+            }
+            return sum;
+        });
+        fflush(stdout);
+        if (null != nullptr && saved >= 0) {
+            dup2(saved, STDOUT_FILENO);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+// queries/sec encoded: DNS::BuildDnsQueryPacket against dns_query_encoder and its template cache
+#include "../dns.h"
+#include "../dns_query_encoder.h"
+#include <cmdline.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using bench_clock = std::chrono::steady_clock;
+
+static vector<string> make_names(size_t cnt) {
+    static const char *suffixes[] = {"com", "net", "org", "cn", "example.co.uk", "cdn.cloudprovider.net"};
+    std::mt19937 rng(42);
+    vector<string> names;
+    names.reserve(cnt);
+    for (size_t i = 0; i < cnt; i++) {
+        names.push_back(fmt::format("host-{}.service{}.{}", i, rng() % 1000, suffixes[rng() % 6]));
+    }
+    return names;
+}
+
+// one timed pass, returns ns per query
+template<class Encode>
+static double run(const vector<string> &names, const vector<unsigned int> &order, size_t &checksum, Encode encode) {
+    char buf[DNS::DNS_MAX_QUERY_SIZE];
+    size_t bytes = 0;
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < order.size(); i++) {
+        int len = encode(names[order[i]], (unsigned short) i, buf, sizeof(buf));
+        bytes += len > 0 ? len + buf[0] : 0;
+    }
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+    checksum = bytes;
+    return secs * 1e9 / order.size();
+}
+
+static void report(const char *label, double ns, size_t checksum) {
+    fmt::print("{:<40} {:>12.0f} queries/s  {:>7.1f} ns/query  (checksum {})\n", label, 1e9 / ns, ns, checksum);
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser parser;
+    parser.add<int>("names", 'n', "distinct names", false, 300000);
+    parser.add<int>("queries", 'q', "queries encoded per round", false, 1000000);
+    parser.add<int>("rounds", 'r', "interleaved rounds, the fastest one of each encoder is reported", false, 15);
+    parser.parse_check(argc, argv);
+
+    vector<string> names = make_names(parser.get<int>("names"));
+    // zipf-like reuse: most queries hit a small hot set, like a real resolver workload
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    vector<unsigned int> order(parser.get<int>("queries"));
+    for (auto &index : order) {
+        index = (unsigned int) (names.size() * dist(rng) * dist(rng) * dist(rng));
+    }
+    vector<bool> seen(names.size());
+    size_t distinct = 0;
+    for (auto index : order) {
+        distinct += !seen[index];
+        seen[index] = true;
+    }
+    fmt::print("{} queries per round over {} distinct names\n", order.size(), distinct);
+    // every name once, like a bulk run over a list of unique names
+    vector<unsigned int> once(names.size());
+    for (size_t i = 0; i < once.size(); i++) {
+        once[i] = (unsigned int) i;
+    }
+
+    auto build = [](const string &host, unsigned short id, char *buf, int len) {
+        return DNS::BuildDnsQueryPacket(host.c_str(), buf, 0, len, id);
+    };
+    dns_query_encoder encoder;
+    auto encode = [&encoder](const string &host, unsigned short id, char *buf, int len) {
+        return encoder.encode(host, DNS::DNS_TYPE_A, id, buf, len);
+    };
+    dns_query_encoder cache(dns_query_encoder::s_cache_entries);
+    auto cached = [&cache](const string &host, unsigned short id, char *buf, int len) {
+        return cache.encode(host, DNS::DNS_TYPE_A, id, buf, len);
+    };
+
+    // on a shared box single runs are noisy, rounds alternate between the encoders
+    const char *labels[6] = {"BuildDnsQueryPacket", "dns_query_encoder", "dns_query_encoder (template cache)",
+                             "BuildDnsQueryPacket (unique names)", "dns_query_encoder (unique names)",
+                             "dns_query_encoder (cache, unique names)"};
+    double best[6] = {1e18, 1e18, 1e18, 1e18, 1e18, 1e18};
+    size_t checksums[6] = {0};
+    for (int round = 0; round < std::max(parser.get<int>("rounds"), 1); round++) {
+        best[0] = std::min(best[0], run(names, order, checksums[0], build));
+        best[1] = std::min(best[1], run(names, order, checksums[1], encode));
+        best[2] = std::min(best[2], run(names, order, checksums[2], cached));
+        best[3] = std::min(best[3], run(names, once, checksums[3], build));
+        best[4] = std::min(best[4], run(names, once, checksums[4], encode));
+        best[5] = std::min(best[5], run(names, once, checksums[5], cached));
+    }
+    for (int i = 0; i < 6; i++) {
+        report(labels[i], best[i], checksums[i]);
+    }
+    fmt::print("speedup {:.2f}x ({:.2f}x with the template cache), unique names {:.2f}x ({:.2f}x), {} templates cached\n",
+               best[0] / best[1], best[0] / best[2], best[3] / best[4], best[3] / best[5], cache.size());
+    return 0;
+}
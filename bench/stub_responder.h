@@ -0,0 +1,412 @@
+#ifndef DNS_CLIENT_STUB_RESPONDER_H
+#define DNS_CLIENT_STUB_RESPONDER_H
+
+#include <utility>
+#include "asio.hpp"
+#include "../dns.h"
+#include "../dns_message.h"
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using asio::ip::tcp;
+using asio::ip::udp;
+
+// Minimal in-process authoritative responder for benchmarks, on its own thread and
+// io_context. Answers A / AAAA / CNAME / NS / PTR / MX / TXT from a zone, NXDOMAIN with a SOA
+// for anything else, and can drop, delay or truncate a share of the udp replies.
+// Truncated queries are answered in full over tcp on the same port.
+class stub_responder {
+public:
+    struct options {
+        double loss = 0;    // share of udp queries dropped
+        double truncate = 0;// share of udp replies sent empty with TC set
+        std::chrono::microseconds delay{0};// added to every udp reply
+    };
+
+    struct stats {
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> answered{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> truncated{0};
+        std::atomic<uint64_t> tcp_queries{0};
+    };
+
+    explicit stub_responder(const options &opts)
+        : opts_(opts), sock_(ios_, udp::endpoint(asio::ip::make_address("127.0.0.1"), 0)),
+          acceptor_(ios_, tcp::endpoint(asio::ip::make_address("127.0.0.1"), sock_.local_endpoint().port())),
+          delay_timer_(ios_), rng_(std::random_device{}()) {
+        sock_.non_blocking(true);
+        asio::socket_base::receive_buffer_size size(8 << 20);
+        asio::error_code ignored;
+        sock_.set_option(size, ignored);
+        sock_.set_option(asio::socket_base::send_buffer_size(8 << 20), ignored);
+    }
+
+    ~stub_responder() { stop(); }
+
+    // "name type ttl data" per line, # comments
+    bool load_zone(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string name, type, data;
+            unsigned int ttl = 0;
+            if (line.empty() || line[0] == '#' || !(fields >> name >> type >> ttl) || !std::getline(fields >> std::ws, data)) {
+                continue;
+            }
+            if (!add_record(name, type, ttl, data)) {
+                fmt::print(stderr, "zone: skipped {}\n", line);
+            }
+        }
+        return true;
+    }
+
+    // host0.<origin> .. host<cnt-1>.<origin>, one A record each
+    void generate_zone(size_t cnt, const std::string &origin) {
+        for (size_t i = 0; i < cnt; i++) {
+            add_record(fmt::format("host{}.{}", i, origin), "A", 300, fmt::format("10.{}.{}.{}", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff));
+        }
+    }
+
+    bool add_record(const std::string &name, const std::string &type, unsigned int ttl, const std::string &data) {
+        std::string rdata;
+        unsigned short qtype = 0;
+        unsigned char addr[16];
+        if (type == "A" && inet_pton(AF_INET, data.c_str(), addr) == 1) {
+            qtype = DNS::DNS_TYPE_A;
+            rdata.assign((char *) addr, 4);
+        } else if (type == "AAAA" && inet_pton(AF_INET6, data.c_str(), addr) == 1) {
+            qtype = DNS::DNS_TYPE_AAAA;
+            rdata.assign((char *) addr, 16);
+        } else if (type == "CNAME" || type == "NS" || type == "PTR") {
+            qtype = type == "CNAME" ? DNS::DNS_TYPE_CNAME : type == "NS" ? DNS::DNS_TYPE_NS : DNS::DNS_TYPE_PTR;
+            if (!encode_name(data, rdata)) {
+                return false;
+            }
+        } else if (type == "MX") {
+            std::istringstream fields(data);
+            unsigned int preference = 0;
+            std::string exchange;
+            if (!(fields >> preference >> exchange)) {
+                return false;
+            }
+            qtype = DNS::DNS_TYPE_MX;
+            rdata.push_back((char) (preference >> 8));
+            rdata.push_back((char) preference);
+            if (!encode_name(exchange, rdata)) {
+                return false;
+            }
+        } else if (type == "TXT") {
+            qtype = DNS::DNS_TYPE_TXT;
+            for (size_t i = 0; i < data.size(); i += 255) {
+                std::string chunk = data.substr(i, 255);
+                rdata.push_back((char) chunk.size());
+                rdata += chunk;
+            }
+        } else {
+            return false;
+        }
+        std::string key = canonical(name);
+        auto &records = zone_[key];
+        records.push_back({qtype, ttl, std::move(rdata)});
+        names_.push_back(key);
+        return true;
+    }
+
+    // names with at least one record, as loaded (duplicates for several records)
+    const std::vector<std::string> &names() const { return names_; }
+    unsigned short port() const { return sock_.local_endpoint().port(); }
+    const stats &counters() const { return stats_; }
+
+    void start() {
+        receive();
+        accept();
+        thread_ = std::thread([this] { ios_.run(); });
+    }
+
+    void stop() {
+        if (thread_.joinable()) {
+            ios_.stop();
+            thread_.join();
+        }
+    }
+
+private:
+    struct record {
+        unsigned short type;
+        unsigned int ttl;
+        std::string rdata;
+    };
+
+    struct name_hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+
+    struct delayed_reply {
+        std::chrono::steady_clock::time_point due;
+        udp::endpoint to;
+        std::string packet;
+    };
+
+    static std::string canonical(std::string name) {
+        if (!name.empty() && name.back() == '.') {
+            name.pop_back();
+        }
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char ch) { return (char) std::tolower(ch); });
+        return name;
+    }
+
+    static bool encode_name(const std::string &name, std::string &out) {
+        std::string host = canonical(name);
+        size_t begin = 0;
+        while (begin < host.size()) {
+            size_t end = std::min(host.find('.', begin), host.size());
+            if (end == begin || end - begin > 63) {
+                return false;
+            }
+            out.push_back((char) (end - begin));
+            out.append(host, begin, end - begin);
+            begin = end + 1;
+        }
+        out.push_back(0);
+        return true;
+    }
+
+    static void put16(std::string &out, unsigned int value) {
+        out.push_back((char) (value >> 8));
+        out.push_back((char) value);
+    }
+
+    static void put32(std::string &out, unsigned int value) {
+        put16(out, value >> 16);
+        put16(out, value & 0xffff);
+    }
+
+    // the full answer to a query, or an empty string if it is not worth answering.
+    // udp replies larger than the client's payload are truncated.
+    std::string answer(const char *query, size_t len, bool udp, bool force_truncate) {
+        DNS::DnsMessageView msg(query, (int) len);
+        if (!msg.valid() || msg.response() || msg.questions().size() != 1) {
+            return {};
+        }
+        DNS::DnsQuestionView question = *msg.questions().begin();
+        char name[256];
+        int name_len = question.host.to_string(name, sizeof(name));
+        if (name_len < 0) {
+            return {};
+        }
+        for (int i = 0; i < name_len; i++) {
+            name[i] = (char) std::tolower((unsigned char) name[i]);
+        }
+        int question_end = DNS::SkipName(msg.bytes(), DNS::DNS_HEADER_SIZE) + 4;
+        DNS::DnsOptView opt{};
+        bool edns = msg.edns(opt);
+        size_t payload = edns ? std::max<size_t>(opt.udp_payload, 512) : 512;
+
+        std::string out;
+        out.reserve(512);
+        put16(out, msg.id());
+        auto it = zone_.find(std::string_view(name, name_len));
+        unsigned short rcode = it == zone_.end() ? DNS::DNS_RCODE_NXDOMAIN : DNS::DNS_RCODE_NOERROR;
+        put16(out, 0x8400 | (msg.header().flags & 0x0100) | rcode);// QR AA, RD echoed
+        put16(out, 1);
+        put16(out, 0);
+        put16(out, 0);
+        put16(out, edns ? 1 : 0);
+        out.append(query + DNS::DNS_HEADER_SIZE, question_end - DNS::DNS_HEADER_SIZE);
+
+        unsigned short answers = 0;
+        if (it != zone_.end()) {
+            for (const record &rr : it->second) {
+                if (rr.type != question.query_type && rr.type != DNS::DNS_TYPE_CNAME) {
+                    continue;
+                }
+                put16(out, 0xc000 | DNS::DNS_HEADER_SIZE);
+                put16(out, rr.type);
+                put16(out, DNS::DNS_CLASS_IN);
+                put32(out, rr.ttl);
+                put16(out, (unsigned int) rr.rdata.size());
+                out += rr.rdata;
+                answers++;
+            }
+        }
+        unsigned short authorities = 0;
+        if (rcode == DNS::DNS_RCODE_NXDOMAIN || answers == 0) {
+            // negative answers carry the zone SOA so they can be cached (RFC 2308)
+            put16(out, 0xc000 | DNS::DNS_HEADER_SIZE);
+            put16(out, DNS::DNS_TYPE_SOA);
+            put16(out, DNS::DNS_CLASS_IN);
+            put32(out, 60);
+            std::string soa;
+            encode_name("ns.stub", soa);
+            encode_name("hostmaster.stub", soa);
+            for (unsigned int value : {1u, 3600u, 600u, 86400u, 60u}) {
+                put32(soa, value);
+            }
+            put16(out, (unsigned int) soa.size());
+            out += soa;
+            authorities = 1;
+        }
+        if (edns) {
+            out.push_back(0);
+            put16(out, DNS::DNS_TYPE_OPT);
+            put16(out, DNS::DNS_MAX_EDNS_PAYLOAD_SIZE);
+            put32(out, 0);
+            put16(out, 0);
+        }
+        out[7] = (char) answers;
+        out[6] = (char) (answers >> 8);
+        out[9] = (char) authorities;
+
+        if (udp && (force_truncate || out.size() > payload)) {
+            // header + question (+ OPT) only, with TC set
+            std::string tc = out.substr(0, question_end);
+            tc[2] |= (char) (DNS::DNS_FLAG_TC >> 8);
+            tc[6] = tc[7] = tc[8] = tc[9] = 0;
+            if (edns) {
+                tc += out.substr(out.size() - DNS::DNS_OPT_RECORD_SIZE);
+            }
+            stats_.truncated++;
+            return tc;
+        }
+        return out;
+    }
+
+    void receive() {
+        sock_.async_wait(udp::socket::wait_read, [this](const asio::error_code &err) {
+            if (err) {
+                return;
+            }
+            char buf[4096];
+            udp::endpoint from;
+            asio::error_code read_err;
+            std::uniform_real_distribution<double> dist(0, 1);
+            // drain everything that is queued before waiting again
+            for (;;) {
+                size_t len = sock_.receive_from(asio::buffer(buf), from, 0, read_err);
+                if (read_err) {
+                    break;
+                }
+                stats_.received++;
+                if (opts_.loss > 0 && dist(rng_) < opts_.loss) {
+                    stats_.dropped++;
+                    continue;
+                }
+                std::string reply = answer(buf, len, true, opts_.truncate > 0 && dist(rng_) < opts_.truncate);
+                if (reply.empty()) {
+                    continue;
+                }
+                if (opts_.delay.count() > 0) {
+                    delayed_.push_back({std::chrono::steady_clock::now() + opts_.delay, from, std::move(reply)});
+                    if (delayed_.size() == 1) {
+                        arm_delay();
+                    }
+                    continue;
+                }
+                send(reply, from);
+            }
+            receive();
+        });
+    }
+
+    void send(const std::string &reply, const udp::endpoint &to) {
+        asio::error_code err;
+        sock_.send_to(asio::buffer(reply), to, 0, err);
+        if (!err) {
+            stats_.answered++;
+        }
+    }
+
+    // the delay is the same for every reply, so the queue is already in due order
+    void arm_delay() {
+        delay_timer_.expires_at(delayed_.front().due);
+        delay_timer_.async_wait([this](const asio::error_code &err) {
+            if (err) {
+                return;
+            }
+            auto now = std::chrono::steady_clock::now();
+            while (!delayed_.empty() && delayed_.front().due <= now) {
+                send(delayed_.front().packet, delayed_.front().to);
+                delayed_.pop_front();
+            }
+            if (!delayed_.empty()) {
+                arm_delay();
+            }
+        });
+    }
+
+    struct tcp_session {
+        explicit tcp_session(tcp::socket sock) : sock(std::move(sock)) {}
+        tcp::socket sock;
+        unsigned char len_buf[2] = {0};
+        std::vector<char> query;
+        std::string reply;
+    };
+
+    void accept() {
+        acceptor_.async_accept([this](const asio::error_code &err, tcp::socket sock) {
+            if (err) {
+                return;
+            }
+            read_tcp(std::make_shared<tcp_session>(std::move(sock)));
+            accept();
+        });
+    }
+
+    void read_tcp(std::shared_ptr<tcp_session> session) {
+        asio::async_read(session->sock, asio::buffer(session->len_buf), [this, session](const asio::error_code &err, size_t) {
+            if (err) {
+                return;
+            }
+            session->query.resize((session->len_buf[0] << 8) | session->len_buf[1]);
+            asio::async_read(session->sock, asio::buffer(session->query), [this, session](const asio::error_code &err, size_t) {
+                if (err) {
+                    return;
+                }
+                stats_.tcp_queries++;
+                std::string reply = answer(session->query.data(), session->query.size(), false, false);
+                session->reply.clear();
+                put16(session->reply, (unsigned int) reply.size());
+                session->reply += reply;
+                asio::async_write(session->sock, asio::buffer(session->reply), [this, session](const asio::error_code &err, size_t) {
+                    if (!err) {
+                        read_tcp(session);
+                    }
+                });
+            });
+        });
+    }
+
+    options opts_;
+    asio::io_context ios_;
+    udp::socket sock_;
+    tcp::acceptor acceptor_;
+    asio::steady_timer delay_timer_;
+    std::deque<delayed_reply> delayed_;
+    std::mt19937 rng_;
+    std::unordered_map<std::string, std::vector<record>, name_hash, std::equal_to<>> zone_;
+    std::vector<std::string> names_;
+    stats stats_;
+    std::thread thread_;
+};
+
+#endif//DNS_CLIENT_STUB_RESPONDER_H
@@ -0,0 +1,75 @@
+#ifndef DNS_CLIENT_BULK_RESOLVER_H
+#define DNS_CLIENT_BULK_RESOLVER_H
+
+#include "dns_resolver.h"
+
+#include <istream>
+#include <string>
+
+// feeds host names from a stream into a resolver (dns_resolver or iterative_resolver),
+// keeping `window` queries in flight and handing every result to the handler as soon as it arrives
+template<class Resolver>
+class basic_bulk_resolver {
+public:
+    basic_bulk_resolver(Resolver &resolver, std::istream &in, size_t window, unsigned short query_type, dns_resolver::handler_type handler)
+        : resolver_(resolver),
+          in_(in),
+          window_(window == 0 ? 1 : window),
+          query_type_(query_type),
+          handler_(std::move(handler)) {}
+
+    void start() { fill(); }
+
+    size_t sent() const { return sent_; }
+    size_t completed() const { return completed_; }
+
+private:
+    bool next_host(std::string &host) {
+        while (std::getline(in_, host)) {
+            size_t first = host.find_first_not_of(" \t\r");
+            if (first == std::string::npos || host[first] == '#') {
+                continue;
+            }
+            size_t last = host.find_last_not_of(" \t\r");
+            host = host.substr(first, last - first + 1);
+            return true;
+        }
+        return false;
+    }
+
+    void fill() {
+        if (filling_) {
+            return;
+        }
+        filling_ = true;
+        std::string host;
+        while (outstanding_ < window_ && next_host(host)) {
+            outstanding_++;
+            sent_++;
+            resolver_.async_resolve(std::move(host), query_type_, [this](const dns_result &result) { on_result(result); });
+        }
+        filling_ = false;
+    }
+
+    void on_result(const dns_result &result) {
+        outstanding_--;
+        completed_++;
+        handler_(result);
+        fill();
+    }
+
+private:
+    Resolver &resolver_;
+    std::istream &in_;
+    size_t window_;
+    unsigned short query_type_;
+    dns_resolver::handler_type handler_;
+    size_t outstanding_ = 0;
+    size_t sent_ = 0;
+    size_t completed_ = 0;
+    bool filling_ = false;
+};
+
+using bulk_resolver = basic_bulk_resolver<dns_resolver>;
+
+#endif//DNS_CLIENT_BULK_RESOLVER_H
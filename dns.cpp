@@ -1,65 +1,12 @@
 #include "dns.h"
+#include "dns_message.h"
 #include <fmt/format.h>
-#include <tabulate.hpp>
 
+#include <algorithm>
 #include <cstdio>
 #include <string>
-#include <sys/ioctl.h>
-#include <assert.h>
-
-using tabulate::FontAlign;
-using tabulate::FontStyle;
-using tabulate::Table;
 
 namespace DNS {
-    std::string IPBin2Dec(const std::string &data) {
-        if (data.size() < 4) {
-            return "";
-        }
-        char buf[32] = {0};
-        snprintf(buf, sizeof(buf), "%d.%d.%d.%d",
-                 (unsigned char) data[0], (unsigned char) data[1],
-                 (unsigned char) data[2], (unsigned char) data[3]);
-        return buf;
-    }
-
-    void printSectionTag(const std::string &section_name) {
-        fmt::print(
-                "┌{0:─^{2}}┐\n"
-                "│{1: ^{2}}│\n"
-                "└{0:─^{2}}┘\n",
-                "", section_name, 20);
-    }
-
-    void PrintBuffer(const char *buf, int len) {
-        int width = 16;
-
-        for (int i = 0; i < len; i++) {
-            if (i % width == 0) {
-                fmt::print("{:<5}", i / width);
-            }
-            char ch = ' ';
-            if ((i + 1) % width == 0) {
-                ch = '\n';
-            }
-            unsigned char byte = buf[i];
-            int hi = 0x0f & (byte >> 4);
-            int lo = 0x0f & byte;
-
-            fmt::print("{:X}{:X}{}", hi, lo, ch);
-        }
-        fmt::print("\n");
-    }
-
-    int ParseUnsignedInt(const char *buf, int pos, int end, unsigned int &value) {
-        value = 0;
-        value = (unsigned char) buf[pos++];
-        value = (value << 8) | (unsigned char) buf[pos++];
-        value = (value << 8) | (unsigned char) buf[pos++];
-        value = (value << 8) | (unsigned char) buf[pos++];
-        return pos;
-    }
-
     int ParseUnsignedShort(const char *buf, int pos, int end, uint16_t &value) {
         value = 0;
         value = (unsigned char) buf[pos++];
@@ -67,256 +14,68 @@ namespace DNS {
         return pos;
     }
 
-    int ParseHost(const char *buf, int pos, int end, std::string &host) {
-        if (buf == nullptr) {
-            return pos;
-        }
-        unsigned int limit = 0xc0;
-        unsigned int len = (unsigned char) buf[pos++];
-        while (len != 0 && !(len & limit)) {
-            host.append(buf + pos, len);
-            pos += len;
-            len = (unsigned char) buf[pos++];
-            if (len != 0) {
-                host.append(".");
-            }
-        }
-        if (len & limit) {
-            unsigned int offset = ((limit ^ len) << 8) | (unsigned char) buf[pos++];
-            ParseHost(buf, offset, end, host);
-        }
-        return pos;
-    }
-
-    int ParseQuestionSection(const char *buf, int pos, int end, DNS::DnsQuestionSection &dns_question_section) {
-        pos = ParseHost(buf, pos, end, dns_question_section.host);
-        pos = ParseUnsignedShort(buf, pos, end, dns_question_section.query_type);
-        pos = ParseUnsignedShort(buf, pos, end, dns_question_section.query_class);
-        return pos;
-    }
-
-    int ParseResourceRecord(const char *buf, int pos, int end, DNS::DnsResource &dns_resource) {
-        if (buf == NULL) {
-            return pos;
+    int ParseDnsHeader(const char *buf, int end, DNS::DnsHeader &header) {
+        if (buf == nullptr || end < DNS_HEADER_SIZE) {
+            return -1;
         }
-        pos = ParseHost(buf, pos, end, dns_resource.host);
-        pos = ParseUnsignedShort(buf, pos, end, dns_resource.domain_type);
-        pos = ParseUnsignedShort(buf, pos, end, dns_resource.domain_class);
-        pos = ParseUnsignedInt(buf, pos, end, dns_resource.ttl);
-        pos = ParseUnsignedShort(buf, pos, end, dns_resource.data_len);
-        dns_resource.data_pos = pos;
-        pos += dns_resource.data_len;
+        int pos = 0;
+        pos = ParseUnsignedShort(buf, pos, end, header.id);
+        pos = ParseUnsignedShort(buf, pos, end, header.flags);
+        pos = ParseUnsignedShort(buf, pos, end, header.query_cnt);
+        pos = ParseUnsignedShort(buf, pos, end, header.answer_cnt);
+        pos = ParseUnsignedShort(buf, pos, end, header.authority_cnt);
+        pos = ParseUnsignedShort(buf, pos, end, header.additional_cnt);
         return pos;
     }
 
-    int ParseDnsRecordDataField(const char *buf, int pos, int end, DNS::DnsResource &res) {
-        uint16_t type = res.domain_type;
-        if (type == 1) {
-            res.data = IPBin2Dec(std::string(buf + res.data_pos, res.data_len));
-        } else if (type == 2 || type == 5) {
-            ParseHost(buf, res.data_pos, end, res.data);
-        } else if (type == 28) {
-            res.data = "IPV6 ADDR";
-        } else {
-            res.data = "OTHERS";
-        }
-        return 0;
-    }
-
-    int ParseDnsResponsePacket(const char *buf, int end) {
-        if (buf == nullptr) {
+    // how long a response may be cached: the smallest answer ttl, or for NXDOMAIN / NODATA
+    // min(soa ttl, soa minimum) from the authority section (RFC 2308). -1 if not cacheable.
+    int GetCacheTtl(const char *buf, int end, unsigned int &ttl) {
+        DNS::DnsMessageView msg(buf, end);
+        if (!msg.valid() || msg.truncated()) {
             return -1;
         }
-
-        // get current terminal col size
-        struct winsize w {};
-        ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-        int win_size = w.ws_col;
-
-
-        int pos = 0;
-        // query transaction id
-        uint16_t query_id = 0;
-        query_id = buf[pos++];
-        query_id = (query_id << 8) | buf[pos++];
-
-        bool req_recursive = false;
-        uint16_t opcode_info = 0;
-        // |qr| opcode |aa|tc|rd|
-        pos = ParseUnsignedShort(buf, pos, end, opcode_info);
-        if (opcode_info & 0x0f) {
-            fmt::print("dns ret code non-zero, ret = {}\n", opcode_info & 0x0f);
+        unsigned short rcode = msg.rcode();
+        if (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN) {
             return -1;
         }
-
-        int table_width = 160;
-        int subtable_width = table_width - 10;
-        bool table_flag = win_size > table_width;
-        fmt::print("window columns={}{}{}, enbale_table={}\n", win_size, table_flag ? ">" : "<", table_width, table_flag);
-
-        // generate data table
-        Table dns_package;
-        dns_package.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(table_width);
-        dns_package.add_row({"DNS Response Package"});
-
-        //============header section=================
-        std::string response_state = opcode_info & 0x80 ? "true" : "false";
-
-        uint16_t query_cnt = 0;
-        pos = ParseUnsignedShort(buf, pos, end, query_cnt);
-
-        uint16_t answer_cnt = 0;
-        pos = ParseUnsignedShort(buf, pos, end, answer_cnt);
-
-        uint16_t authority_cnt = 0;
-        pos = ParseUnsignedShort(buf, pos, end, authority_cnt);
-
-        uint16_t additional_cnt = 0;
-        pos = ParseUnsignedShort(buf, pos, end, additional_cnt);
-
-        if (!table_flag) {
-            printSectionTag("header section");
-            fmt::print("query id: {}\nrecursived response: {}\nquery_cnt: {}\nanswer_cnt: {}\nauthority_cnt: {}\naddtional_cnt: {}\n",
-                       query_id,
-                       response_state,
-                       query_cnt,
-                       answer_cnt,
-                       authority_cnt,
-                       additional_cnt);
-        }
-
-        Table header;
-        header.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
-        header.add_row({"response header"});
-        Table header_section;
-        header_section.add_row({"query id", "recursived response", "query_cnt", "answer_cnt", "authority_cnt", "addtional_cnt"});
-        header_section.add_row({std::to_string(query_id), response_state, std::to_string(query_cnt), std::to_string(answer_cnt), std::to_string(authority_cnt), std::to_string(additional_cnt)});
-        header.add_row({header_section});
-        header[1].format().hide_border_top();
-        dns_package.add_row({header});
-        dns_package[1].format().hide_border_top();
-
-
-        //============query section=================
-        Table query;
-        query.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
-        query.add_row({"query section"});
-        Table query_section;
-        query_section.add_row({"host", "type", "class"});
-        if (!table_flag) {
-            printSectionTag("query section");
-        }
-
-        for (int i = 0; i < query_cnt; i++) {
-            DNS::DnsQuestionSection dns_question;
-            pos = ParseQuestionSection(buf, pos, end, dns_question);
-            query_section.add_row({dns_question.host, std::to_string(dns_question.query_type), std::to_string(dns_question.query_class)});
-            if (!table_flag) {
-                fmt::print("host: {} type: {} class: {}\n", dns_question.host, dns_question.query_type, dns_question.query_class);
-            }
-        }
-
-        query.add_row({query_section});
-        query[1].format().hide_border_top();
-        dns_package.add_row({query});
-        dns_package[2].format().hide_border_top();
-
-
-        //===========answer section=================
-        Table answer;
-        answer.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
-        answer.add_row({"answer section"});
-        Table answer_section;
-        answer_section.add_row({fmt::format("{:<55}", "host"), "type", "class", "ttl", "dlen", fmt::format("{:<55}", "data")});
-        if (!table_flag) {
-            printSectionTag("answer section");
-        }
-
-
-        for (int i = 0; i < answer_cnt; i++) {
-            DNS::DnsResource res;
-            pos = ParseResourceRecord(buf, pos, end, res);
-            ParseDnsRecordDataField(buf, pos, end, res);
-            answer_section.add_row({res.host, std::to_string(res.domain_type), std::to_string(res.domain_class), std::to_string(res.ttl), std::to_string(res.data_len), res.data});
-            if (!table_flag) {
-                fmt::print("host={}, type={}, class={}, ttl={}, dlen={}, data={}\n",
-                           res.host,
-                           res.domain_type,
-                           res.domain_class,
-                           res.ttl,
-                           res.data_len,
-                           res.data);
-            }
+        bool found = false;
+        for (const DNS::DnsRecordView &res : msg.answers()) {
+            ttl = found ? std::min(ttl, res.ttl) : res.ttl;
+            found = true;
         }
-        answer.add_row({answer_section});
-        answer[1].format().hide_border_top();
-        dns_package.add_row({answer});
-        dns_package[3].format().hide_border_top();
-
-
-        //==========authority section==============
-        Table authority;
-        authority.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
-        authority.add_row({"authority section"});
-        tabulate::Table authority_section;
-        authority_section.add_row({fmt::format("{:<55}", "host"), "type", "class", "ttl", "dlen", fmt::format("{:<55}", "data")});
-        if (!table_flag) {
-            printSectionTag("authority section");
+        if (rcode == DNS_RCODE_NOERROR && found) {
+            return 0;
         }
-
-
-        for (int i = 0; i < authority_cnt; i++) {
-            DNS::DnsResource res;
-            pos = ParseResourceRecord(buf, pos, end, res);
-            ParseDnsRecordDataField(buf, pos, end, res);
-            authority_section.add_row({res.host, std::to_string(res.domain_type), std::to_string(res.domain_class), std::to_string(res.ttl), std::to_string(res.data_len), res.data});
-            if (!table_flag) {
-                fmt::print("host={}, type={}, class={}, ttl={}, dlen={}, data={}\n",
-                           res.host,
-                           res.domain_type,
-                           res.domain_class,
-                           res.ttl,
-                           res.data_len,
-                           res.data);
+        // negative answer, only cacheable with a SOA in the authority section
+        bool has_soa = false;
+        for (const DNS::DnsRecordView &res : msg.authorities()) {
+            DNS::DnsSoaView soa{};
+            if (res.soa(soa)) {
+                unsigned int negative_ttl = std::min(res.ttl, soa.minimum);
+                ttl = found ? std::min(ttl, negative_ttl) : negative_ttl;
+                found = true;
+                has_soa = true;
             }
         }
-        authority.add_row({authority_section});
-        authority[1].format().hide_border_top();
-        dns_package.add_row({authority});
-        dns_package[4].format().hide_border_top();
+        return has_soa ? 0 : -1;
+    }
 
-        //==========additional section=============
-        Table additional;
-        additional.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
-        additional.add_row({"additional section"});
-        tabulate::Table additional_section;
-        additional.format().hide_border_top();
-        additional_section.add_row({fmt::format("{:<55}", "host"), "type", "class", "ttl", "dlen", fmt::format("{:<55}", "data")});
-        if (!table_flag) {
-            printSectionTag("additional section");
+    // age a cached response in place: every record ttl (except OPT) goes down by elapsed seconds
+    int DecreaseRecordTtl(char *buf, int end, unsigned int elapsed) {
+        DNS::DnsMessageView msg(buf, end);
+        if (!msg.valid()) {
+            return -1;
         }
-
-        for (int i = 0; i < additional_cnt; i++) {
-            DNS::DnsResource res;
-            pos = ParseResourceRecord(buf, pos, end, res);
-            ParseDnsRecordDataField(buf, pos, end, res);
-            additional_section.add_row({res.host, std::to_string(res.domain_type), std::to_string(res.domain_class), std::to_string(res.ttl), std::to_string(res.data_len), res.data});
-            if (!table_flag) {
-                fmt::print("host={}, type={}, class={}, ttl={}, dlen={}, data={}\n",
-                           res.host,
-                           res.domain_type,
-                           res.domain_class,
-                           res.ttl,
-                           res.data_len,
-                           res.data);
+        for (const DNS::DnsRecordView &res : msg.records()) {
+            if (res.domain_type == DNS_TYPE_OPT) {
+                continue;
             }
-        }
-
-        if (table_flag) {
-            additional.add_row({additional_section});
-            dns_package.add_row({additional});
-            dns_package[5].format().hide_border_top();
-            std::cout << dns_package << std::endl;
+            unsigned int ttl = res.ttl > elapsed ? res.ttl - elapsed : 0;
+            buf[res.ttl_pos] = 0xff & (ttl >> 24);
+            buf[res.ttl_pos + 1] = 0xff & (ttl >> 16);
+            buf[res.ttl_pos + 2] = 0xff & (ttl >> 8);
+            buf[res.ttl_pos + 3] = 0xff & ttl;
         }
         return 0;
     }
@@ -338,13 +97,16 @@ namespace DNS {
     //  +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
 
 
-    int BuildDnsQueryPacket(const char *host, char *buf, int pos, int end) {
+    int BuildDnsQueryPacket(const char *host, char *buf, int pos, int end, unsigned short query_id, unsigned short query_type,
+                            unsigned short edns_payload) {
         if (buf == nullptr || host == nullptr) {
             return 0;
         }
+        if (end - pos < DNS_HEADER_SIZE) {
+            return -1;
+        }
         //==========header section===========
         // query id
-        uint16_t query_id = 0x091d;
         buf[pos++] = 0xff & (query_id >> 8);
         buf[pos++] = 0xff & query_id;
 
@@ -368,6 +130,7 @@ namespace DNS {
         buf[pos++] = 0;
 
         // ARCOUNT
+        int additional_pos = pos;
         buf[pos++] = 0;
         buf[pos++] = 0;
 
@@ -384,21 +147,27 @@ namespace DNS {
             }
             int len = pos - lp - 1;
             if (len <= 0 || len > 63) {
-                fmt::print("host name format invalid.\n");
                 return -1;
             }
             buf[lp] = len;
             lp = pos++;
         }
+        // name + root label + type + class must fit the buffer
+        if (ch != '\0' || pos + 5 > end) {
+            return -1;
+        }
         if (last == '.') {
             buf[lp] = 0;
         } else {
-            buf[lp] = pos - lp - 1;
+            int len = pos - lp - 1;
+            if (len <= 0 || len > 63) {
+                return -1;
+            }
+            buf[lp] = len;
             buf[pos++] = 0;
         }
 
         //==========query type==========
-        uint16_t query_type = 0x0001;
         buf[pos++] = 0xff & (query_type >> 8);
         buf[pos++] = 0xff & query_type;
 
@@ -407,7 +176,33 @@ namespace DNS {
         buf[pos++] = 0xff & (query_class >> 8);
         buf[pos++] = 0xff & query_class;
 
+        //==========edns0 opt record======
+        //  root name | type OPT | class = udp payload | ttl = ext rcode, version, flags | rdlen 0
+        if (edns_payload > 0) {
+            if (pos + DNS_OPT_RECORD_SIZE > end) {
+                return -1;
+            }
+            buf[pos++] = 0;
+            buf[pos++] = 0xff & (DNS_TYPE_OPT >> 8);
+            buf[pos++] = 0xff & DNS_TYPE_OPT;
+            buf[pos++] = 0xff & (edns_payload >> 8);
+            buf[pos++] = 0xff & edns_payload;
+            for (int i = 0; i < 6; i++) {
+                buf[pos++] = 0;
+            }
+            buf[additional_pos + 1] = 1;
+        }
+
         return pos;
     }
 
+    int StripQueryOptRecord(char *buf, int len) {
+        if (len < DNS_HEADER_SIZE + DNS_OPT_RECORD_SIZE || buf[10] != 0 || buf[11] != 1 ||
+            buf[len - DNS_OPT_RECORD_SIZE] != 0 || buf[len - DNS_OPT_RECORD_SIZE + 2] != DNS_TYPE_OPT) {
+            return -1;
+        }
+        buf[11] = 0;
+        return len - DNS_OPT_RECORD_SIZE;
+    }
+
 } /* end of namespace DNS */
\ No newline at end of file
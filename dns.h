@@ -1,32 +1,66 @@
 #ifndef DNS_CLIENT_DNS_H
 #define DNS_CLIENT_DNS_H
 
+#include <cstdint>
 #include <string>
 
 namespace DNS {
 
-    typedef struct tagDnsQuestionSection {
-        std::string host;
-        unsigned short query_type;
-        unsigned short query_class;
-    } DnsQuestionSection;
-
-    typedef struct tagDnsResource {
-        std::string host;
-        unsigned short domain_type;
-        unsigned short domain_class;
-        unsigned int ttl;
-        unsigned short data_len;
-        unsigned short data_pos;
-        std::string data;// parsed
-    } DnsResource;
+    typedef struct tagDnsHeader {
+        unsigned short id;
+        unsigned short flags;
+        unsigned short query_cnt;
+        unsigned short answer_cnt;
+        unsigned short authority_cnt;
+        unsigned short additional_cnt;
+    } DnsHeader;
 
     const static unsigned short DNS_UDP_PORT = 53;
     const static std::string DEFAULT_DNS_SERVER_IP = "114.114.114.114";
+    const static unsigned short DNS_HEADER_SIZE = 12;
+    const static unsigned short DNS_MAX_QUERY_SIZE = 512;
+    // EDNS0 (RFC 6891): advertised udp payload size, 1232 avoids ip fragmentation on any path
+    const static unsigned short DNS_EDNS_PAYLOAD_SIZE = 1232;
+    const static unsigned short DNS_MAX_EDNS_PAYLOAD_SIZE = 4096;
+    const static unsigned short DNS_OPT_RECORD_SIZE = 11;
 
-    void PrintBuffer(const char *buf, int len);
-    int BuildDnsQueryPacket(const char *host, char *buf, int pos, int end);
-    int ParseDnsResponsePacket(const char *buf, int end);
+    const static unsigned short DNS_TYPE_A = 1;
+    const static unsigned short DNS_TYPE_NS = 2;
+    const static unsigned short DNS_TYPE_CNAME = 5;
+    const static unsigned short DNS_TYPE_SOA = 6;
+    const static unsigned short DNS_TYPE_PTR = 12;
+    const static unsigned short DNS_TYPE_MX = 15;
+    const static unsigned short DNS_TYPE_TXT = 16;
+    const static unsigned short DNS_TYPE_AAAA = 28;
+    const static unsigned short DNS_TYPE_OPT = 41;
+    const static unsigned short DNS_CLASS_IN = 1;
+
+    // header flags
+    const static unsigned short DNS_FLAG_QR = 0x8000;
+    const static unsigned short DNS_FLAG_AA = 0x0400;
+    const static unsigned short DNS_FLAG_TC = 0x0200;
+    const static unsigned short DNS_FLAG_RD = 0x0100;
+    const static unsigned short DNS_FLAG_RA = 0x0080;
+    const static unsigned short DNS_RCODE_MASK = 0x000f;
+    // OPT record ttl flags
+    const static unsigned short DNS_EDNS_FLAG_DO = 0x8000;
+
+    const static unsigned short DNS_RCODE_NOERROR = 0;
+    const static unsigned short DNS_RCODE_FORMERR = 1;
+    const static unsigned short DNS_RCODE_SERVFAIL = 2;
+    const static unsigned short DNS_RCODE_NXDOMAIN = 3;
+    const static unsigned short DNS_RCODE_NOTIMP = 4;
+    const static unsigned short DNS_RCODE_REFUSED = 5;
+
+    // edns_payload > 0 appends an OPT record advertising that udp payload size
+    int BuildDnsQueryPacket(const char *host, char *buf, int pos, int end,
+                            unsigned short query_id = 0x091d, unsigned short query_type = DNS_TYPE_A,
+                            unsigned short edns_payload = 0);
+    // drop the OPT record BuildDnsQueryPacket appended, for servers that answer FORMERR to EDNS
+    int StripQueryOptRecord(char *buf, int len);
+    int ParseDnsHeader(const char *buf, int end, DnsHeader &header);
+    int GetCacheTtl(const char *buf, int end, unsigned int &ttl);
+    int DecreaseRecordTtl(char *buf, int end, unsigned int elapsed);
 
 }
 #endif//DNS_CLIENT_DNS_H
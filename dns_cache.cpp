@@ -0,0 +1,195 @@
+#include "dns_cache.h"
+#include "dns.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+
+dns_cache::dns_cache(size_t max_entries, size_t shard_cnt) {
+    shard_cnt = std::max<size_t>(shard_cnt, 1);
+    max_entries_per_shard_ = std::max<size_t>(max_entries / shard_cnt, 1);
+    shards_.reserve(shard_cnt);
+    for (size_t i = 0; i < shard_cnt; i++) {
+        shards_.push_back(std::make_unique<shard>());
+    }
+}
+
+int dns_cache::make_key(std::string_view host, unsigned short query_type, unsigned short query_class, char *key) {
+    if (!host.empty() && host.back() == '.') {
+        host.remove_suffix(1);
+    }
+    if (host.size() + 4 > s_max_key_size) {
+        return -1;
+    }
+    int len = 0;
+    for (char ch : host) {
+        key[len++] = (char) std::tolower((unsigned char) ch);
+    }
+    key[len++] = 0xff & (query_type >> 8);
+    key[len++] = 0xff & query_type;
+    key[len++] = 0xff & (query_class >> 8);
+    key[len++] = 0xff & query_class;
+    return len;
+}
+
+bool dns_cache::insert(std::string_view host, unsigned short query_type, unsigned short query_class, const char *packet, int len) {
+    char key[s_max_key_size];
+    int key_len = make_key(host, query_type, query_class, key);
+    unsigned int ttl = 0;
+    if (key_len < 0 || DNS::GetCacheTtl(packet, len, ttl) < 0) {
+        return false;
+    }
+    DNS::DnsHeader header{};
+    DNS::ParseDnsHeader(packet, len, header);
+    bool negative = header.answer_cnt == 0 || (header.flags & DNS::DNS_RCODE_MASK) == DNS::DNS_RCODE_NXDOMAIN;
+    ttl = std::min(ttl, negative ? s_max_negative_ttl : s_max_ttl);
+    if (ttl == 0) {
+        return false;
+    }
+
+    std::string_view key_view(key, key_len);
+    shard &s = *shards_[key_hash{}(key_view) % shards_.size()];
+    clock::time_point now = clock::now();
+
+    std::unique_lock lock(s.mutex);
+    auto it = s.entries.find(key_view);
+    if (it == s.entries.end()) {
+        entry_map::value_type *victim = s.entries.size() >= max_entries_per_shard_ ? evict(s, now) : nullptr;
+        if (victim != nullptr) {
+            s.entries.erase(s.entries.find(victim->first));
+        }
+        it = s.entries.try_emplace(std::string(key_view)).first;
+        if (victim != nullptr) {
+            s.ring[s.hand] = &*it;
+            s.hand = (s.hand + 1) % s.ring.size();
+        } else {
+            s.ring.push_back(&*it);
+        }
+    }
+    it->second.packet.assign(packet, len);
+    it->second.inserted = now;
+    it->second.expires = now + std::chrono::seconds(ttl);
+    return true;
+}
+
+dns_cache::entry_map::value_type *dns_cache::evict(shard &s, clock::time_point now) {
+    // every referenced entry passed loses its bit, so this ends within one turn of the ring
+    for (;;) {
+        entry_map::value_type *entry = s.ring[s.hand];
+        if (entry->second.expires <= now || !entry->second.referenced.exchange(false, std::memory_order_relaxed)) {
+            return entry;
+        }
+        s.hand = (s.hand + 1) % s.ring.size();
+    }
+}
+
+int dns_cache::lookup(std::string_view host, unsigned short query_type, unsigned short query_class, char *buf, int buf_len) const {
+    char key[s_max_key_size];
+    int key_len = make_key(host, query_type, query_class, key);
+    if (key_len < 0) {
+        return -1;
+    }
+    std::string_view key_view(key, key_len);
+    const shard &s = *shards_[key_hash{}(key_view) % shards_.size()];
+    clock::time_point now = clock::now();
+    int len = 0;
+    clock::time_point inserted;
+    {
+        std::shared_lock lock(s.mutex);
+        auto it = s.entries.find(key_view);
+        if (it == s.entries.end() || it->second.expires <= now) {
+            return lookup_snapshot(key_view, buf, buf_len);
+        }
+        if ((int) it->second.packet.size() > buf_len) {
+            return -1;
+        }
+        len = (int) it->second.packet.size();
+        memcpy(buf, it->second.packet.data(), len);
+        inserted = it->second.inserted;
+        // a relaxed test first, so hot entries do not bounce their cache line between readers
+        if (!it->second.referenced.load(std::memory_order_relaxed)) {
+            it->second.referenced.store(true, std::memory_order_relaxed);
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - inserted).count();
+    if (elapsed > 0) {
+        DNS::DecreaseRecordTtl(buf, len, (unsigned int) elapsed);
+    }
+    return len;
+}
+
+size_t dns_cache::size() const {
+    size_t total = 0;
+    for (const auto &s : shards_) {
+        std::shared_lock lock(s->mutex);
+        total += s->entries.size();
+    }
+    return total;
+}
+
+void dns_cache::clear() {
+    for (auto &s : shards_) {
+        std::unique_lock lock(s->mutex);
+        s->entries.clear();
+        s->ring.clear();
+        s->hand = 0;
+    }
+}
+
+int dns_cache::lookup_snapshot(std::string_view key, char *buf, int buf_len) const {
+    dns_snapshot::entry e{};
+    int64_t now = unix_now();
+    if (!snapshot_.find(key, now, e) || (int) e.packet.size() > buf_len) {
+        return -1;
+    }
+    int len = (int) e.packet.size();
+    memcpy(buf, e.packet.data(), len);
+    if (now > e.inserted) {
+        DNS::DecreaseRecordTtl(buf, len, (unsigned int) (now - e.inserted));
+    }
+    return len;
+}
+
+int64_t dns_cache::unix_now() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool dns_cache::load_snapshot(const std::string &path) {
+    return snapshot_.open(path);
+}
+
+bool dns_cache::save_snapshot(const std::string &path) const {
+    // steady clock times of the live entries become unix times
+    clock::time_point now = clock::now();
+    int64_t wall_now = unix_now();
+    auto to_unix = [now, wall_now](clock::time_point tp) {
+        return wall_now + std::chrono::duration_cast<std::chrono::seconds>(tp - now).count();
+    };
+    std::vector<std::string> keys;
+    std::vector<std::string> packets;
+    std::vector<dns_snapshot::entry> entries;
+    for (const auto &s : shards_) {
+        std::shared_lock lock(s->mutex);
+        for (const auto &[key, value] : s->entries) {
+            if (value.expires > now) {
+                keys.push_back(key);
+                packets.push_back(value.packet);
+                entries.push_back({{}, {}, to_unix(value.inserted), to_unix(value.expires)});
+            }
+        }
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        entries[i].key = keys[i];
+        entries[i].packet = packets[i];
+    }
+    for (const dns_snapshot::entry &e : snapshot_.entries(wall_now)) {
+        const shard &s = *shards_[key_hash{}(e.key) % shards_.size()];
+        std::shared_lock lock(s.mutex);
+        auto it = s.entries.find(e.key);
+        if (it == s.entries.end() || it->second.expires <= now) {
+            entries.push_back(e);
+        }
+    }
+    return dns_snapshot::write(path, entries, wall_now);
+}
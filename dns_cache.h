@@ -0,0 +1,93 @@
+#ifndef DNS_CLIENT_DNS_CACHE_H
+#define DNS_CLIENT_DNS_CACHE_H
+
+#include "dns_snapshot.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// TTL aware response cache keyed by (name, qtype, qclass).
+// Whole response packets are stored, so a hit is one memcpy plus a ttl rewrite.
+// NXDOMAIN / NODATA answers are kept for the SOA minimum (RFC 2308).
+// Entries are spread over hash shards, each guarded by its own shared_mutex,
+// so concurrent readers on different threads rarely touch the same lock.
+// A full shard evicts with CLOCK: a hit sets the entry's reference bit, and an insert advances
+// the shard's hand past referenced entries, clearing their bits, to the first expired or
+// unreferenced one. That is O(1) amortized per insert and keeps the names that are asked for.
+// A snapshot written by an earlier process can be mapped behind the shards: a miss in the
+// shards is looked up in the file, still valid entries answer without any upstream query.
+class dns_cache {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr unsigned int s_max_ttl = 86400;
+    static constexpr unsigned int s_max_negative_ttl = 10800;
+
+    explicit dns_cache(size_t max_entries, size_t shard_cnt = 64);
+
+    dns_cache(const dns_cache &) = delete;
+    dns_cache &operator=(const dns_cache &) = delete;
+
+    // returns false if the response is not cacheable (truncated, SERVFAIL, no SOA for a negative answer, ...)
+    bool insert(std::string_view host, unsigned short query_type, unsigned short query_class, const char *packet, int len);
+
+    // copies the cached response into buf with ttls aged by the time spent in the cache.
+    // returns the packet length, or -1 on a miss.
+    int lookup(std::string_view host, unsigned short query_type, unsigned short query_class, char *buf, int buf_len) const;
+
+    size_t size() const;
+    void clear();
+
+    // map a snapshot for lookups that miss; call before the cache is shared between threads
+    bool load_snapshot(const std::string &path);
+    // live entries plus the still valid, not overridden ones of the loaded snapshot
+    bool save_snapshot(const std::string &path) const;
+    size_t snapshot_size() const { return snapshot_.size(); }
+
+private:
+    struct cache_entry {
+        std::string packet;
+        clock::time_point inserted;
+        clock::time_point expires;
+        // set by lookups under the shared lock, cleared by the clock hand
+        mutable std::atomic<bool> referenced{false};
+    };
+
+    struct key_hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+    };
+
+    using entry_map = std::unordered_map<std::string, cache_entry, key_hash, std::equal_to<>>;
+
+    struct shard {
+        mutable std::shared_mutex mutex;
+        entry_map entries;
+        // clock order over the entries; map nodes never move, so the pointers stay valid
+        std::vector<entry_map::value_type *> ring;
+        size_t hand = 0;
+    };
+
+    static const size_t s_max_key_size = 260;
+
+    // lower cased name, without trailing dot, followed by type and class
+    static int make_key(std::string_view host, unsigned short query_type, unsigned short query_class, char *key);
+    // the entry the clock hand stops at, only called on a full shard
+    static entry_map::value_type *evict(shard &s, clock::time_point now);
+    int lookup_snapshot(std::string_view key, char *buf, int buf_len) const;
+    static int64_t unix_now();
+
+    size_t max_entries_per_shard_;
+    std::vector<std::unique_ptr<shard>> shards_;
+    dns_snapshot snapshot_;
+};
+
+#endif//DNS_CLIENT_DNS_CACHE_H
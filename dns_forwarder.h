@@ -0,0 +1,351 @@
+#ifndef DNS_CLIENT_DNS_FORWARDER_H
+#define DNS_CLIENT_DNS_FORWARDER_H
+
+#include "resolver_engine.h"
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Caching forwarder: serves DNS over udp to local clients through dns_resolver.
+// Every worker thread has its own io_context, listening socket (one port shared with
+// SO_REUSEPORT, the kernel spreads clients over the workers), upstream socket and resolver;
+// the cache and hosts file are shared. A client query is parsed with DnsMessageView and
+// handed to the resolver, which answers from the cache or forwards it under a transaction
+// id of its own, coalescing identical questions. The reply gets the client's id and its
+// spelling of the name back; the upstream's OPT record is replaced by one of our own for a
+// client that sent EDNS, dropped for one that did not. A reply over the client's udp payload
+// keeps the records that fit, with TC set if an answer or authority record had to go
+// (RFC 2181 9), so it is still a valid, usable answer.
+// Only udp is served, a client that needs the whole truncated answer has to ask over TCP elsewhere.
+class dns_forwarder {
+public:
+    // outstanding client queries per worker, more are dropped
+    static constexpr size_t s_max_clients = 1 << 16;
+
+    struct stats {
+        uint64_t requests = 0;
+        uint64_t replies = 0;
+        uint64_t truncated = 0;
+        uint64_t servfails = 0;
+        uint64_t malformed = 0;// not a query, or no header at all, dropped
+        uint64_t dropped = 0;// over s_max_clients
+    };
+
+    // options.search is ignored, clients send fully qualified names
+    dns_forwarder(const udp::endpoint &listen, const std::vector<udp::endpoint> &servers, const resolver_engine_options &options)
+        : listen_(listen), servers_(servers), options_(options) {
+        unsigned int cnt = std::max(options_.threads, 1u);
+        for (unsigned int i = 0; i < cnt; i++) {
+            workers_.push_back(std::make_unique<worker>(i));
+        }
+    }
+
+    dns_forwarder(const dns_forwarder &) = delete;
+    dns_forwarder &operator=(const dns_forwarder &) = delete;
+
+    ~dns_forwarder() {
+        stop();
+        join();
+    }
+
+    // binds every worker's listening socket, false with err set if one fails
+    bool open(asio::error_code &err) {
+        size_t window = std::max<size_t>(options_.window / workers_.size(), 1);
+        udp::endpoint bound = listen_;
+        for (auto &w : workers_) {
+            udp::socket sock(w->ios);
+            sock.open(bound.protocol(), err);
+            if (!err && workers_.size() > 1) {
+                sock.set_option(reuse_port_option(true), err);
+            }
+            if (!err) {
+                sock.bind(bound, err);
+            }
+            if (err) {
+                return false;
+            }
+            // bursts from many clients queue here while the worker is busy
+            asio::error_code ignored;
+            sock.set_option(asio::socket_base::receive_buffer_size(s_socket_buffer_size), ignored);
+            sock.set_option(asio::socket_base::send_buffer_size(s_socket_buffer_size), ignored);
+            // port 0 picks one for the first worker, the others join it
+            bound = sock.local_endpoint();
+            w->listener = make_udp_transport(std::move(sock), options_.batch);
+            w->listener->set_receive_handler([this, &w = *w](const udp::endpoint &from, const char *data, size_t len) {
+                on_query(w, from, data, len);
+            });
+
+            udp::socket upstream(w->ios, udp::endpoint(servers_.front().protocol(), 0));
+            w->resolver = std::make_unique<dns_resolver>(make_udp_transport(std::move(upstream), options_.batch), servers_, window);
+            w->resolver->set_cache(options_.cache);
+            w->resolver->set_hosts(options_.hosts);
+            w->resolver->set_retry_policy(options_.retry);
+            w->resolver->set_hedge_percentile(options_.hedge_percentile);
+            w->resolver->set_edns_payload(options_.edns_payload);
+        }
+        local_ = bound;
+        return true;
+    }
+
+    void start() {
+        for (unsigned int i = 0; i < workers_.size(); i++) {
+            workers_[i]->listener->start_receive();
+            workers_[i]->thread = std::thread([this, i] {
+                if (options_.pin_cpus) {
+                    pin_to_cpu(i);
+                }
+                workers_[i]->ios.run();
+            });
+        }
+    }
+
+    // thread safe; queries still in flight are dropped
+    void stop() {
+        for (auto &w : workers_) {
+            w->ios.stop();
+        }
+    }
+
+    void join() {
+        for (auto &w : workers_) {
+            if (w->thread.joinable()) {
+                w->thread.join();
+            }
+        }
+    }
+
+    const udp::endpoint &local_endpoint() const { return local_; }
+    unsigned int threads() const { return workers_.size(); }
+
+    // every worker's resolver metrics merged, safe to call from any thread while the workers run
+    metrics_snapshot metrics() const {
+        metrics_snapshot merged;
+        for (const auto &w : workers_) {
+            if (w->resolver) {
+                merged.merge(w->resolver->metrics().snapshot());
+            }
+        }
+        return merged;
+    }
+
+    stats totals() const {
+        stats s;
+        for (const auto &w : workers_) {
+            s.requests += w->requests.load();
+            s.replies += w->replies.load();
+            s.truncated += w->truncated.load();
+            s.servfails += w->servfails.load();
+            s.malformed += w->malformed.load();
+            s.dropped += w->dropped.load();
+        }
+        return s;
+    }
+
+private:
+    using reuse_port_option = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+    // what the reply needs from the client's query
+    struct client_query {
+        udp::endpoint from;
+        unsigned short id = 0;
+        unsigned short flags = 0;// opcode and RD, echoed in the reply
+        unsigned short payload = 512;// largest udp reply the client takes
+        bool edns = false;
+        int question_len = 0;// name + type + class as the client wrote them
+        char question[DNS::DNS_MAX_QUERY_SIZE];
+    };
+
+    struct worker {
+        explicit worker(unsigned int index) : index(index), ios(1), reply(s_reply_size) {}
+
+        unsigned int index;
+        asio::io_context ios;
+        std::unique_ptr<dns_transport> listener;
+        std::unique_ptr<dns_resolver> resolver;
+        std::vector<client_query> clients;
+        std::vector<int> free_clients;
+        std::vector<char> reply;
+        metric_counter requests;
+        metric_counter replies;
+        metric_counter truncated;
+        metric_counter servfails;
+        metric_counter malformed;
+        metric_counter dropped;
+        std::thread thread;
+    };
+
+    static constexpr size_t s_reply_size = 65535;
+    static constexpr int s_socket_buffer_size = 8 << 20;
+    static constexpr unsigned short s_opcode_mask = 0x7800;
+
+    void on_query(worker &w, const udp::endpoint &from, const char *data, size_t len) {
+        w.requests.add();
+        DNS::DnsMessageView msg(data, (int) len);
+        if (len < DNS::DNS_HEADER_SIZE || msg.response()) {
+            w.malformed.add();
+            return;
+        }
+        client_query query;
+        query.from = from;
+        query.id = msg.id();
+        query.flags = msg.header().flags & (s_opcode_mask | DNS::DNS_FLAG_RD);
+        DNS::DnsOptView opt{};
+        if (msg.valid() && msg.edns(opt)) {
+            query.edns = true;
+            query.payload = std::clamp<unsigned short>(opt.udp_payload, 512, DNS::DNS_MAX_EDNS_PAYLOAD_SIZE);
+        }
+        int question_end = msg.valid() && msg.questions().size() == 1 ? DNS::SkipName(msg.bytes(), DNS::DNS_HEADER_SIZE) : -1;
+        if (question_end > 0 && question_end + 4 - DNS::DNS_HEADER_SIZE <= (int) sizeof(query.question)) {
+            query.question_len = question_end + 4 - DNS::DNS_HEADER_SIZE;
+            memcpy(query.question, data + DNS::DNS_HEADER_SIZE, query.question_len);
+        }
+        if (query.flags & s_opcode_mask) {
+            reply_error(w, query, DNS::DNS_RCODE_NOTIMP);
+            return;
+        }
+        char name[256];
+        int name_len = -1;
+        DNS::DnsQuestionView question{};
+        if (query.question_len > 0) {
+            question = *msg.questions().begin();
+            name_len = question.host.to_string(name, sizeof(name));
+        }
+        if (name_len <= 0) {
+            reply_error(w, query, DNS::DNS_RCODE_FORMERR);
+            return;
+        }
+        if (question.query_class != DNS::DNS_CLASS_IN) {
+            reply_error(w, query, DNS::DNS_RCODE_NOTIMP);
+            return;
+        }
+
+        int index;
+        if (!w.free_clients.empty()) {
+            index = w.free_clients.back();
+            w.free_clients.pop_back();
+        } else if (w.clients.size() < s_max_clients) {
+            index = (int) w.clients.size();
+            w.clients.emplace_back();
+        } else {
+            w.dropped.add();
+            return;
+        }
+        w.clients[index] = query;
+        // a trailing dot keeps the name absolute whatever the resolver's search list
+        std::string host(name, name_len);
+        host.push_back('.');
+        w.resolver->async_resolve(std::move(host), question.query_type, [this, &w, index](const dns_result &result) {
+            on_result(w, index, result);
+        });
+    }
+
+    void on_result(worker &w, int index, const dns_result &result) {
+        const client_query &query = w.clients[index];
+        char *reply = w.reply.data();
+        int len = -1;
+        if (result.status == resolve_status::ok && result.len <= (int) w.reply.size()) {
+            memcpy(reply, result.packet, result.len);
+            len = result.len;
+            reply[0] = (char) (query.id >> 8);
+            reply[1] = (char) query.id;
+            reply[2] = (char) ((reply[2] & ~(DNS::DNS_FLAG_RD >> 8)) | (query.flags >> 8 & (DNS::DNS_FLAG_RD >> 8)));
+            // the upstream's question is the client's name in another case, put the client's back
+            if (DNS::SkipName(DNS::DnsMessageView(reply, len).bytes(), DNS::DNS_HEADER_SIZE) + 4 - DNS::DNS_HEADER_SIZE == query.question_len) {
+                memcpy(reply + DNS::DNS_HEADER_SIZE, query.question, query.question_len - 4);
+            }
+            len = DNS::StripOptRecord(reply, len);
+        }
+        if (len < 0) {
+            w.servfails.add();
+            len = build_reply(query, DNS::DNS_RCODE_SERVFAIL, reply);
+        } else {
+            int opt_len = query.edns ? DNS::DNS_OPT_RECORD_SIZE : 0;
+            if (len + opt_len > query.payload && truncate_reply(reply, len, query.payload - opt_len)) {
+                w.truncated.add();
+            }
+            if (query.edns) {
+                len = append_opt(reply, len);
+            }
+        }
+        w.listener->send(reply, len, query.from);
+        w.replies.add();
+        w.free_clients.push_back(index);
+    }
+
+    void reply_error(worker &w, const client_query &query, unsigned short rcode) {
+        int len = build_reply(query, rcode, w.reply.data());
+        w.listener->send(w.reply.data(), len, query.from);
+        w.replies.add();
+    }
+
+    // header, the client's question and the OPT record for an EDNS client, for errors
+    static int build_reply(const client_query &query, unsigned short rcode, char *out) {
+        unsigned short flags = DNS::DNS_FLAG_QR | query.flags | DNS::DNS_FLAG_RA | (rcode & DNS::DNS_RCODE_MASK);
+        const char header[DNS::DNS_HEADER_SIZE] = {(char) (query.id >> 8), (char) query.id, (char) (flags >> 8), (char) flags,
+                                                   0, query.question_len > 0 ? (char) 1 : (char) 0, 0, 0, 0, 0, 0, 0};
+        memcpy(out, header, sizeof(header));
+        memcpy(out + DNS::DNS_HEADER_SIZE, query.question, query.question_len);
+        int len = DNS::DNS_HEADER_SIZE + query.question_len;
+        return query.edns ? append_opt(out, len) : len;
+    }
+
+    // cuts a reply without OPT record down to its longest run of whole records that fits in
+    // limit bytes. Kept records stay where they were, so their compression pointers still hold.
+    // Sets TC and returns true if an answer or authority record had to go; dropped additional
+    // records alone do not make the reply truncated (RFC 2181 9).
+    static bool truncate_reply(char *reply, int &len, int limit) {
+        DNS::DnsMessageView msg(reply, len);
+        const DNS::DnsHeader &header = msg.header();
+        int cut = DNS::DNS_HEADER_SIZE;
+        for (int i = 0; i < header.query_cnt; i++) {
+            cut = DNS::SkipName(msg.bytes(), cut) + 4;
+        }
+        const int counts[3] = {header.answer_cnt, header.authority_cnt, header.additional_cnt};
+        int kept[3] = {0, 0, 0};
+        int section = 0;
+        bool truncated = false;
+        for (const DNS::DnsRecordView &res : msg.records()) {
+            while (kept[section] == counts[section]) {
+                section++;
+            }
+            int end = res.data_pos + res.data_len;
+            if (end > limit) {
+                truncated = section < 2;
+                break;
+            }
+            cut = end;
+            kept[section]++;
+        }
+        for (int i = 0; i < 3; i++) {
+            reply[6 + i * 2] = (char) (kept[i] >> 8);
+            reply[7 + i * 2] = (char) kept[i];
+        }
+        if (truncated) {
+            reply[2] |= (char) (DNS::DNS_FLAG_TC >> 8);
+        }
+        len = cut;
+        return truncated;
+    }
+
+    // our OPT record after the last record, advertising the payload we take from clients
+    static int append_opt(char *reply, int len) {
+        const char opt[DNS::DNS_OPT_RECORD_SIZE] = {0, 0, (char) DNS::DNS_TYPE_OPT, (char) (DNS::DNS_EDNS_PAYLOAD_SIZE >> 8),
+                                                    (char) DNS::DNS_EDNS_PAYLOAD_SIZE, 0, 0, 0, 0, 0, 0};
+        memcpy(reply + len, opt, sizeof(opt));
+        unsigned short additional_cnt = (unsigned short) (((unsigned char) reply[10] << 8 | (unsigned char) reply[11]) + 1);
+        reply[10] = (char) (additional_cnt >> 8);
+        reply[11] = (char) additional_cnt;
+        return len + DNS::DNS_OPT_RECORD_SIZE;
+    }
+
+    udp::endpoint listen_;
+    udp::endpoint local_;
+    std::vector<udp::endpoint> servers_;
+    resolver_engine_options options_;
+    std::vector<std::unique_ptr<worker>> workers_;
+};
+
+#endif//DNS_CLIENT_DNS_FORWARDER_H
@@ -0,0 +1,332 @@
+#include "dns_message.h"
+
+#include <cctype>
+#include <cstring>
+
+namespace DNS {
+
+    int SkipName(ByteSpan msg, int pos) {
+        int size = (int) msg.size();
+        while (pos >= 0 && pos < size) {
+            unsigned int len = std::to_integer<unsigned>(msg[pos]);
+            if (len == 0) {
+                return pos + 1;
+            }
+            if ((len & 0xc0) == 0xc0) {
+                return pos + 2 <= size ? pos + 2 : -1;
+            }
+            if (len & 0xc0) {
+                return -1;
+            }
+            pos += len + 1;
+        }
+        return -1;
+    }
+
+    //==========name view==========
+    void DnsNameView::iterator::advance() {
+        int size = (int) msg_.size();
+        while (pos_ >= 0) {
+            if (pos_ >= size) {
+                break;
+            }
+            unsigned int len = std::to_integer<unsigned>(msg_[pos_]);
+            if ((len & 0xc0) == 0xc0) {
+                if (pos_ + 1 >= size) {
+                    break;
+                }
+                int target = ((len & 0x3f) << 8) | std::to_integer<unsigned>(msg_[pos_ + 1]);
+                if (target >= bound_) {
+                    break;
+                }
+                bound_ = target;
+                pos_ = target;
+                continue;
+            }
+            if (len & 0xc0) {
+                break;
+            }
+            if (len == 0) {
+                pos_ = -1;
+                return;
+            }
+            total_ += len + 1;
+            if (pos_ + 1 + (int) len > size || total_ > 255) {
+                break;
+            }
+            label_ = std::string_view(reinterpret_cast<const char *>(msg_.data()) + pos_ + 1, len);
+            pos_ += len + 1;
+            return;
+        }
+        failed_ = true;
+        pos_ = -1;
+    }
+
+    bool DnsNameView::valid() const {
+        auto it = begin();
+        while (it != end()) {
+            ++it;
+        }
+        return pos_ >= 0 && !it.failed();
+    }
+
+    bool DnsNameView::equals(std::string_view host) const {
+        if (!host.empty() && host.back() == '.') {
+            host.remove_suffix(1);
+        }
+        size_t pos = 0;
+        auto it = begin();
+        for (; it != end(); ++it) {
+            std::string_view label = *it;
+            if (pos != 0) {
+                if (pos >= host.size() || host[pos] != '.') {
+                    return false;
+                }
+                pos++;
+            }
+            if (host.size() - pos < label.size()) {
+                return false;
+            }
+            for (char ch : label) {
+                if (std::tolower((unsigned char) ch) != std::tolower((unsigned char) host[pos++])) {
+                    return false;
+                }
+            }
+        }
+        return !it.failed() && pos == host.size();
+    }
+
+    int DnsNameView::to_string(char *out, int out_len) const {
+        int len = 0;
+        auto it = begin();
+        for (; it != end(); ++it) {
+            int need = (len != 0) + (int) it->size();
+            if (len + need > out_len) {
+                return -1;
+            }
+            if (len != 0) {
+                out[len++] = '.';
+            }
+            memcpy(out + len, it->data(), it->size());
+            len += (int) it->size();
+        }
+        if (it.failed() || pos_ < 0) {
+            return -1;
+        }
+        if (len == 0) {
+            if (out_len < 1) {
+                return -1;
+            }
+            out[len++] = '.';
+        }
+        return len;
+    }
+
+    int DnsNameView::to_wire(char *out, int out_len) const {
+        int len = 0;
+        auto it = begin();
+        for (; it != end(); ++it) {
+            if (len + 1 + (int) it->size() > out_len) {
+                return -1;
+            }
+            out[len++] = (char) it->size();
+            memcpy(out + len, it->data(), it->size());
+            len += (int) it->size();
+        }
+        if (it.failed() || pos_ < 0 || len + 1 > out_len) {
+            return -1;
+        }
+        out[len++] = 0;
+        return len;
+    }
+
+    std::string DnsNameView::str() const {
+        char buf[256];
+        int len = to_string(buf, sizeof(buf));
+        return len < 0 ? std::string() : std::string(buf, len);
+    }
+
+    //==========record view==========
+    bool DnsRecordView::a(std::array<unsigned char, 4> &addr) const {
+        if (domain_type != DNS_TYPE_A || data_len != addr.size()) {
+            return false;
+        }
+        memcpy(addr.data(), data.data(), addr.size());
+        return true;
+    }
+
+    bool DnsRecordView::aaaa(std::array<unsigned char, 16> &addr) const {
+        if (domain_type != DNS_TYPE_AAAA || data_len != addr.size()) {
+            return false;
+        }
+        memcpy(addr.data(), data.data(), addr.size());
+        return true;
+    }
+
+    bool DnsRecordView::target(DnsNameView &name) const {
+        if (domain_type != DNS_TYPE_NS && domain_type != DNS_TYPE_CNAME && domain_type != DNS_TYPE_PTR) {
+            return false;
+        }
+        int end = SkipName(msg.first(data_pos + data_len), data_pos);
+        if (end != data_pos + data_len) {
+            return false;
+        }
+        name = DnsNameView(msg, data_pos);
+        return true;
+    }
+
+    bool DnsRecordView::mx(unsigned short &preference, DnsNameView &exchange) const {
+        if (domain_type != DNS_TYPE_MX || data_len < 3) {
+            return false;
+        }
+        int end = SkipName(msg.first(data_pos + data_len), data_pos + 2);
+        if (end != data_pos + data_len) {
+            return false;
+        }
+        preference = ReadUint16(msg, data_pos);
+        exchange = DnsNameView(msg, data_pos + 2);
+        return true;
+    }
+
+    // mname, rname, serial, refresh, retry, expire, minimum
+    bool DnsRecordView::soa(DnsSoaView &soa) const {
+        if (domain_type != DNS_TYPE_SOA) {
+            return false;
+        }
+        ByteSpan rdata_end = msg.first(data_pos + data_len);
+        int rname = SkipName(rdata_end, data_pos);
+        int pos = SkipName(rdata_end, rname);
+        if (rname < 0 || pos < 0 || pos + 20 != data_pos + data_len) {
+            return false;
+        }
+        soa.mname = DnsNameView(msg, data_pos);
+        soa.rname = DnsNameView(msg, rname);
+        soa.serial = ReadUint32(msg, pos);
+        soa.refresh = ReadUint32(msg, pos + 4);
+        soa.retry = ReadUint32(msg, pos + 8);
+        soa.expire = ReadUint32(msg, pos + 12);
+        soa.minimum = ReadUint32(msg, pos + 16);
+        return true;
+    }
+
+    bool DnsRecordView::opt(DnsOptView &opt) const {
+        if (domain_type != DNS_TYPE_OPT) {
+            return false;
+        }
+        opt.udp_payload = domain_class;
+        opt.extended_rcode = 0xff & (ttl >> 24);
+        opt.version = 0xff & (ttl >> 16);
+        opt.flags = 0xffff & ttl;
+        opt.options = data;
+        return true;
+    }
+
+    bool DnsMessageView::edns(DnsOptView &opt) const {
+        for (const DnsRecordView &res : additionals()) {
+            if (res.opt(opt)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //==========section iterators==========
+    DnsQuestionView DnsQuestionIterator::operator*() const {
+        int pos = SkipName(msg_, pos_);
+        return {DnsNameView(msg_, pos_), ReadUint16(msg_, pos), ReadUint16(msg_, pos + 2)};
+    }
+
+    DnsQuestionIterator &DnsQuestionIterator::operator++() {
+        pos_ = SkipName(msg_, pos_) + 4;
+        remaining_--;
+        return *this;
+    }
+
+    DnsRecordView DnsRecordIterator::operator*() const {
+        DnsRecordView rr{};
+        int pos = SkipName(msg_, pos_);
+        rr.host = DnsNameView(msg_, pos_);
+        rr.domain_type = ReadUint16(msg_, pos);
+        rr.domain_class = ReadUint16(msg_, pos + 2);
+        rr.ttl_pos = pos + 4;
+        rr.ttl = ReadUint32(msg_, pos + 4);
+        rr.data_len = ReadUint16(msg_, pos + 8);
+        rr.data_pos = pos + 10;
+        rr.data = msg_.subspan(rr.data_pos, rr.data_len);
+        rr.msg = msg_;
+        return rr;
+    }
+
+    DnsRecordIterator &DnsRecordIterator::operator++() {
+        int pos = SkipName(msg_, pos_);
+        pos_ = pos + 10 + ReadUint16(msg_, pos + 8);
+        remaining_--;
+        return *this;
+    }
+
+    //==========message view==========
+    DnsMessageView::DnsMessageView(ByteSpan msg) : msg_(msg) {
+        int size = (int) msg.size();
+        if (size < DNS_HEADER_SIZE) {
+            return;
+        }
+        header_.id = ReadUint16(msg, 0);
+        header_.flags = ReadUint16(msg, 2);
+        header_.query_cnt = ReadUint16(msg, 4);
+        header_.answer_cnt = ReadUint16(msg, 6);
+        header_.authority_cnt = ReadUint16(msg, 8);
+        header_.additional_cnt = ReadUint16(msg, 10);
+
+        // one pass over the sections, only to find where they start and to check bounds
+        int pos = DNS_HEADER_SIZE;
+        for (int i = 0; i < header_.query_cnt; i++) {
+            pos = SkipName(msg, pos);
+            if (pos < 0 || pos + 4 > size) {
+                return;
+            }
+            pos += 4;
+        }
+        const int counts[3] = {header_.answer_cnt, header_.authority_cnt, header_.additional_cnt};
+        int *starts[3] = {&answer_pos_, &authority_pos_, &additional_pos_};
+        for (int section = 0; section < 3; section++) {
+            *starts[section] = pos;
+            for (int i = 0; i < counts[section]; i++) {
+                pos = SkipName(msg, pos);
+                if (pos < 0 || pos + 10 > size) {
+                    return;
+                }
+                pos += 10 + ReadUint16(msg, pos + 8);
+                if (pos > size) {
+                    return;
+                }
+            }
+        }
+        end_pos_ = pos;
+        valid_ = true;
+    }
+
+    int StripOptRecord(char *buf, int len) {
+        DnsMessageView msg(buf, len);
+        if (!msg.valid()) {
+            return -1;
+        }
+        for (const DnsRecordView &res : msg.additionals()) {
+            if (res.domain_type != DNS_TYPE_OPT) {
+                continue;
+            }
+            // owner is the root, a single zero byte, then type, class, ttl and rdlen
+            int begin = res.data_pos - 11;
+            int end = res.data_pos + res.data_len;
+            if (begin < DNS_HEADER_SIZE || buf[begin] != 0) {
+                return -1;
+            }
+            memmove(buf + begin, buf + end, len - end);
+            unsigned short additional_cnt = msg.header().additional_cnt - 1;
+            buf[10] = (char) (additional_cnt >> 8);
+            buf[11] = (char) additional_cnt;
+            return len - (end - begin);
+        }
+        return len;
+    }
+
+} /* end of namespace DNS */
@@ -0,0 +1,246 @@
+#ifndef DNS_CLIENT_DNS_MESSAGE_H
+#define DNS_CLIENT_DNS_MESSAGE_H
+
+#include "dns.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace DNS {
+
+    using ByteSpan = std::span<const std::byte>;
+
+    inline uint16_t ReadUint16(ByteSpan msg, int pos) {
+        return (uint16_t) ((std::to_integer<unsigned>(msg[pos]) << 8) | std::to_integer<unsigned>(msg[pos + 1]));
+    }
+
+    inline uint32_t ReadUint32(ByteSpan msg, int pos) {
+        return ((uint32_t) ReadUint16(msg, pos) << 16) | ReadUint16(msg, pos + 2);
+    }
+
+    // position right after the name stored at pos, without following pointers. -1 if out of bounds.
+    int SkipName(ByteSpan msg, int pos);
+
+    // A possibly compressed domain name inside a message.
+    // Labels are decoded on demand and iteratively: every compression pointer has to jump
+    // strictly before the previous jump target and the name is capped at 255 bytes,
+    // so a hostile packet can neither loop nor read out of bounds.
+    class DnsNameView {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::string_view;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const std::string_view *;
+            using reference = const std::string_view &;
+
+            iterator() = default;
+            iterator(ByteSpan msg, int pos) : msg_(msg), pos_(pos), bound_(pos) { advance(); }
+
+            reference operator*() const { return label_; }
+            pointer operator->() const { return &label_; }
+            iterator &operator++() {
+                advance();
+                return *this;
+            }
+            iterator operator++(int) {
+                iterator it = *this;
+                advance();
+                return it;
+            }
+            bool operator==(const iterator &other) const { return pos_ == other.pos_; }
+
+            // true if iteration stopped on a malformed name rather than the root label
+            bool failed() const { return failed_; }
+
+        private:
+            void advance();
+
+            ByteSpan msg_;
+            int pos_ = -1;
+            int bound_ = 0;
+            int total_ = 1;
+            bool failed_ = false;
+            std::string_view label_;
+        };
+
+        DnsNameView() = default;
+        DnsNameView(ByteSpan msg, int pos) : msg_(msg), pos_(pos) {}
+
+        iterator begin() const { return pos_ < 0 ? iterator() : iterator(msg_, pos_); }
+        iterator end() const { return {}; }
+
+        bool valid() const;
+        // case insensitive compare against a dotted name, the trailing dot is optional
+        bool equals(std::string_view host) const;
+        // dotted form without trailing dot ("." for the root), returns the length or -1
+        int to_string(char *out, int out_len) const;
+        // uncompressed wire form, returns the length or -1
+        int to_wire(char *out, int out_len) const;
+        std::string str() const;
+
+    private:
+        ByteSpan msg_;
+        int pos_ = -1;
+    };
+
+    typedef struct tagDnsQuestionView {
+        DnsNameView host;
+        unsigned short query_type;
+        unsigned short query_class;
+    } DnsQuestionView;
+
+    typedef struct tagDnsSoaView {
+        DnsNameView mname;
+        DnsNameView rname;
+        unsigned int serial;
+        unsigned int refresh;
+        unsigned int retry;
+        unsigned int expire;
+        unsigned int minimum;
+    } DnsSoaView;
+
+    // EDNS0 pseudo record (RFC 6891), the fields are packed into class and ttl
+    typedef struct tagDnsOptView {
+        unsigned short udp_payload;
+        unsigned char extended_rcode;// upper 8 bits of the 12 bit rcode
+        unsigned char version;
+        unsigned short flags;
+        ByteSpan options;
+    } DnsOptView;
+
+    // one resource record; offsets are relative to the start of the message
+    struct DnsRecordView {
+        DnsNameView host;
+        unsigned short domain_type;
+        unsigned short domain_class;
+        unsigned int ttl;
+        unsigned short data_len;
+        unsigned short data_pos;
+        int ttl_pos;
+        ByteSpan data;
+        ByteSpan msg;
+
+        // typed rdata accessors, false if the record has another type or a malformed rdata
+        bool a(std::array<unsigned char, 4> &addr) const;
+        bool aaaa(std::array<unsigned char, 16> &addr) const;
+        // NS, CNAME, PTR target
+        bool target(DnsNameView &name) const;
+        bool mx(unsigned short &preference, DnsNameView &exchange) const;
+        bool soa(DnsSoaView &soa) const;
+        bool opt(DnsOptView &opt) const;
+    };
+
+    class DnsQuestionIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = DnsQuestionView;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const DnsQuestionView *;
+        using reference = DnsQuestionView;
+
+        DnsQuestionIterator() = default;
+        DnsQuestionIterator(ByteSpan msg, int pos, int remaining) : msg_(msg), pos_(pos), remaining_(remaining) {}
+
+        DnsQuestionView operator*() const;
+        DnsQuestionIterator &operator++();
+        bool operator==(const DnsQuestionIterator &other) const { return remaining_ == other.remaining_; }
+
+    private:
+        ByteSpan msg_;
+        int pos_ = 0;
+        int remaining_ = 0;
+    };
+
+    class DnsRecordIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = DnsRecordView;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const DnsRecordView *;
+        using reference = DnsRecordView;
+
+        DnsRecordIterator() = default;
+        DnsRecordIterator(ByteSpan msg, int pos, int remaining) : msg_(msg), pos_(pos), remaining_(remaining) {}
+
+        DnsRecordView operator*() const;
+        DnsRecordIterator &operator++();
+        bool operator==(const DnsRecordIterator &other) const { return remaining_ == other.remaining_; }
+
+    private:
+        ByteSpan msg_;
+        int pos_ = 0;
+        int remaining_ = 0;
+    };
+
+    template<class Iterator>
+    class DnsSection {
+    public:
+        DnsSection() = default;
+        DnsSection(ByteSpan msg, int pos, int count) : msg_(msg), pos_(pos), count_(count) {}
+
+        Iterator begin() const { return Iterator(msg_, pos_, count_); }
+        Iterator end() const { return Iterator(msg_, pos_, 0); }
+        int size() const { return count_; }
+        bool empty() const { return count_ == 0; }
+
+    private:
+        ByteSpan msg_;
+        int pos_ = 0;
+        int count_ = 0;
+    };
+
+    // Read-only view over a DNS message. Construction checks the header and that every
+    // section lies within the buffer; names and rdata are only decoded when asked for.
+    // Nothing here allocates, the view must not outlive the buffer.
+    class DnsMessageView {
+    public:
+        DnsMessageView() = default;
+        explicit DnsMessageView(ByteSpan msg);
+        DnsMessageView(const char *buf, int len) : DnsMessageView(std::as_bytes(std::span(buf, len < 0 ? 0 : len))) {}
+
+        bool valid() const { return valid_; }
+        const DnsHeader &header() const { return header_; }
+        unsigned short id() const { return header_.id; }
+        unsigned short rcode() const { return header_.flags & DNS_RCODE_MASK; }
+        bool response() const { return header_.flags & DNS_FLAG_QR; }
+        bool truncated() const { return header_.flags & DNS_FLAG_TC; }
+
+        DnsSection<DnsQuestionIterator> questions() const { return {msg_, DNS_HEADER_SIZE, valid_ ? header_.query_cnt : 0}; }
+        DnsSection<DnsRecordIterator> answers() const { return {msg_, answer_pos_, valid_ ? header_.answer_cnt : 0}; }
+        DnsSection<DnsRecordIterator> authorities() const { return {msg_, authority_pos_, valid_ ? header_.authority_cnt : 0}; }
+        DnsSection<DnsRecordIterator> additionals() const { return {msg_, additional_pos_, valid_ ? header_.additional_cnt : 0}; }
+        // answer, authority and additional sections back to back
+        DnsSection<DnsRecordIterator> records() const {
+            return {msg_, answer_pos_, valid_ ? header_.answer_cnt + header_.authority_cnt + header_.additional_cnt : 0};
+        }
+
+        // the OPT record of the additional section, false if the server did not answer with EDNS
+        bool edns(DnsOptView &opt) const;
+
+        ByteSpan bytes() const { return msg_; }
+        // end of the last record, anything after it is ignored
+        int length() const { return end_pos_; }
+
+    private:
+        ByteSpan msg_;
+        DnsHeader header_{};
+        bool valid_ = false;
+        int answer_pos_ = DNS_HEADER_SIZE;
+        int authority_pos_ = DNS_HEADER_SIZE;
+        int additional_pos_ = DNS_HEADER_SIZE;
+        int end_pos_ = 0;
+    };
+
+    // removes the OPT record of a message in place, for a reply to a client that sent no OPT.
+    // returns the new length, len if there is none, -1 for a malformed message
+    int StripOptRecord(char *buf, int len);
+
+} /* end of namespace DNS */
+#endif//DNS_CLIENT_DNS_MESSAGE_H
@@ -0,0 +1,375 @@
+#include "dns_printer.h"
+#include <fmt/format.h>
+#include <tabulate.hpp>
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/ioctl.h>
+
+using tabulate::FontAlign;
+using tabulate::FontStyle;
+using tabulate::Table;
+
+namespace DNS {
+    int FormatRecordData(const DnsRecordView &res, char *out, int out_len) {
+        std::array<unsigned char, 4> v4{};
+        std::array<unsigned char, 16> v6{};
+        DnsNameView name;
+        if (res.a(v4)) {
+            return inet_ntop(AF_INET, v4.data(), out, out_len) ? (int) strlen(out) : -1;
+        } else if (res.aaaa(v6)) {
+            return inet_ntop(AF_INET6, v6.data(), out, out_len) ? (int) strlen(out) : -1;
+        } else if (res.target(name)) {
+            return name.to_string(out, out_len);
+        }
+        DnsOptView opt{};
+        if (res.opt(opt)) {
+            int len = snprintf(out, out_len, "EDNS%u udp=%u%s", opt.version, opt.udp_payload, opt.flags & DNS_EDNS_FLAG_DO ? " do" : "");
+            return len < out_len ? len : -1;
+        }
+        int len = snprintf(out, out_len, "OTHERS");
+        return len < out_len ? len : -1;
+    }
+
+    static std::string FormatRecordData(const DnsRecordView &res) {
+        char buf[256];
+        int len = FormatRecordData(res, buf, sizeof(buf));
+        return len < 0 ? std::string("MALFORMED") : std::string(buf, len);
+    }
+
+    void printSectionTag(const std::string &section_name) {
+        fmt::print(
+                "┌{0:─^{2}}┐\n"
+                "│{1: ^{2}}│\n"
+                "└{0:─^{2}}┘\n",
+                "", section_name, 20);
+    }
+
+    void PrintBuffer(const char *buf, int len) {
+        int width = 16;
+
+        for (int i = 0; i < len; i++) {
+            if (i % width == 0) {
+                fmt::print("{:<5}", i / width);
+            }
+            char ch = ' ';
+            if ((i + 1) % width == 0) {
+                ch = '\n';
+            }
+            unsigned char byte = buf[i];
+            int hi = 0x0f & (byte >> 4);
+            int lo = 0x0f & byte;
+
+            fmt::print("{:X}{:X}{}", hi, lo, ch);
+        }
+        fmt::print("\n");
+    }
+
+    int ParseDnsResponsePacket(const char *buf, int end) {
+        if (buf == nullptr) {
+            return -1;
+        }
+        DNS::DnsMessageView msg(buf, end);
+        if (!msg.valid()) {
+            fmt::print("dns response malformed, {} bytes\n", end);
+            return -1;
+        }
+        return PrintDnsResponse(msg);
+    }
+
+    int PrintDnsResponse(const DnsMessageView &msg) {
+        // get current terminal col size
+        struct winsize w {};
+        ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+        int win_size = w.ws_col;
+
+
+        // query transaction id
+        uint16_t query_id = msg.id();
+
+        // |qr| opcode |aa|tc|rd|
+        uint16_t opcode_info = msg.header().flags;
+        if (opcode_info & 0x0f) {
+            fmt::print("dns ret code non-zero, ret = {}\n", opcode_info & 0x0f);
+            return -1;
+        }
+        if (msg.truncated()) {
+            fmt::print("response truncated (tc), some records are missing\n");
+        }
+
+        int table_width = 160;
+        int subtable_width = table_width - 10;
+        bool table_flag = win_size > table_width;
+        fmt::print("window columns={}{}{}, enbale_table={}\n", win_size, table_flag ? ">" : "<", table_width, table_flag);
+
+        // generate data table
+        Table dns_package;
+        dns_package.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(table_width);
+        dns_package.add_row({"DNS Response Package"});
+
+        //============header section=================
+        std::string response_state = opcode_info & 0x80 ? "true" : "false";
+
+        uint16_t query_cnt = msg.header().query_cnt;
+        uint16_t answer_cnt = msg.header().answer_cnt;
+        uint16_t authority_cnt = msg.header().authority_cnt;
+        uint16_t additional_cnt = msg.header().additional_cnt;
+
+        if (!table_flag) {
+            printSectionTag("header section");
+            fmt::print("query id: {}\nrecursived response: {}\nquery_cnt: {}\nanswer_cnt: {}\nauthority_cnt: {}\naddtional_cnt: {}\n",
+                       query_id,
+                       response_state,
+                       query_cnt,
+                       answer_cnt,
+                       authority_cnt,
+                       additional_cnt);
+        }
+
+        Table header;
+        header.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
+        header.add_row({"response header"});
+        Table header_section;
+        header_section.add_row({"query id", "recursived response", "query_cnt", "answer_cnt", "authority_cnt", "addtional_cnt"});
+        header_section.add_row({std::to_string(query_id), response_state, std::to_string(query_cnt), std::to_string(answer_cnt), std::to_string(authority_cnt), std::to_string(additional_cnt)});
+        header.add_row({header_section});
+        header[1].format().hide_border_top();
+        dns_package.add_row({header});
+        dns_package[1].format().hide_border_top();
+
+
+        //============query section=================
+        Table query;
+        query.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
+        query.add_row({"query section"});
+        Table query_section;
+        query_section.add_row({"host", "type", "class"});
+        if (!table_flag) {
+            printSectionTag("query section");
+        }
+
+        for (const DNS::DnsQuestionView &dns_question : msg.questions()) {
+            std::string host = dns_question.host.str();
+            query_section.add_row({host, std::to_string(dns_question.query_type), std::to_string(dns_question.query_class)});
+            if (!table_flag) {
+                fmt::print("host: {} type: {} class: {}\n", host, dns_question.query_type, dns_question.query_class);
+            }
+        }
+
+        query.add_row({query_section});
+        query[1].format().hide_border_top();
+        dns_package.add_row({query});
+        dns_package[2].format().hide_border_top();
+
+
+        //===========answer section=================
+        Table answer;
+        answer.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
+        answer.add_row({"answer section"});
+        Table answer_section;
+        answer_section.add_row({fmt::format("{:<55}", "host"), "type", "class", "ttl", "dlen", fmt::format("{:<55}", "data")});
+        if (!table_flag) {
+            printSectionTag("answer section");
+        }
+
+
+        for (const DNS::DnsRecordView &res : msg.answers()) {
+            std::string host = res.host.str();
+            std::string data = FormatRecordData(res);
+            answer_section.add_row({host, std::to_string(res.domain_type), std::to_string(res.domain_class), std::to_string(res.ttl), std::to_string(res.data_len), data});
+            if (!table_flag) {
+                fmt::print("host={}, type={}, class={}, ttl={}, dlen={}, data={}\n",
+                           host,
+                           res.domain_type,
+                           res.domain_class,
+                           res.ttl,
+                           res.data_len,
+                           data);
+            }
+        }
+        answer.add_row({answer_section});
+        answer[1].format().hide_border_top();
+        dns_package.add_row({answer});
+        dns_package[3].format().hide_border_top();
+
+
+        //==========authority section==============
+        Table authority;
+        authority.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
+        authority.add_row({"authority section"});
+        tabulate::Table authority_section;
+        authority_section.add_row({fmt::format("{:<55}", "host"), "type", "class", "ttl", "dlen", fmt::format("{:<55}", "data")});
+        if (!table_flag) {
+            printSectionTag("authority section");
+        }
+
+
+        for (const DNS::DnsRecordView &res : msg.authorities()) {
+            std::string host = res.host.str();
+            std::string data = FormatRecordData(res);
+            authority_section.add_row({host, std::to_string(res.domain_type), std::to_string(res.domain_class), std::to_string(res.ttl), std::to_string(res.data_len), data});
+            if (!table_flag) {
+                fmt::print("host={}, type={}, class={}, ttl={}, dlen={}, data={}\n",
+                           host,
+                           res.domain_type,
+                           res.domain_class,
+                           res.ttl,
+                           res.data_len,
+                           data);
+            }
+        }
+        authority.add_row({authority_section});
+        authority[1].format().hide_border_top();
+        dns_package.add_row({authority});
+        dns_package[4].format().hide_border_top();
+
+        //==========additional section=============
+        Table additional;
+        additional.format().font_style({FontStyle::bold}).font_align(FontAlign::center).width(subtable_width);
+        additional.add_row({"additional section"});
+        tabulate::Table additional_section;
+        additional.format().hide_border_top();
+        additional_section.add_row({fmt::format("{:<55}", "host"), "type", "class", "ttl", "dlen", fmt::format("{:<55}", "data")});
+        if (!table_flag) {
+            printSectionTag("additional section");
+        }
+
+        for (const DNS::DnsRecordView &res : msg.additionals()) {
+            std::string host = res.host.str();
+            std::string data = FormatRecordData(res);
+            additional_section.add_row({host, std::to_string(res.domain_type), std::to_string(res.domain_class), std::to_string(res.ttl), std::to_string(res.data_len), data});
+            if (!table_flag) {
+                fmt::print("host={}, type={}, class={}, ttl={}, dlen={}, data={}\n",
+                           host,
+                           res.domain_type,
+                           res.domain_class,
+                           res.ttl,
+                           res.data_len,
+                           data);
+            }
+        }
+
+        if (table_flag) {
+            additional.add_row({additional_section});
+            dns_package.add_row({additional});
+            dns_package[5].format().hide_border_top();
+            std::cout << dns_package << std::endl;
+        }
+        return 0;
+    }
+
+    // one tab separated line per answer record: host, rcode, type, ttl, data
+    int FormatDnsResponseLines(fmt::memory_buffer &out, std::string_view host, const DnsMessageView &msg) {
+        if (!msg.valid()) {
+            return -1;
+        }
+        if (msg.answers().empty()) {
+            fmt::format_to(std::back_inserter(out), "{}\t{}\t-\t-\t-\n", host, msg.rcode());
+            return 0;
+        }
+        char data[256];
+        for (const DNS::DnsRecordView &res : msg.answers()) {
+            int len = FormatRecordData(res, data, sizeof(data));
+            fmt::format_to(std::back_inserter(out), "{}\t{}\t{}\t{}\t{}\n", host, msg.rcode(), res.domain_type, res.ttl,
+                           std::string_view(data, len < 0 ? 0 : len));
+        }
+        return 0;
+    }
+
+    bool ParseOutputFormat(std::string_view name, OutputFormat &format) {
+        if (name == "table") {
+            format = OUTPUT_TABLE;
+        } else if (name == "tsv") {
+            format = OUTPUT_TSV;
+        } else if (name == "jsonl") {
+            format = OUTPUT_JSONL;
+        } else if (name == "binary") {
+            format = OUTPUT_BINARY;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    static void AppendJsonString(fmt::memory_buffer &out, std::string_view str) {
+        out.push_back('"');
+        for (char ch : str) {
+            if (ch == '"' || ch == '\\') {
+                out.push_back('\\');
+                out.push_back(ch);
+            } else if ((unsigned char) ch < 0x20) {
+                fmt::format_to(std::back_inserter(out), "\\u{:04x}", (unsigned char) ch);
+            } else {
+                out.push_back(ch);
+            }
+        }
+        out.push_back('"');
+    }
+
+    // {"host":..,"status":"ok","rcode":0,"answers":[{"name":..,"type":1,"ttl":300,"data":..}]}
+    static int FormatDnsResponseJson(fmt::memory_buffer &out, std::string_view host, unsigned char status, const DnsMessageView &msg) {
+        static const char *const status_names[] = {"ok", "error", "timeout"};
+        out.append(std::string_view("{\"host\":"));
+        AppendJsonString(out, host);
+        fmt::format_to(std::back_inserter(out), ",\"status\":\"{}\"", status_names[status <= RESULT_TIMEOUT ? status : RESULT_ERROR]);
+        if (status != RESULT_OK) {
+            out.append(std::string_view("}\n"));
+            return 0;
+        }
+        fmt::format_to(std::back_inserter(out), ",\"rcode\":{},\"answers\":[", msg.rcode());
+        char buf[256];
+        bool first = true;
+        for (const DNS::DnsRecordView &res : msg.answers()) {
+            out.append(std::string_view(first ? "{\"name\":" : ",{\"name\":"));
+            first = false;
+            int len = res.host.to_string(buf, sizeof(buf));
+            AppendJsonString(out, std::string_view(buf, len < 0 ? 0 : len));
+            fmt::format_to(std::back_inserter(out), ",\"type\":{},\"ttl\":{},\"data\":", res.domain_type, res.ttl);
+            len = FormatRecordData(res, buf, sizeof(buf));
+            AppendJsonString(out, std::string_view(buf, len < 0 ? 0 : len));
+            out.push_back('}');
+        }
+        out.append(std::string_view("]}\n"));
+        return 0;
+    }
+
+    int FormatDnsResult(fmt::memory_buffer &out, OutputFormat format, std::string_view host, unsigned char status,
+                        const char *packet, int len) {
+        DnsMessageView msg;
+        if (status == RESULT_OK) {
+            msg = DnsMessageView(packet, len);
+            if (!msg.valid()) {
+                status = RESULT_ERROR;
+            }
+        }
+        switch (format) {
+            case OUTPUT_TSV:
+                if (status != RESULT_OK) {
+                    fmt::format_to(std::back_inserter(out), "{}\t{}\t-\t-\t-\n", host, status == RESULT_TIMEOUT ? "timeout" : "error");
+                    return 0;
+                }
+                return FormatDnsResponseLines(out, host, msg);
+            case OUTPUT_JSONL:
+                return FormatDnsResponseJson(out, host, status, msg);
+            case OUTPUT_BINARY: {
+                host = host.substr(0, 255);
+                size_t packet_len = status == RESULT_OK ? (size_t) len : 0;
+                size_t rest = 2 + host.size() + packet_len;
+                if (rest > 0xffff) {
+                    return -1;
+                }
+                char head[4] = {(char) (rest >> 8), (char) rest, (char) status, (char) host.size()};
+                out.append(head, head + sizeof(head));
+                out.append(host);
+                out.append(packet, packet + packet_len);
+                return 0;
+            }
+            default:
+                return -1;
+        }
+    }
+
+} /* end of namespace DNS */
@@ -0,0 +1,40 @@
+#ifndef DNS_CLIENT_DNS_PRINTER_H
+#define DNS_CLIENT_DNS_PRINTER_H
+
+#include "dns.h"
+#include "dns_message.h"
+#include <fmt/format.h>
+
+#include <string_view>
+
+namespace DNS {
+
+    void PrintBuffer(const char *buf, int len);
+    // presentation form of the rdata, returns the length or -1
+    int FormatRecordData(const DnsRecordView &res, char *out, int out_len);
+    // interactive rendering, fancy tables when the terminal is wide enough
+    int PrintDnsResponse(const DnsMessageView &msg);
+    int ParseDnsResponsePacket(const char *buf, int end);
+    int FormatDnsResponseLines(fmt::memory_buffer &out, std::string_view host, const DnsMessageView &msg);
+
+    // output of a run: the interactive tables or a streaming, machine readable format
+    typedef enum tagOutputFormat {
+        OUTPUT_TABLE,
+        OUTPUT_TSV,   // FormatDnsResponseLines, host\ttimeout|error\t-\t-\t- on failure
+        OUTPUT_JSONL, // one json object per response
+        OUTPUT_BINARY,// u16 length of the rest, u8 status, u8 host length, host, raw response packet
+    } OutputFormat;
+
+    // result status, in the order of resolve_status
+    const static unsigned char RESULT_OK = 0;
+    const static unsigned char RESULT_ERROR = 1;
+    const static unsigned char RESULT_TIMEOUT = 2;
+
+    bool ParseOutputFormat(std::string_view name, OutputFormat &format);
+    // appends one result in a streaming format; packet is ignored unless status is RESULT_OK.
+    // returns -1 for OUTPUT_TABLE, which only renders interactively
+    int FormatDnsResult(fmt::memory_buffer &out, OutputFormat format, std::string_view host, unsigned char status,
+                        const char *packet, int len);
+
+}
+#endif//DNS_CLIENT_DNS_PRINTER_H
@@ -0,0 +1,193 @@
+#include "dns_query_encoder.h"
+#include "dns.h"
+
+#include <cstring>
+
+dns_query_encoder::dns_query_encoder(size_t max_entries, unsigned short edns_payload) : edns_payload_(edns_payload) {
+    if (max_entries > 0) {
+        size_t slots = 16;
+        while (slots < max_entries) {
+            slots *= 2;
+        }
+        slots_.resize(slots);
+    }
+    build_parts();
+}
+
+void dns_query_encoder::clear() {
+    std::fill(slots_.begin(), slots_.end(), slot{});
+    size_ = 0;
+}
+
+void dns_query_encoder::set_edns_payload(unsigned short edns_payload) {
+    if (edns_payload == edns_payload_) {
+        return;
+    }
+    edns_payload_ = edns_payload;
+    clear();
+    build_parts();
+}
+
+void dns_query_encoder::build_parts() {
+    // take header and tail from the reference encoder, so both always send the same bytes
+    char packet[DNS::DNS_MAX_QUERY_SIZE];
+    int len = DNS::BuildDnsQueryPacket("a", packet, 0, sizeof(packet), 0, 0, edns_payload_);
+    int tail_pos = DNS::DNS_HEADER_SIZE + 3 + 2;// "\1a\0" and the type
+    memcpy(header_, packet, sizeof(header_));
+    tail_len_ = len - tail_pos;
+    memcpy(tail_, packet + tail_pos, tail_len_);
+}
+
+uint32_t dns_query_encoder::hash_key(const char *wire, int wire_len, unsigned short query_type) {
+    // word at a time multiply-xorshift, names are short so this is a handful of rounds
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ ((uint64_t) wire_len * 0xff51afd7ed558ccdull) ^ query_type;
+    int i = 0;
+    for (; i + 8 <= wire_len; i += 8) {
+        uint64_t word;
+        memcpy(&word, wire + i, 8);
+        h = (h ^ word) * 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, wire + i, wire_len - i);
+    h = (h ^ tail) * 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 32;
+    return (uint32_t) h;
+}
+
+// ascii upper case letters of 8 bytes get the 0x20 bit
+static inline uint64_t lower_word(uint64_t word) {
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t high = 0x8080808080808080ull;
+    uint64_t low = word & ~high;
+    uint64_t upper = (low + 0x3f * ones) & ~(low + 0x25 * ones) & ~word & high;
+    return word | upper >> 2;
+}
+
+// high bit set in every byte of word that is a dot
+static inline uint64_t dot_mask(uint64_t word) {
+    const uint64_t high = 0x8080808080808080ull;
+    uint64_t x = word ^ 0x2e2e2e2e2e2e2e2eull;
+    return ~(((x & ~high) + ~high) | x) & high;
+}
+
+int dns_query_encoder::to_wire(std::string_view host, char *wire) {
+    int size = (int) host.size();
+    char *name = wire + 1;
+    // lower case copy 8 bytes at a time; the last partial word is an overlapping load and store
+    // ending at the last byte, names under 8 bytes go byte by byte
+    if (size >= 8) {
+        uint64_t word;
+        for (int i = 0; i + 8 <= size; i += 8) {
+            memcpy(&word, host.data() + i, 8);
+            word = lower_word(word);
+            memcpy(name + i, &word, 8);
+        }
+        memcpy(&word, host.data() + size - 8, 8);
+        word = lower_word(word);
+        memcpy(name + size - 8, &word, 8);
+    } else {
+        for (int i = 0; i < size; i++) {
+            unsigned char ch = host[i];
+            name[i] = (char) (ch | ((unsigned char) (ch - 'A') < 26) << 5);
+        }
+    }
+    // then the dots become label lengths, found a word at a time: a branch per label, not per byte
+    int len_pos = 0;
+    for (int i = 0; i < size; i += 8) {
+        uint64_t dots;
+        if (i + 8 <= size) {
+            uint64_t word;
+            memcpy(&word, name + i, 8);
+            dots = dot_mask(word);
+        } else if (size >= 8) {
+            // overlapping word ending at the last byte, its bytes before i were already scanned
+            uint64_t word;
+            memcpy(&word, name + size - 8, 8);
+            dots = dot_mask(word) >> ((i + 8 - size) * 8);
+        } else {
+            dots = 0;
+            for (int k = 0; k < size; k++) {
+                dots |= (uint64_t) (name[k] == '.') << (k * 8 + 7);
+            }
+        }
+        while (dots != 0) {
+            int pos = i + 1 + (__builtin_ctzll(dots) >> 3);
+            int len = pos - len_pos - 1;
+            if (len == 0 || len > 63) {
+                return -1;
+            }
+            wire[len_pos] = (char) len;
+            len_pos = pos;
+            dots &= dots - 1;
+        }
+    }
+    int len = size - len_pos;
+    if (len == 0 || len > 63) {
+        return -1;
+    }
+    wire[len_pos] = (char) len;
+    wire[size + 1] = 0;
+    return size + 2;
+}
+
+int dns_query_encoder::encode(std::string_view host, unsigned short query_type, unsigned short query_id, char *buf, int buf_len) {
+    if (!host.empty() && host.back() == '.') {
+        host.remove_suffix(1);
+    }
+    if (host.empty() || host.size() > 253) {
+        return -1;
+    }
+    int wire_len = (int) host.size() + 2;
+    int len = DNS::DNS_HEADER_SIZE + wire_len + 2 + tail_len_;
+    if (len > buf_len) {
+        return -1;
+    }
+    // the name is canonicalized straight into its place in the packet
+    if (to_wire(host, buf + DNS::DNS_HEADER_SIZE) < 0) {
+        return -1;
+    }
+    if (slots_.empty()) {
+        assemble(buf, wire_len, query_type);
+    } else {
+        probe(buf, wire_len, len, query_type);
+    }
+    buf[0] = 0xff & (query_id >> 8);
+    buf[1] = 0xff & query_id;
+    return len;
+}
+
+// header, type and tail around the wire name already at buf + 12
+void dns_query_encoder::assemble(char *buf, int wire_len, unsigned short query_type) const {
+    memcpy(buf, header_, DNS::DNS_HEADER_SIZE);
+    buf[DNS::DNS_HEADER_SIZE + wire_len] = (char) (query_type >> 8);
+    buf[DNS::DNS_HEADER_SIZE + wire_len + 1] = (char) query_type;
+    // fixed size copies, a variable one would be a library call
+    char *tail = buf + DNS::DNS_HEADER_SIZE + wire_len + 2;
+    if (tail_len_ == s_tail_size) {
+        memcpy(tail, tail_, s_tail_size);
+    } else {
+        memcpy(tail, tail_, 2);
+    }
+}
+
+void dns_query_encoder::probe(char *buf, int wire_len, int len, unsigned short query_type) {
+    const char *wire = buf + DNS::DNS_HEADER_SIZE;
+    uint32_t hash = hash_key(wire, wire_len, query_type);
+    slot &s = slots_[hash & (slots_.size() - 1)];
+    if (s.len == len && s.hash == hash && memcmp(s.packet + DNS::DNS_HEADER_SIZE, wire, wire_len) == 0 &&
+        (unsigned char) s.packet[DNS::DNS_HEADER_SIZE + wire_len] == query_type >> 8 &&
+        (unsigned char) s.packet[DNS::DNS_HEADER_SIZE + wire_len + 1] == (query_type & 0xff)) {
+        memcpy(buf, s.packet, len);
+        return;
+    }
+    assemble(buf, wire_len, query_type);
+    if (s.candidate != hash) {
+        s.candidate = hash;
+    } else if (len <= (int) sizeof(s.packet)) {
+        size_ += s.len == 0;
+        s.hash = hash;
+        s.len = (unsigned short) len;
+        memcpy(s.packet, buf, len);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef DNS_CLIENT_DNS_QUERY_ENCODER_H
+#define DNS_CLIENT_DNS_QUERY_ENCODER_H
+
+#include "dns.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Query encoder. Every name is canonicalized (lower case, no trailing dot) straight into its
+// wire form inside the packet, 8 bytes at a time, and header, type and the optional OPT record
+// are copied around it; measured against BuildDnsQueryPacket it is as fast on any name mix.
+// Optionally (max_entries > 0) it keeps a small direct mapped table of inline templates keyed by
+// the canonical wire name and qtype. A template is only stored the second time its slot sees
+// the name, so one-shot names never evict hot ones. The probe costs more than assembling the
+// packet (query_encode_bench), so the resolvers run without it.
+// Not thread safe, every resolver owns its own encoder.
+class dns_query_encoder {
+public:
+    // table size worth trying with the template cache, about 256 KiB
+    static constexpr size_t s_cache_entries = 2048;
+
+    explicit dns_query_encoder(size_t max_entries = 0, unsigned short edns_payload = 0);
+
+    dns_query_encoder(const dns_query_encoder &) = delete;
+    dns_query_encoder &operator=(const dns_query_encoder &) = delete;
+
+    // returns the packet length, or -1 for an invalid name or a too small buffer
+    int encode(std::string_view host, unsigned short query_type, unsigned short query_id, char *buf, int buf_len);
+
+    // templates currently cached
+    size_t size() const { return size_; }
+    void clear();
+
+    // 0 sends plain queries, otherwise an OPT record advertising this udp payload.
+    // cached templates are dropped when it changes.
+    void set_edns_payload(unsigned short edns_payload);
+    unsigned short edns_payload() const { return edns_payload_; }
+
+private:
+    static constexpr size_t s_slot_size = 128;
+
+    // two cache lines; names whose template does not fit are always assembled
+    struct slot {
+        uint32_t hash;
+        uint32_t candidate;// hash of the last name that missed here, admitted on its next miss
+        unsigned short len;// 0 while empty
+        char packet[s_slot_size - 10];
+    };
+
+    void build_parts();
+    void assemble(char *buf, int wire_len, unsigned short query_type) const;
+    void probe(char *buf, int wire_len, int len, unsigned short query_type);
+    static uint32_t hash_key(const char *wire, int wire_len, unsigned short query_type);
+    // lower cased wire form of a non-empty name without trailing dot, -1 for an invalid name
+    static int to_wire(std::string_view host, char *wire);
+
+    unsigned short edns_payload_;
+    size_t size_ = 0;
+    // header and class + OPT record of every query, the parts around the name and type
+    char header_[12];
+    static constexpr int s_tail_size = 2 + DNS::DNS_OPT_RECORD_SIZE;
+    char tail_[s_tail_size];
+    int tail_len_ = 0;
+    std::vector<slot> slots_;
+};
+
+#endif//DNS_CLIENT_DNS_QUERY_ENCODER_H
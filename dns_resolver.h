@@ -0,0 +1,770 @@
+#ifndef DNS_CLIENT_DNS_RESOLVER_H
+#define DNS_CLIENT_DNS_RESOLVER_H
+
+#include <utility>
+#include "asio.hpp"
+#include "dns.h"
+#include "dns_cache.h"
+#include "dns_message.h"
+#include "dns_printer.h"
+#include "dns_query_encoder.h"
+#include "dns_transport.h"
+#include "hosts_file.h"
+#include "resolv_conf.h"
+#include "resolver_metrics.h"
+#include "retry_policy.h"
+#include "tcp_pool.h"
+#include "timing_wheel.h"
+#include "upstream_set.h"
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum class resolve_status {
+    ok,
+    error,
+    timeout,// no reply after every attempt of the retry policy
+};
+
+struct dns_result {
+    std::string_view host;
+    unsigned short query_type;
+    resolve_status status;
+    const char *packet;// response packet, only valid inside the handler
+    int len;
+    unsigned int attempts;// datagrams sent for this query, 0 for a cache hit
+};
+
+// owning, decoded copy of a result for the awaitable api
+struct dns_record {
+    std::string name;
+    unsigned short type;
+    unsigned short domain_class;
+    unsigned int ttl;
+    std::string data;// presentation form, dotted address or domain name
+};
+
+struct dns_answer {
+    std::string host;
+    unsigned short query_type = 0;
+    resolve_status status = resolve_status::error;
+    unsigned short rcode = 0;
+    unsigned int attempts = 0;
+    std::vector<dns_record> records;// answer section
+
+    bool ok() const { return status == resolve_status::ok && rcode == DNS::DNS_RCODE_NOERROR; }
+};
+
+inline dns_answer make_dns_answer(const dns_result &result) {
+    dns_answer answer{std::string(result.host), result.query_type, result.status, 0, result.attempts, {}};
+    if (result.status != resolve_status::ok) {
+        return answer;
+    }
+    DNS::DnsMessageView msg(result.packet, result.len);
+    if (!msg.valid()) {
+        answer.status = resolve_status::error;
+        return answer;
+    }
+    answer.rcode = msg.rcode();
+    answer.records.reserve(msg.answers().size());
+    char buf[1024];
+    for (const DNS::DnsRecordView &res : msg.answers()) {
+        int name_len = res.host.to_string(buf, sizeof(buf));
+        dns_record record{name_len < 0 ? std::string() : std::string(buf, name_len), res.domain_type, res.domain_class, res.ttl, {}};
+        int data_len = DNS::FormatRecordData(res, buf, sizeof(buf));
+        if (data_len >= 0) {
+            record.data.assign(buf, data_len);
+        }
+        answer.records.push_back(std::move(record));
+    }
+    return answer;
+}
+
+// pipelined resolver: keeps up to max_in_flight queries outstanding on one socket,
+// every query gets its own transaction id and replies are matched by id + question.
+// Lost queries are retransmitted with the same id under the retry policy; all their
+// timers live in one timing wheel driven by a single steady_timer.
+// With several upstreams every send goes to the server with the best smoothed rtt, and a
+// query still unanswered after the hedge delay (a percentile of recent rtts) is copied to
+// the next best one. The first valid reply from any server the query was sent to wins.
+// A truncated reply moves the query to the pooled, pipelined TCP connections of the
+// server that sent it.
+// Identical concurrent lookups (same name, case insensitive, and type) share one query:
+// later callers wait on the slot already in flight and complete from its response.
+// Counters and rtt histograms per upstream are kept in metrics(), readable from any thread.
+// With a hosts file, names it lists are answered without any I/O. With a search list, a name
+// is expanded into its candidates and all of them are asked at once; the first one in list
+// order that has records wins (see resolv_conf::candidates).
+class dns_resolver {
+public:
+    using handler_type = std::function<void(const dns_result &)>;
+
+    static constexpr size_t s_max_in_flight = 65535;
+
+    dns_resolver(asio::io_context &ios, const udp::endpoint &server, size_t max_in_flight)
+        : dns_resolver(std::make_unique<asio_udp_transport>(udp::socket(ios, udp::endpoint(server.protocol(), 0))), server, max_in_flight) {}
+
+    dns_resolver(std::unique_ptr<dns_transport> transport, const udp::endpoint &server, size_t max_in_flight,
+                 unsigned short id_stride = 1, unsigned short id_offset = 0)
+        : dns_resolver(std::move(transport), std::vector<udp::endpoint>{server}, max_in_flight, id_stride, id_offset) {}
+
+    // the transport's socket is already open and bound. Only ids with id % id_stride == id_offset
+    // are used, so resolvers sharing one port can be told apart by transaction id.
+    // servers must not be empty, at most upstream_set::s_max_upstreams are used.
+    dns_resolver(std::unique_ptr<dns_transport> transport, const std::vector<udp::endpoint> &servers, size_t max_in_flight,
+                 unsigned short id_stride = 1, unsigned short id_offset = 0)
+        : transport_(std::move(transport)),
+          upstreams_(servers),
+          metrics_(upstream_endpoints(upstreams_)),
+          id_to_slot_(65536, -1),
+          tick_timer_(transport_->socket().get_executor()),
+          tcp_(transport_->socket().get_executor(), tcp_servers(upstreams_)) {
+        transport_->set_receive_handler([this](const udp::endpoint &from, const char *data, size_t len) { on_packet(from, data, len); });
+        transport_->set_error_handler([this](bool sending, const asio::error_code &) {
+            (sending ? metrics_.send_errors : metrics_.receive_errors).add();
+        });
+        tcp_.set_handlers([this](int server, const char *data, size_t len) { on_tcp_packet(server, data, len); },
+                          [this](int, unsigned short query_id) { on_tcp_failure(query_id); });
+        for (unsigned int id = id_offset; id < 65536; id += std::max<unsigned short>(id_stride, 1)) {
+            free_ids_.push_back(id);
+        }
+        // one id more than slots, the ring is never completely drained
+        slots_.resize(std::clamp<size_t>(max_in_flight, 1, std::min(s_max_in_flight, free_ids_.size() - 1)));
+        free_slots_.reserve(slots_.size());
+        queries_by_key_.reserve(slots_.size());
+        for (size_t i = slots_.size(); i > 0; i--) {
+            free_slots_.push_back(i - 1);
+        }
+        // timer id i is the retransmit timer of slot i, capacity + i its hedge timer
+        wheel_ = std::make_unique<timing_wheel>(slots_.size() * 2, std::chrono::milliseconds(1));
+        // ids are handed out from a shuffled ring, so a freed id is not reused soon
+        std::shuffle(free_ids_.begin(), free_ids_.end(), std::mt19937(std::random_device{}()));
+    }
+
+    dns_resolver(const dns_resolver &) = delete;
+    dns_resolver &operator=(const dns_resolver &) = delete;
+
+    // Completion token flavour of async_resolve, e.g. asio::use_awaitable. The handler gets a
+    // decoded dns_answer and, as asio requires, never runs inside this call, cache hits included.
+    // Like every other member, call it from the thread running the resolver's io_context.
+    template<class CompletionToken>
+    auto async_lookup(std::string host, unsigned short query_type, CompletionToken &&token) {
+        return asio::async_initiate<CompletionToken, void(dns_answer)>(
+                [this](auto handler, std::string host, unsigned short query_type) {
+                    auto shared = std::make_shared<decltype(handler)>(std::move(handler));
+                    auto initiating = std::make_shared<bool>(true);
+                    async_resolve(std::move(host), query_type, [this, shared, initiating](const dns_result &result) {
+                        deliver(shared, initiating, make_dns_answer(result));
+                    });
+                    *initiating = false;
+                },
+                token, std::move(host), query_type);
+    }
+
+    // every name resolved concurrently, the answers in the order of the names
+    template<class CompletionToken>
+    auto async_lookup_all(std::vector<std::string> hosts, unsigned short query_type, CompletionToken &&token) {
+        return asio::async_initiate<CompletionToken, void(std::vector<dns_answer>)>(
+                [this](auto handler, std::vector<std::string> hosts, unsigned short query_type) {
+                    struct gather {
+                        std::vector<dns_answer> answers;
+                        size_t remaining;
+                    };
+                    auto shared = std::make_shared<decltype(handler)>(std::move(handler));
+                    auto initiating = std::make_shared<bool>(true);
+                    auto state = std::make_shared<gather>(gather{std::vector<dns_answer>(hosts.size()), hosts.size()});
+                    if (hosts.empty()) {
+                        deliver(shared, initiating, std::vector<dns_answer>());
+                    }
+                    for (size_t i = 0; i < hosts.size(); i++) {
+                        async_resolve(std::move(hosts[i]), query_type, [this, shared, initiating, state, i](const dns_result &result) {
+                            state->answers[i] = make_dns_answer(result);
+                            if (--state->remaining == 0) {
+                                deliver(shared, initiating, std::move(state->answers));
+                            }
+                        });
+                    }
+                    *initiating = false;
+                },
+                token, std::move(hosts), query_type);
+    }
+
+    // co_await resolver.resolve("example.com", DNS::DNS_TYPE_A) inside a coroutine
+    // spawned on the resolver's io_context
+    asio::awaitable<dns_answer> resolve(std::string host, unsigned short query_type = DNS::DNS_TYPE_A) {
+        co_return co_await async_lookup(std::move(host), query_type, asio::use_awaitable);
+    }
+
+    asio::awaitable<std::vector<dns_answer>> resolve_all(std::vector<std::string> hosts, unsigned short query_type = DNS::DNS_TYPE_A) {
+        co_return co_await async_lookup_all(std::move(hosts), query_type, asio::use_awaitable);
+    }
+
+    void async_resolve(std::string host, unsigned short query_type, handler_type handler) {
+        // a trailing dot keeps the name out of the search list
+        bool absolute = !host.empty() && host.back() == '.';
+        if (absolute) {
+            host.pop_back();
+        }
+        // hosts and cache hits complete inline, before async_resolve returns
+        if (hosts_ != nullptr) {
+            char buf[s_buff_size];
+            int len = hosts_->answer(host, query_type, 0, buf, sizeof(buf));
+            if (len > 0) {
+                metrics_.hosts_answers.add();
+                handler(dns_result{host, query_type, resolve_status::ok, buf, len, 0});
+                return;
+            }
+        }
+        if (!absolute && !search_.search.empty()) {
+            std::vector<std::string> names = search_.candidates(host);
+            if (names.size() > 1) {
+                search(std::move(host), query_type, std::move(names), std::move(handler));
+                return;
+            }
+        }
+        resolve_name(std::move(host), query_type, std::move(handler));
+    }
+
+    // optional, shared by every resolver that is handed the same cache
+    void set_cache(dns_cache *cache) { cache_ = cache; }
+    // optional, shared like the cache
+    void set_hosts(hosts_file *hosts) { hosts_ = hosts; }
+    // search domains and ndots of a resolv.conf, an empty search list turns expansion off
+    void set_search(const resolv_conf &conf) {
+        search_.search = conf.search;
+        search_.ndots = conf.ndots;
+    }
+    // applies to queries started afterwards
+    void set_retry_policy(const retry_policy &policy) { policy_ = policy; }
+    // advertised EDNS0 udp payload, 0 sends plain queries. Servers that answer FORMERR
+    // to the OPT record are asked again without it.
+    void set_edns_payload(unsigned short payload) { encoder_.set_edns_payload(std::min(payload, DNS::DNS_MAX_EDNS_PAYLOAD_SIZE)); }
+
+    // percentile of recent rtts after which an unanswered query is hedged, 0 disables hedging
+    void set_hedge_percentile(double percentile) { hedge_percentile_ = percentile; }
+
+    using executor_type = udp::socket::executor_type;
+    executor_type get_executor() { return transport_->socket().get_executor(); }
+
+    const upstream_set &upstreams() const { return upstreams_; }
+    const resolver_metrics &metrics() const { return metrics_; }
+    size_t tcp_fallbacks() const { return tcp_fallbacks_; }
+    size_t capacity() const { return slots_.size(); }
+    size_t in_flight() const { return slots_.size() - free_slots_.size(); }
+    size_t pending() const { return pending_.size(); }
+
+private:
+    // one name as it is, no hosts file and no search list
+    void resolve_name(std::string host, unsigned short query_type, handler_type handler) {
+        // cache hits complete inline, before async_resolve returns
+        if (cache_ != nullptr) {
+            char buf[s_buff_size];
+            int len = cache_->lookup(host, query_type, DNS::DNS_CLASS_IN, buf, sizeof(buf));
+            if (len > 0) {
+                metrics_.cache_hits.add();
+                handler(dns_result{host, query_type, resolve_status::ok, buf, len, 0});
+                return;
+            }
+        }
+        if (join_in_flight(host, query_type, handler)) {
+            return;
+        }
+        if (free_slots_.empty()) {
+            pending_.push_back({std::move(host), query_type, std::move(handler)});
+            metrics_.pending.set((int64_t) pending_.size());
+            return;
+        }
+        start_query(std::move(host), query_type, std::move(handler));
+    }
+
+    struct search_answer {
+        bool done = false;
+        resolve_status status = resolve_status::error;
+        unsigned int attempts = 0;
+        std::string packet;
+    };
+
+    struct search_state {
+        std::string host;// as it was asked, the result carries this name
+        unsigned short query_type = 0;
+        handler_type handler;
+        std::vector<search_answer> answers;// one per candidate, in preference order
+        size_t name_index = 0;// candidate that is the name itself
+        size_t next = 0;// first candidate whose answer is not known to be unusable
+        bool finished = false;
+    };
+
+    // every candidate goes out at once, the answers are settled in list order
+    void search(std::string host, unsigned short query_type, std::vector<std::string> names, handler_type handler) {
+        metrics_.searches.add();
+        auto state = std::make_shared<search_state>();
+        state->query_type = query_type;
+        state->handler = std::move(handler);
+        state->answers.resize(names.size());
+        state->name_index = std::find(names.begin(), names.end(), host) - names.begin();
+        state->host = std::move(host);
+        for (size_t i = 0; i < names.size() && !state->finished; i++) {
+            resolve_name(std::move(names[i]), query_type, [this, state, i](const dns_result &result) {
+                search_answer &answer = state->answers[i];
+                answer.done = true;
+                answer.status = result.status;
+                answer.attempts = result.attempts;
+                if (result.status == resolve_status::ok) {
+                    answer.packet.assign(result.packet, result.len);
+                }
+                settle_search(state);
+            });
+        }
+    }
+
+    void settle_search(const std::shared_ptr<search_state> &state) {
+        if (state->finished) {
+            return;
+        }
+        auto has_records = [](const search_answer &answer, bool nodata) {
+            DNS::DnsMessageView msg(answer.packet.data(), (int) answer.packet.size());
+            return answer.status == resolve_status::ok && msg.valid() && msg.rcode() == DNS::DNS_RCODE_NOERROR &&
+                   (nodata || msg.answers().size() > 0);
+        };
+        std::vector<search_answer> &answers = state->answers;
+        while (state->next < answers.size() && answers[state->next].done) {
+            if (has_records(answers[state->next], false)) {
+                finish_search(state, answers[state->next]);
+                return;
+            }
+            state->next++;
+        }
+        if (state->next < answers.size()) {
+            return;
+        }
+        // nothing has records: a name that exists (NODATA) beats the answer for the name itself
+        auto nodata = std::find_if(answers.begin(), answers.end(), [&](const search_answer &answer) { return has_records(answer, true); });
+        finish_search(state, nodata != answers.end() ? *nodata : answers[std::min(state->name_index, answers.size() - 1)]);
+    }
+
+    void finish_search(const std::shared_ptr<search_state> &state, const search_answer &answer) {
+        state->finished = true;
+        handler_type handler = std::move(state->handler);
+        handler(dns_result{state->host, state->query_type, answer.status, answer.packet.data(), (int) answer.packet.size(), answer.attempts});
+    }
+
+    // hand a result to an asio completion handler on its own executor, posted if the
+    // operation finished before its initiating function returned
+    template<class Handler, class Result>
+    void deliver(const std::shared_ptr<Handler> &handler, const std::shared_ptr<bool> &initiating, Result result) {
+        auto executor = asio::get_associated_executor(*handler, transport_->socket().get_executor());
+        auto call = [handler, result = std::move(result)]() mutable { std::move(*handler)(std::move(result)); };
+        if (*initiating) {
+            asio::post(executor, std::move(call));
+        } else {
+            asio::dispatch(executor, std::move(call));
+        }
+    }
+
+    struct waiter {
+        std::string host;
+        handler_type handler;
+    };
+
+    struct query_slot {
+        std::string host;
+        unsigned short query_type = 0;
+        unsigned short query_id = 0;
+        bool busy = false;
+        bool tcp = false;// truncated over udp, asked again over tcp
+        unsigned int attempts = 0;
+        int server = -1;// upstream of the latest send
+        int hedge = -1;// upstream of the hedged copy of the latest send
+        uint64_t tried = 0;// bit per upstream the query went to
+        timing_wheel::clock::time_point sent_at;
+        timing_wheel::clock::time_point hedged_at;
+        handler_type handler;
+        std::vector<waiter> waiters;// coalesced callers of the same lookup
+        std::string key;// backs the queries_by_key_ entry while busy
+        int len = 0;
+        char packet[DNS::DNS_MAX_QUERY_SIZE];
+    };
+
+    struct pending_query {
+        std::string host;
+        unsigned short query_type;
+        handler_type handler;
+    };
+
+    // lower cased name and the type, the name is unique per question in flight
+    static void make_key(std::string_view host, unsigned short query_type, std::string &key) {
+        key.resize(host.size() + 2);
+        for (size_t i = 0; i < host.size(); i++) {
+            key[i] = (char) std::tolower((unsigned char) host[i]);
+        }
+        key[host.size()] = (char) (query_type >> 8);
+        key[host.size() + 1] = (char) query_type;
+    }
+
+    // attach to an identical query already in flight; key_ holds the key afterwards
+    bool join_in_flight(std::string &host, unsigned short query_type, handler_type &handler) {
+        make_key(host, query_type, key_);
+        auto it = queries_by_key_.find(key_);
+        if (it == queries_by_key_.end()) {
+            return false;
+        }
+        slots_[it->second].waiters.push_back({std::move(host), std::move(handler)});
+        metrics_.coalesced.add();
+        return true;
+    }
+
+    void start_query(std::string host, unsigned short query_type, handler_type handler) {
+        int index = free_slots_.back();
+        free_slots_.pop_back();
+        query_slot &slot = slots_[index];
+        slot.query_id = free_ids_[id_head_];
+        id_head_ = (id_head_ + 1) % free_ids_.size();
+        slot.len = encoder_.encode(host, query_type, slot.query_id, slot.packet, sizeof(slot.packet));
+        slot.host = std::move(host);
+        slot.query_type = query_type;
+        slot.handler = std::move(handler);
+        slot.busy = true;
+        slot.attempts = 0;
+        slot.tcp = false;
+        slot.tried = 0;
+        id_to_slot_[slot.query_id] = index;
+        slot.key = key_;
+        queries_by_key_.emplace(slot.key, index);
+        metrics_.queries.add();
+        metrics_.in_flight.set((int64_t) in_flight());
+
+        if (slot.len <= 0) {
+            complete(index, resolve_status::error, nullptr, 0);
+            return;
+        }
+        if (send(index)) {
+            transport_->start_receive();
+        }
+    }
+
+    // (re)send the slot's packet to the best upstream and arm its timers for this attempt
+    bool send(int index) {
+        query_slot &slot = slots_[index];
+        int server = upstreams_.select();
+        if (slot.tcp) {
+            tcp_.send(server, slot.packet, slot.len);
+        } else if (!transport_->send(slot.packet, slot.len, upstreams_[server].endpoint)) {
+            complete(index, resolve_status::error, nullptr, 0);
+            return false;
+        }
+        upstreams_.on_send(server, false);
+        upstream_metrics &m = metrics_.upstream(server);
+        m.sent.add();
+        m.retransmits.add(slot.attempts > 0);
+        m.tcp_sent.add(slot.tcp);
+        slot.attempts++;
+        set_upstream(slot.server, server);
+        set_upstream(slot.hedge, -1);
+        slot.tried |= uint64_t(1) << server;
+        slot.sent_at = timing_wheel::clock::now();
+
+        auto timeout = policy_.timeout_for(slot.attempts);
+        wheel_->arm(index, slot.sent_at + timeout);
+        if (hedge_percentile_ > 0 && upstreams_.size() > 1 && !slot.tcp) {
+            auto delay = upstreams_.hedge_delay(hedge_percentile_, timeout / 2);
+            if (delay < timeout) {
+                wheel_->arm(hedge_timer(index), slot.sent_at + delay);
+            }
+        }
+        if (!ticking_) {
+            ticking_ = true;
+            arm_tick();
+        }
+        return true;
+    }
+
+    void on_timer(int id) {
+        if (id >= (int) slots_.size()) {
+            on_hedge(id - (int) slots_.size());
+        } else {
+            on_timeout(id);
+        }
+    }
+
+    void on_timeout(int index) {
+        query_slot &slot = slots_[index];
+        if (!slot.busy) {
+            return;
+        }
+        auto waited = timing_wheel::clock::now() - slot.sent_at;
+        upstreams_.on_timeout(slot.server, waited);
+        metrics_.upstream(slot.server).timeouts.add();
+        if (slot.hedge >= 0) {
+            upstreams_.on_timeout(slot.hedge, timing_wheel::clock::now() - slot.hedged_at);
+            metrics_.upstream(slot.hedge).timeouts.add();
+        }
+        if (slot.attempts >= policy_.attempts) {
+            complete(index, resolve_status::timeout, nullptr, 0);
+            return;
+        }
+        // same id and packet, a late reply to any earlier attempt still completes the query
+        wheel_->cancel(hedge_timer(index));
+        send(index);
+    }
+
+    // no reply within the hedge delay: send a copy to the next best server, same id
+    void on_hedge(int index) {
+        query_slot &slot = slots_[index];
+        if (!slot.busy || slot.tcp) {
+            return;
+        }
+        int server = upstreams_.select(slot.server);
+        if (server < 0 || !transport_->send(slot.packet, slot.len, upstreams_[server].endpoint)) {
+            return;
+        }
+        upstreams_.on_send(server, true);
+        metrics_.upstream(server).sent.add();
+        metrics_.upstream(server).hedges.add();
+        set_upstream(slot.hedge, server);
+        slot.tried |= uint64_t(1) << server;
+        slot.hedged_at = timing_wheel::clock::now();
+    }
+
+    int hedge_timer(int index) const { return (int) slots_.size() + index; }
+
+    // slot.server and slot.hedge only change here, so every upstream's in_flight gauge follows them
+    void set_upstream(int &which, int server) {
+        if (which >= 0) {
+            metrics_.upstream(which).in_flight.add(-1);
+        }
+        if (server >= 0) {
+            metrics_.upstream(server).in_flight.add(1);
+        }
+        which = server;
+    }
+
+    void arm_tick() {
+        tick_timer_.expires_after(wheel_->tick());
+        tick_timer_.async_wait([this](const asio::error_code &err) {
+            if (err || !ticking_) {
+                return;
+            }
+            wheel_->advance(timing_wheel::clock::now(), [this](int id) { on_timer(id); });
+            if (wheel_->empty()) {
+                ticking_ = false;
+            } else {
+                arm_tick();
+            }
+        });
+    }
+
+    void complete(int index, resolve_status status, const char *packet, int len) {
+        query_slot &slot = slots_[index];
+        handler_type handler = std::move(slot.handler);
+        std::string host = std::move(slot.host);
+        std::vector<waiter> waiters;
+        waiters.swap(slot.waiters);
+        // a handler may start new queries, which can reuse this slot right away
+        unsigned short query_type = slot.query_type;
+        unsigned int attempts = slot.attempts;
+        queries_by_key_.erase(slot.key);
+        slot.busy = false;
+        set_upstream(slot.server, -1);
+        set_upstream(slot.hedge, -1);
+        wheel_->cancel(index);
+        wheel_->cancel(hedge_timer(index));
+        if (slot.tcp) {
+            tcp_.forget(slot.query_id);
+        }
+        id_to_slot_[slot.query_id] = -1;
+        free_ids_[id_tail_] = slot.query_id;
+        id_tail_ = (id_tail_ + 1) % free_ids_.size();
+        free_slots_.push_back(index);
+
+        (status == resolve_status::ok ? metrics_.answered : status == resolve_status::timeout ? metrics_.timeouts : metrics_.errors).add();
+        if (cache_ != nullptr && status == resolve_status::ok) {
+            cache_->insert(host, query_type, DNS::DNS_CLASS_IN, packet, len);
+        }
+        handler(dns_result{host, query_type, status, packet, len, attempts});
+        for (waiter &w : waiters) {
+            w.handler(dns_result{w.host, query_type, status, packet, len, attempts});
+        }
+
+        while (!pending_.empty() && !free_slots_.empty()) {
+            pending_query query = std::move(pending_.front());
+            pending_.pop_front();
+            if (!join_in_flight(query.host, query.query_type, query.handler)) {
+                start_query(std::move(query.host), query.query_type, std::move(query.handler));
+            }
+        }
+        metrics_.in_flight.set((int64_t) in_flight());
+        metrics_.pending.set((int64_t) pending_.size());
+        if (in_flight() == 0) {
+            transport_->stop_receive();
+            if (ticking_) {
+                // nothing left to time out, let the io_context run out of work
+                ticking_ = false;
+                tick_timer_.cancel();
+            }
+        }
+    }
+
+    // the reply has to carry a known id and echo exactly the question we asked
+    int match(const char *buf, int len, DNS::DnsMessageView &msg) {
+        msg = DNS::DnsMessageView(buf, len);
+        if (!msg.valid() || !msg.response() || msg.questions().size() != 1) {
+            return -1;
+        }
+        int index = id_to_slot_[msg.id()];
+        if (index < 0 || !slots_[index].busy) {
+            return -1;
+        }
+        const query_slot &slot = slots_[index];
+        DNS::DnsQuestionView question = *msg.questions().begin();
+        if (question.query_type != slot.query_type || question.query_class != DNS::DNS_CLASS_IN ||
+            !question.host.equals(slot.host)) {
+            return -1;
+        }
+        return index;
+    }
+
+    void on_packet(const udp::endpoint &from, const char *data, size_t len) {
+        int server = upstreams_.find(from);
+        if (server < 0) {
+            return;
+        }
+        DNS::DnsMessageView msg;
+        int index = match(data, len, msg);
+        if (index < 0 || !(slots_[index].tried & (uint64_t(1) << server))) {
+            return;
+        }
+        query_slot &slot = slots_[index];
+        bool truncated = msg.truncated();
+        if (truncated && slot.tcp) {
+            return;
+        }
+        on_response(server, msg);
+        auto now = timing_wheel::clock::now();
+        if (server == slot.hedge) {
+            // the hedge won, the primary is at least this slow
+            upstreams_.on_reply(server, now - slot.hedged_at);
+            upstreams_.on_slow(slot.server, now - slot.sent_at);
+            record_rtt(server, now - slot.hedged_at);
+        } else if (server == slot.server && slot.attempts == 1) {
+            upstreams_.on_reply(server, now - slot.sent_at);
+            record_rtt(server, now - slot.sent_at);
+        } else {
+            // reply to a retransmitted query, the rtt is ambiguous
+            upstreams_.on_reply(server, timing_wheel::clock::duration(-1));
+        }
+        DNS::DnsOptView opt{};
+        if (msg.rcode() == DNS::DNS_RCODE_FORMERR && !msg.edns(opt) && !slot.tcp) {
+            int len = DNS::StripQueryOptRecord(slot.packet, slot.len);
+            if (len > 0) {
+                // an old server that does not speak EDNS0, same server without the OPT record
+                slot.len = len;
+                transport_->send(slot.packet, slot.len, upstreams_[server].endpoint);
+                return;
+            }
+        }
+        if (truncated) {
+            // the answer does not fit, ask the same server again over tcp with a fresh timer
+            slot.tcp = true;
+            tcp_fallbacks_++;
+            wheel_->cancel(hedge_timer(index));
+            tcp_.send(server, slot.packet, slot.len);
+            metrics_.upstream(server).sent.add();
+            metrics_.upstream(server).tcp_sent.add();
+            set_upstream(slot.server, server);
+            set_upstream(slot.hedge, -1);
+            slot.sent_at = timing_wheel::clock::now();
+            wheel_->arm(index, slot.sent_at + policy_.timeout_for(slot.attempts));
+            return;
+        }
+        complete(index, resolve_status::ok, data, len);
+    }
+
+    void on_tcp_packet(int server, const char *data, size_t len) {
+        DNS::DnsMessageView msg;
+        int index = match(data, len, msg);
+        if (index >= 0 && slots_[index].tcp) {
+            upstreams_.on_reply(server, timing_wheel::clock::duration(-1));
+            on_response(server, msg);
+            record_rtt(server, timing_wheel::clock::now() - slots_[index].sent_at);
+            complete(index, resolve_status::ok, data, len);
+        }
+    }
+
+    // the connection went away under the query, handle it like a timeout right now
+    void on_tcp_failure(unsigned short query_id) {
+        int index = id_to_slot_[query_id];
+        if (index >= 0 && slots_[index].busy && slots_[index].tcp) {
+            wheel_->cancel(index);
+            on_timeout(index);
+        }
+    }
+
+    void on_response(int server, const DNS::DnsMessageView &msg) {
+        upstream_metrics &m = metrics_.upstream(server);
+        m.responses.add();
+        m.rcodes[msg.rcode()].add();
+        m.truncated.add(msg.truncated());
+    }
+
+    void record_rtt(int server, timing_wheel::clock::duration rtt) {
+        metrics_.upstream(server).latency.record(std::chrono::duration_cast<std::chrono::microseconds>(rtt).count());
+    }
+
+    static std::vector<udp::endpoint> upstream_endpoints(const upstream_set &upstreams) {
+        std::vector<udp::endpoint> servers;
+        for (const auto &u : upstreams.upstreams()) {
+            servers.push_back(u.endpoint);
+        }
+        return servers;
+    }
+
+    static std::vector<tcp::endpoint> tcp_servers(const upstream_set &upstreams) {
+        std::vector<tcp::endpoint> servers;
+        for (const auto &u : upstreams.upstreams()) {
+            servers.emplace_back(u.endpoint.address(), u.endpoint.port());
+        }
+        return servers;
+    }
+
+private:
+    static constexpr size_t s_buff_size = 4096;
+
+    std::unique_ptr<dns_transport> transport_;
+    upstream_set upstreams_;
+    resolver_metrics metrics_;
+
+    std::vector<int> id_to_slot_;
+    std::vector<query_slot> slots_;
+    std::vector<int> free_slots_;
+    std::vector<unsigned short> free_ids_;
+    size_t id_head_ = 0;
+    size_t id_tail_ = 0;
+    std::deque<pending_query> pending_;
+    std::unordered_map<std::string_view, int> queries_by_key_;// busy slots by make_key
+    std::string key_;
+    dns_query_encoder encoder_;
+    dns_cache *cache_ = nullptr;
+    hosts_file *hosts_ = nullptr;
+    resolv_conf search_;
+
+    retry_policy policy_;
+    double hedge_percentile_ = 0.95;
+    std::unique_ptr<timing_wheel> wheel_;
+    asio::steady_timer tick_timer_;
+    bool ticking_ = false;
+
+    tcp_pool tcp_;
+    size_t tcp_fallbacks_ = 0;
+};
+
+#endif//DNS_CLIENT_DNS_RESOLVER_H
@@ -0,0 +1,206 @@
+#include "dns_snapshot.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    const char s_magic[8] = {'D', 'N', 'S', 'S', 'N', 'A', 'P', 0};
+    const uint32_t s_byte_order = 0x01020304;
+
+    struct snapshot_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        int64_t created;
+        uint32_t entry_cnt;
+        uint32_t bucket_cnt;
+        uint64_t file_size;
+    };
+
+    struct snapshot_bucket {
+        uint32_t hash;
+        uint32_t offset;
+    };
+
+    struct snapshot_entry {
+        int64_t expires;
+        int64_t inserted;
+        uint16_t key_len;
+        uint16_t packet_len;
+        uint32_t reserved;
+    };
+
+    // FNV-1a, stable across processes and builds unlike std::hash
+    uint32_t hash_key(std::string_view key) {
+        uint32_t hash = 2166136261u;
+        for (char ch : key) {
+            hash = (hash ^ (unsigned char) ch) * 16777619u;
+        }
+        return hash;
+    }
+
+    size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+}
+
+dns_snapshot::~dns_snapshot() { close(); }
+
+bool dns_snapshot::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(snapshot_header)) {
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    snapshot_header header{};
+    memcpy(&header, map, sizeof(header));
+    size_t index_end = sizeof(snapshot_header) + (size_t) header.bucket_cnt * sizeof(snapshot_bucket);
+    if (memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || header.version != s_version || header.byte_order != s_byte_order ||
+        header.file_size != (uint64_t) st.st_size || !std::has_single_bit(header.bucket_cnt) || index_end > (size_t) st.st_size) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    data_ = static_cast<const char *>(map);
+    size_ = st.st_size;
+    return true;
+}
+
+void dns_snapshot::close() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char *>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+size_t dns_snapshot::size() const {
+    if (data_ == nullptr) {
+        return 0;
+    }
+    snapshot_header header{};
+    memcpy(&header, data_, sizeof(header));
+    return header.entry_cnt;
+}
+
+// bounds checked, a damaged file yields misses instead of reads past the mapping
+bool dns_snapshot::read_entry(uint32_t offset, entry &out) const {
+    if (offset < sizeof(snapshot_header) || (size_t) offset + sizeof(snapshot_entry) > size_) {
+        return false;
+    }
+    snapshot_entry e{};
+    memcpy(&e, data_ + offset, sizeof(e));
+    if ((size_t) offset + sizeof(snapshot_entry) + e.key_len + e.packet_len > size_) {
+        return false;
+    }
+    const char *key = data_ + offset + sizeof(snapshot_entry);
+    out = entry{std::string_view(key, e.key_len), std::string_view(key + e.key_len, e.packet_len), e.inserted, e.expires};
+    return true;
+}
+
+bool dns_snapshot::find(std::string_view key, int64_t now, entry &out) const {
+    if (data_ == nullptr) {
+        return false;
+    }
+    snapshot_header header{};
+    memcpy(&header, data_, sizeof(header));
+    uint32_t mask = header.bucket_cnt - 1;
+    uint32_t hash = hash_key(key);
+    const char *index = data_ + sizeof(snapshot_header);
+    for (uint32_t i = hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+        snapshot_bucket bucket{};
+        memcpy(&bucket, index + (size_t) i * sizeof(bucket), sizeof(bucket));
+        if (bucket.offset == 0) {
+            return false;
+        }
+        if (bucket.hash == hash && read_entry(bucket.offset, out) && out.key == key) {
+            return out.expires > now;
+        }
+    }
+    return false;
+}
+
+std::vector<dns_snapshot::entry> dns_snapshot::entries(int64_t now) const {
+    std::vector<entry> result;
+    if (data_ == nullptr) {
+        return result;
+    }
+    snapshot_header header{};
+    memcpy(&header, data_, sizeof(header));
+    const char *index = data_ + sizeof(snapshot_header);
+    for (uint32_t i = 0; i < header.bucket_cnt; i++) {
+        snapshot_bucket bucket{};
+        memcpy(&bucket, index + (size_t) i * sizeof(bucket), sizeof(bucket));
+        entry e{};
+        if (bucket.offset != 0 && read_entry(bucket.offset, e) && e.expires > now) {
+            result.push_back(e);
+        }
+    }
+    return result;
+}
+
+bool dns_snapshot::write(const std::string &path, const std::vector<entry> &entries, int64_t now) {
+    // load factor at most 1/2, probes stay short
+    uint32_t bucket_cnt = std::bit_ceil<uint32_t>(std::max<uint32_t>((uint32_t) entries.size() * 2, 16));
+    size_t offset = sizeof(snapshot_header) + (size_t) bucket_cnt * sizeof(snapshot_bucket);
+    std::vector<snapshot_bucket> buckets(bucket_cnt, snapshot_bucket{0, 0});
+    std::string body;
+    uint32_t written = 0;
+    for (const entry &e : entries) {
+        if (e.expires <= now || e.key.size() > UINT16_MAX || e.packet.size() > UINT16_MAX) {
+            continue;
+        }
+        if (offset + body.size() > UINT32_MAX) {
+            break;
+        }
+        uint32_t hash = hash_key(e.key);
+        uint32_t i = hash & (bucket_cnt - 1);
+        while (buckets[i].offset != 0) {
+            i = (i + 1) & (bucket_cnt - 1);
+        }
+        buckets[i] = snapshot_bucket{hash, (uint32_t) (offset + body.size())};
+        snapshot_entry header{e.expires, e.inserted, (uint16_t) e.key.size(), (uint16_t) e.packet.size(), 0};
+        body.append(reinterpret_cast<const char *>(&header), sizeof(header));
+        body.append(e.key);
+        body.append(e.packet);
+        body.resize(align8(body.size()));
+        written++;
+    }
+
+    snapshot_header header{};
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = s_version;
+    header.byte_order = s_byte_order;
+    header.created = now;
+    header.entry_cnt = written;
+    header.bucket_cnt = bucket_cnt;
+    header.file_size = offset + body.size();
+
+    std::string tmp = path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(buckets.data(), sizeof(snapshot_bucket), buckets.size(), file) == buckets.size() &&
+              fwrite(body.data(), 1, body.size(), file) == body.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
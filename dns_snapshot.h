@@ -0,0 +1,56 @@
+#ifndef DNS_CLIENT_DNS_SNAPSHOT_H
+#define DNS_CLIENT_DNS_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only, memory-mapped snapshot of cached responses for a warm start.
+// File layout, host byte order (the header records it, a foreign file is refused):
+//   header       magic "DNSSNAP\0", version, byte order mark, creation time, counts, file size
+//   index        bucket_cnt x {hash, offset}, open addressing, offset 0 marks a free bucket
+//   entries      {expires, inserted, key_len, packet_len} + cache key + response packet, 8 byte aligned
+// Times are unix seconds, so entries keep their absolute expiry across restarts.
+// open() only checks the header: entries are found through the index and copied out on a
+// hit, nothing is parsed or moved to the heap up front. Lookups are safe from any thread.
+class dns_snapshot {
+public:
+    static constexpr uint32_t s_version = 1;
+
+    struct entry {
+        std::string_view key;
+        std::string_view packet;
+        int64_t inserted;
+        int64_t expires;
+    };
+
+    dns_snapshot() = default;
+    ~dns_snapshot();
+
+    dns_snapshot(const dns_snapshot &) = delete;
+    dns_snapshot &operator=(const dns_snapshot &) = delete;
+
+    // false if the file is missing, truncated or of another version
+    bool open(const std::string &path);
+    void close();
+    bool is_open() const { return data_ != nullptr; }
+
+    // the entry for a cache key, false if absent or expired at `now`
+    bool find(std::string_view key, int64_t now, entry &out) const;
+    // every entry still valid at `now`
+    std::vector<entry> entries(int64_t now) const;
+    size_t size() const;
+
+    // writes the entries to path.tmp and renames it over path
+    static bool write(const std::string &path, const std::vector<entry> &entries, int64_t now);
+
+private:
+    bool read_entry(uint32_t offset, entry &out) const;
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif//DNS_CLIENT_DNS_SNAPSHOT_H
@@ -0,0 +1,155 @@
+#ifndef DNS_CLIENT_DNS_TRANSPORT_H
+#define DNS_CLIENT_DNS_TRANSPORT_H
+
+#include <utility>
+#include "asio.hpp"
+#include <fmt/format.h>
+
+#include <deque>
+#include <functional>
+#include <string>
+
+using asio::ip::udp;
+
+// datagram transport under dns_resolver, driven by the socket's io_context
+class dns_transport {
+public:
+    // called once per datagram, data is only valid during the call
+    using receive_handler = std::function<void(const udp::endpoint &from, const char *data, size_t len)>;
+    // failed socket call; without a handler the error is printed to stderr
+    using error_handler = std::function<void(bool sending, const asio::error_code &err)>;
+
+    virtual ~dns_transport() = default;
+
+    void set_receive_handler(receive_handler handler) { handler_ = std::move(handler); }
+    void set_error_handler(error_handler handler) { error_handler_ = std::move(handler); }
+
+    // data may be reused as soon as send returns. false if the datagram was dropped.
+    virtual bool send(const char *data, size_t len, const udp::endpoint &to) = 0;
+    // deliver datagrams until stop_receive; stop_receive drops the pending receive
+    // so the io_context can run out of work
+    virtual void start_receive() = 0;
+    virtual void stop_receive() = 0;
+
+    virtual udp::socket &socket() = 0;
+
+protected:
+    void report_error(bool sending, const asio::error_code &err) {
+        if (error_handler_) {
+            error_handler_(sending, err);
+        } else {
+            fmt::print(stderr, "{} error: {}\n", sending ? "send" : "receive", err.message());
+        }
+    }
+
+    receive_handler handler_;
+    error_handler error_handler_;
+};
+
+// one syscall per datagram through the asio reactor
+class asio_udp_transport : public dns_transport {
+public:
+    explicit asio_udp_transport(udp::socket sock) : sock_(std::move(sock)) { sock_.non_blocking(true); }
+
+    bool send(const char *data, size_t len, const udp::endpoint &to) override {
+        if (!queued_.empty()) {
+            queued_.push_back({std::string(data, len), to});
+            return true;
+        }
+        asio::error_code err;
+        sock_.send_to(asio::buffer(data, len), to, 0, err);
+        if (err == asio::error::would_block || err == asio::error::try_again) {
+            queued_.push_back({std::string(data, len), to});
+            wait_write();
+            return true;
+        }
+        if (err) {
+            report_error(true, err);
+            return false;
+        }
+        return true;
+    }
+
+    void start_receive() override {
+        receiving_ = true;
+        if (!reading_ && !delivering_) {
+            do_read();
+        }
+    }
+
+    void stop_receive() override {
+        receiving_ = false;
+        if (reading_) {
+            sock_.cancel();
+        }
+    }
+
+    udp::socket &socket() override { return sock_; }
+
+private:
+    struct queued_datagram {
+        std::string data;
+        udp::endpoint to;
+    };
+
+    void wait_write() {
+        sock_.async_wait(udp::socket::wait_write, [this](const asio::error_code &err) {
+            // stop_receive's cancel() takes this wait down too, the queue still has to go out
+            if (err == asio::error::operation_aborted) {
+                wait_write();
+                return;
+            }
+            if (err) {
+                queued_.clear();
+                return;
+            }
+            while (!queued_.empty()) {
+                asio::error_code send_err;
+                sock_.send_to(asio::buffer(queued_.front().data), queued_.front().to, 0, send_err);
+                if (send_err == asio::error::would_block || send_err == asio::error::try_again) {
+                    wait_write();
+                    return;
+                }
+                queued_.pop_front();
+            }
+        });
+    }
+
+    // delivering_ stays set while the handler runs, so nothing re-arms a receive into
+    // read_buf_ before it is done with the packet
+    void do_read() {
+        reading_ = true;
+        sock_.async_receive_from(asio::buffer(read_buf_), sender_, [this](const asio::error_code &err, size_t bytes) {
+            reading_ = false;
+            // a start_receive between stop_receive's cancel and this handler found reading_ still set
+            if (err == asio::error::operation_aborted) {
+                if (receiving_) {
+                    do_read();
+                }
+                return;
+            }
+            delivering_ = true;
+            if (!err) {
+                handler_(sender_, read_buf_, bytes);
+            } else {
+                report_error(false, err);
+            }
+            delivering_ = false;
+            if (receiving_) {
+                do_read();
+            }
+        });
+    }
+
+    static constexpr size_t s_buff_size = 4096;
+
+    udp::socket sock_;
+    udp::endpoint sender_;
+    bool receiving_ = false;
+    bool reading_ = false;
+    bool delivering_ = false;
+    char read_buf_[s_buff_size];
+    std::deque<queued_datagram> queued_;
+};
+
+#endif//DNS_CLIENT_DNS_TRANSPORT_H
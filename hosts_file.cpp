@@ -0,0 +1,174 @@
+#include "hosts_file.h"
+#include "dns.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    int64_t mtime_ns(const struct stat &st) { return (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec; }
+
+    bool is_space(char ch) { return ch == ' ' || ch == '\t' || ch == '\r'; }
+}
+
+void hosts_file::parse(std::string_view text, table_type &table) {
+    while (!text.empty()) {
+        size_t eol = std::min(text.find('\n'), text.size());
+        std::string_view line = text.substr(0, eol);
+        text.remove_prefix(std::min(eol + 1, text.size()));
+        line = line.substr(0, line.find('#'));
+
+        std::vector<std::string_view> fields;
+        size_t pos = 0;
+        while (pos < line.size()) {
+            while (pos < line.size() && is_space(line[pos])) {
+                pos++;
+            }
+            size_t begin = pos;
+            while (pos < line.size() && !is_space(line[pos])) {
+                pos++;
+            }
+            if (pos > begin) {
+                fields.push_back(line.substr(begin, pos - begin));
+            }
+        }
+        if (fields.size() < 2 || fields[0].size() >= INET6_ADDRSTRLEN) {
+            continue;
+        }
+        char address[INET6_ADDRSTRLEN];
+        memcpy(address, fields[0].data(), fields[0].size());
+        address[fields[0].size()] = 0;
+        std::array<unsigned char, 4> v4{};
+        std::array<unsigned char, 16> v6{};
+        bool is_v4 = inet_pton(AF_INET, address, v4.data()) == 1;
+        if (!is_v4 && inet_pton(AF_INET6, address, v6.data()) != 1) {
+            continue;
+        }
+        for (size_t i = 1; i < fields.size(); i++) {
+            std::string name(fields[i]);
+            if (!name.empty() && name.back() == '.') {
+                name.pop_back();
+            }
+            if (name.empty() || name.size() > 253) {
+                continue;
+            }
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char ch) { return (char) std::tolower(ch); });
+            host_entry &entry = table[std::move(name)];
+            if (is_v4 && std::find(entry.v4.begin(), entry.v4.end(), v4) == entry.v4.end()) {
+                entry.v4.push_back(v4);
+            } else if (!is_v4 && std::find(entry.v6.begin(), entry.v6.end(), v6) == entry.v6.end()) {
+                entry.v6.push_back(v6);
+            }
+        }
+    }
+}
+
+bool hosts_file::load() {
+    table_type table;
+    struct stat st {};
+    int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    bool ok = fd >= 0 && fstat(fd, &st) == 0;
+    if (ok && st.st_size > 0) {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            ok = false;
+        } else {
+            parse(std::string_view(static_cast<const char *>(map), st.st_size), table);
+            munmap(map, st.st_size);
+        }
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+
+    std::unique_lock lock(mutex_);
+    table_.swap(table);
+    mtime_ns_ = ok ? mtime_ns(st) : -1;
+    file_size_ = ok ? (int64_t) st.st_size : -1;
+    inode_ = ok ? st.st_ino : 0;
+    return ok;
+}
+
+void hosts_file::reload_if_changed() {
+    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    int64_t next = next_check_.load(std::memory_order_relaxed);
+    // one thread per interval does the stat, the others keep answering from the old table
+    if (now < next || !next_check_.compare_exchange_strong(next, now + std::chrono::steady_clock::duration(s_check_interval).count(),
+                                                           std::memory_order_relaxed)) {
+        return;
+    }
+    struct stat st {};
+    bool exists = stat(path_.c_str(), &st) == 0;
+    {
+        std::shared_lock lock(mutex_);
+        if (exists ? (mtime_ns(st) == mtime_ns_ && (int64_t) st.st_size == file_size_ && st.st_ino == inode_) : mtime_ns_ < 0) {
+            return;
+        }
+    }
+    load();
+}
+
+int hosts_file::answer(std::string_view host, unsigned short query_type, unsigned short query_id, char *buf, int buf_len) {
+    if (query_type != DNS::DNS_TYPE_A && query_type != DNS::DNS_TYPE_AAAA) {
+        return -1;
+    }
+    if (!host.empty() && host.back() == '.') {
+        host.remove_suffix(1);
+    }
+    char name[256];
+    if (host.empty() || host.size() >= sizeof(name)) {
+        return -1;
+    }
+    reload_if_changed();
+    for (size_t i = 0; i < host.size(); i++) {
+        name[i] = (char) std::tolower((unsigned char) host[i]);
+    }
+    name[host.size()] = 0;
+
+    std::shared_lock lock(mutex_);
+    auto it = table_.find(std::string_view(name, host.size()));
+    if (it == table_.end()) {
+        return -1;
+    }
+    const host_entry &entry = it->second;
+    size_t count = query_type == DNS::DNS_TYPE_A ? entry.v4.size() : entry.v6.size();
+    if (count == 0) {
+        return -1;
+    }
+    // header and question come from the query encoder, the name as it was asked
+    memcpy(name, host.data(), host.size());
+    int pos = DNS::BuildDnsQueryPacket(name, buf, 0, buf_len, query_id, query_type);
+    if (pos <= 0) {
+        return -1;
+    }
+    unsigned short flags = DNS::DNS_FLAG_QR | DNS::DNS_FLAG_AA | DNS::DNS_FLAG_RD | DNS::DNS_FLAG_RA;
+    buf[2] = (char) (flags >> 8);
+    buf[3] = (char) flags;
+    buf[6] = (char) (count >> 8);
+    buf[7] = (char) count;
+    size_t rdlen = query_type == DNS::DNS_TYPE_A ? 4 : 16;
+    // compressed owner name pointing at the question | type | class | ttl 0 | rdlen | rdata
+    for (size_t i = 0; i < count; i++) {
+        if (pos + 12 + (int) rdlen > buf_len) {
+            return -1;
+        }
+        const unsigned char record[12] = {0xc0, DNS::DNS_HEADER_SIZE, 0, (unsigned char) query_type, 0, DNS::DNS_CLASS_IN,
+                                          0, 0, 0, 0, 0, (unsigned char) rdlen};
+        memcpy(buf + pos, record, sizeof(record));
+        pos += sizeof(record);
+        memcpy(buf + pos, query_type == DNS::DNS_TYPE_A ? entry.v4[i].data() : entry.v6[i].data(), rdlen);
+        pos += (int) rdlen;
+    }
+    return pos;
+}
+
+size_t hosts_file::size() const {
+    std::shared_lock lock(mutex_);
+    return table_.size();
+}
@@ -0,0 +1,64 @@
+#ifndef DNS_CLIENT_HOSTS_FILE_H
+#define DNS_CLIENT_HOSTS_FILE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// /etc/hosts as a local answer source. The file is mapped, parsed once into a hash table
+// keyed by the lower cased name (canonical names and aliases alike) and parsed again when
+// its mtime, size or inode change; the check is a stat at most once per s_check_interval.
+// Hits are answered with a synthesized response packet, so callers handle them exactly
+// like a reply from the network. Lookups are safe from any thread.
+class hosts_file {
+public:
+    static constexpr std::chrono::seconds s_check_interval{1};
+
+    explicit hosts_file(std::string path = "/etc/hosts") : path_(std::move(path)) {}
+
+    hosts_file(const hosts_file &) = delete;
+    hosts_file &operator=(const hosts_file &) = delete;
+
+    // false if the file can not be read, the table is then empty
+    bool load();
+
+    // response packet for an A or AAAA question with ttl 0 records, or -1 if the name
+    // has no address of that type in the file
+    int answer(std::string_view host, unsigned short query_type, unsigned short query_id, char *buf, int buf_len);
+
+    size_t size() const;
+    const std::string &path() const { return path_; }
+
+private:
+    struct host_entry {
+        std::vector<std::array<unsigned char, 4>> v4;
+        std::vector<std::array<unsigned char, 16>> v6;
+    };
+
+    struct name_hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+
+    using table_type = std::unordered_map<std::string, host_entry, name_hash, std::equal_to<>>;
+
+    static void parse(std::string_view text, table_type &table);
+    void reload_if_changed();
+
+    std::string path_;
+    mutable std::shared_mutex mutex_;
+    table_type table_;
+    // identity of the parsed file
+    int64_t mtime_ns_ = -1;
+    int64_t file_size_ = -1;
+    uint64_t inode_ = 0;
+    std::atomic<int64_t> next_check_{0};
+};
+
+#endif//DNS_CLIENT_HOSTS_FILE_H
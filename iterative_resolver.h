@@ -0,0 +1,541 @@
+#ifndef DNS_CLIENT_ITERATIVE_RESOLVER_H
+#define DNS_CLIENT_ITERATIVE_RESOLVER_H
+
+#include "dns_resolver.h"
+#include "timing_wheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Iterative resolution without a recursive upstream: every lookup starts at the closest
+// zone with known nameservers (the root hints at first) and follows referrals down, using
+// the NS records of the authority section and the glue of the additional section.
+// Delegations are cached for the NS ttl, so later lookups under the same zone go straight
+// to its nameservers; nameserver addresses without glue are looked up iteratively as well.
+// Each nameserver address keeps a smoothed rtt, the fastest one of a zone is asked first and
+// a timeout doubles its rtt, so slow or dead servers sink to the back.
+// Glue is only taken for nameservers inside the zone of the server that sent it, and a
+// referral has to move closer to the name asked for. udp only: a truncated answer is used
+// as far as it goes. Sends are kept in a table indexed by transaction id and their timeouts
+// in one timing wheel driven by a single steady_timer, as in dns_resolver.
+// Like dns_resolver, call it from the thread running its io_context.
+class iterative_resolver {
+public:
+    using clock = std::chrono::steady_clock;
+    using handler_type = dns_resolver::handler_type;
+
+    static constexpr int s_max_sends = 48;// per lookup, nested nameserver lookups included
+    static constexpr int s_max_cnames = 8;
+    static constexpr int s_max_depth = 3;// nested lookups for glueless nameservers
+    static constexpr size_t s_max_stage_servers = 4;
+
+    iterative_resolver(std::unique_ptr<dns_transport> transport, const std::vector<asio::ip::address> &roots,
+                       unsigned short port = DNS::DNS_UDP_PORT)
+        : transport_(std::move(transport)),
+          port_(port),
+          encoder_(0, DNS::DNS_EDNS_PAYLOAD_SIZE),
+          rng_(std::random_device{}()),
+          pending_(65536),
+          wheel_(65536, std::chrono::milliseconds(1)),
+          tick_timer_(transport_->socket().get_executor()) {
+        delegation &root = zones_[""];
+        root.expires = clock::time_point::max();
+        for (const auto &address : roots) {
+            root.servers.push_back({"", {address}});
+        }
+        transport_->set_receive_handler([this](const udp::endpoint &from, const char *data, size_t len) { on_packet(from, data, len); });
+    }
+
+    iterative_resolver(const iterative_resolver &) = delete;
+    iterative_resolver &operator=(const iterative_resolver &) = delete;
+
+    void async_resolve(std::string host, unsigned short query_type, handler_type handler) {
+        if (!host.empty() && host.back() == '.') {
+            host.pop_back();
+        }
+        auto state = std::make_shared<lookup>();
+        state->qname = lower(host);
+        state->host = std::move(host);
+        state->query_type = query_type;
+        state->handler = std::move(handler);
+        state->sends = std::make_shared<int>(0);
+        start_receive();
+        start_stage(state);
+    }
+
+    // timeout doubles per round over a zone's servers; attempts bounds the sends to one zone
+    void set_retry_policy(const retry_policy &policy) { policy_ = policy; }
+    void set_edns_payload(unsigned short payload) { encoder_.set_edns_payload(std::min(payload, DNS::DNS_MAX_EDNS_PAYLOAD_SIZE)); }
+    // every query and referral on stderr
+    void set_trace(bool trace) { trace_ = trace; }
+
+    using executor_type = udp::socket::executor_type;
+    executor_type get_executor() { return transport_->socket().get_executor(); }
+
+    size_t zones() const { return zones_.size(); }
+    size_t queries_sent() const { return queries_sent_; }
+    size_t referrals() const { return referrals_; }
+
+    // named.root style lines ("A.ROOT-SERVERS.NET. 3600000 A 198.41.0.4") or bare addresses
+    static bool load_root_hints(const std::string &path, std::vector<asio::ip::address> &roots) {
+        std::ifstream file(path);
+        if (!file) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            line = line.substr(0, std::min(line.find(';'), line.find('#')));
+            size_t end = line.find_last_not_of(" \t\r");
+            if (end == std::string::npos) {
+                continue;
+            }
+            size_t begin = line.find_last_of(" \t", end);
+            asio::error_code err;
+            auto address = asio::ip::make_address(line.substr(begin == std::string::npos ? 0 : begin + 1, end - begin), err);
+            if (!err) {
+                roots.push_back(address);
+            }
+        }
+        return !roots.empty();
+    }
+
+    // IANA root servers a to m
+    static std::vector<asio::ip::address> default_root_hints(bool v6) {
+        static const char *const v4_roots[] = {"198.41.0.4", "170.247.170.2", "192.33.4.12", "199.7.91.13", "192.203.230.10",
+                                               "192.5.5.241", "192.112.36.4", "198.97.190.53", "192.36.148.17", "192.58.128.30",
+                                               "193.0.14.129", "199.7.83.42", "202.12.27.33"};
+        static const char *const v6_roots[] = {"2001:503:ba3e::2:30", "2801:1b8:10::b", "2001:500:2::c", "2001:500:2d::d",
+                                               "2001:500:a8::e", "2001:500:2f::f", "2001:500:12::d0d", "2001:500:1::53",
+                                               "2001:7fe::53", "2001:503:c27::2:30", "2001:7fd::1", "2001:500:9f::42", "2001:dc3::35"};
+        std::vector<asio::ip::address> roots;
+        for (const char *root : v6 ? v6_roots : v4_roots) {
+            roots.push_back(asio::ip::make_address(root));
+        }
+        return roots;
+    }
+
+private:
+    struct nameserver {
+        std::string name;// lower case, empty for root hints
+        std::vector<asio::ip::address> addresses;
+    };
+
+    struct delegation {
+        std::vector<nameserver> servers;
+        clock::time_point expires;
+    };
+
+    struct server_stats {
+        double srtt_us = 0;// unknown servers sort first, so each gets tried once
+    };
+
+    struct lookup {
+        std::string host;// as asked
+        std::string qname;// lower case, moves along CNAMEs
+        unsigned short query_type = 0;
+        handler_type handler;
+        std::shared_ptr<int> sends;// shared with the nested nameserver lookups
+        int cnames = 0;
+        int depth = 0;
+        // the stage: servers of the closest known zone
+        std::string zone;
+        std::vector<asio::ip::address> candidates;// best first
+        std::vector<std::string> glueless;// nameservers still without an address
+        unsigned int attempt = 0;
+        bool finished = false;
+    };
+
+    // by transaction id, free while state is null; the timeout is timer id == transaction id
+    struct pending_send {
+        std::shared_ptr<lookup> state;
+        udp::endpoint server;
+        clock::time_point sent_at;
+    };
+
+    static std::string lower(std::string_view name) {
+        std::string out(name);
+        std::transform(out.begin(), out.end(), out.begin(), [](unsigned char ch) { return (char) std::tolower(ch); });
+        return out;
+    }
+
+    static bool in_zone(std::string_view name, std::string_view zone) {
+        return zone.empty() || name == zone ||
+               (name.size() > zone.size() && name.substr(name.size() - zone.size()) == zone && name[name.size() - zone.size() - 1] == '.');
+    }
+
+    static std::string name_string(const DNS::DnsNameView &name) {
+        char buf[256];
+        int len = name.to_string(buf, sizeof(buf));
+        if (len <= 0 || (len == 1 && buf[0] == '.')) {
+            return {};
+        }
+        return lower(std::string_view(buf, len));
+    }
+
+    bool usable(const asio::ip::address &address) const { return address.is_v4() == (transport_->socket().local_endpoint().protocol() == udp::v4()); }
+
+    void start_receive() {
+        if (!receiving_) {
+            receiving_ = true;
+            transport_->start_receive();
+        }
+    }
+
+    // callers check trace_ first, so nothing is formatted while tracing is off
+    void trace(const std::shared_ptr<lookup> &state, std::string_view what) const {
+        fmt::print(stderr, "{:>{}}{} {}: {}\n", "", state->depth * 2, state->qname.empty() ? "." : state->qname, state->query_type, what);
+    }
+
+    // servers of the closest zone with a live delegation
+    void start_stage(const std::shared_ptr<lookup> &state) {
+        std::string_view name = state->qname;
+        clock::time_point now = clock::now();
+        for (;;) {
+            auto it = zones_.find(std::string(name));
+            if (it != zones_.end() && it->second.expires > now) {
+                state->zone = it->first;
+                break;
+            }
+            if (it != zones_.end()) {
+                zones_.erase(it);
+            }
+            size_t dot = name.find('.');
+            name = dot == std::string_view::npos ? std::string_view() : name.substr(dot + 1);
+        }
+        state->candidates.clear();
+        state->glueless.clear();
+        state->attempt = 0;
+        for (const nameserver &ns : zones_[state->zone].servers) {
+            bool any = false;
+            for (const auto &address : ns.addresses) {
+                if (usable(address)) {
+                    state->candidates.push_back(address);
+                    any = true;
+                }
+            }
+            if (!any && !ns.name.empty()) {
+                state->glueless.push_back(ns.name);
+            }
+        }
+        std::stable_sort(state->candidates.begin(), state->candidates.end(),
+                         [this](const asio::ip::address &a, const asio::ip::address &b) { return servers_[a].srtt_us < servers_[b].srtt_us; });
+        if (trace_) {
+            trace(state, fmt::format("zone {} with {} addresses, {} nameservers without", state->zone.empty() ? "." : state->zone,
+                                     state->candidates.size(), state->glueless.size()));
+        }
+        send_next(state);
+    }
+
+    void send_next(const std::shared_ptr<lookup> &state) {
+        if (*state->sends >= s_max_sends) {
+            finish(state, resolve_status::error, nullptr, 0);
+            return;
+        }
+        if (state->candidates.empty()) {
+            resolve_glueless(state);
+            return;
+        }
+        // every server once, then more rounds up to the policy's attempts
+        size_t servers = state->candidates.size();
+        if (state->attempt >= std::max<size_t>(policy_.attempts, std::min(servers, s_max_stage_servers))) {
+            finish(state, resolve_status::timeout, nullptr, 0);
+            return;
+        }
+        asio::ip::address address = state->candidates[state->attempt % servers];
+        unsigned int round = (unsigned int) (state->attempt++ / servers) + 1;
+        unsigned short id = 0;
+        do {
+            id = (unsigned short) rng_();
+        } while (pending_[id].state);
+        char packet[DNS::DNS_MAX_QUERY_SIZE];
+        int len = encoder_.encode(state->qname, state->query_type, id, packet, sizeof(packet));
+        if (len < 0) {
+            finish(state, resolve_status::error, nullptr, 0);
+            return;
+        }
+        // iterative: the servers are asked not to recurse
+        packet[2] &= (char) ~(DNS::DNS_FLAG_RD >> 8);
+
+        pending_send &p = pending_[id];
+        p.state = state;
+        p.server = udp::endpoint(address, port_);
+        p.sent_at = clock::now();
+        in_flight_++;
+        wheel_.arm(id, p.sent_at + policy_.timeout_for(round));
+        if (!ticking_) {
+            ticking_ = true;
+            arm_tick();
+        }
+        (*state->sends)++;
+        queries_sent_++;
+        if (trace_) {
+            trace(state, fmt::format("ask {}", address.to_string()));
+        }
+        transport_->send(packet, len, p.server);
+    }
+
+    void arm_tick() {
+        tick_timer_.expires_after(wheel_.tick());
+        tick_timer_.async_wait([this](const asio::error_code &err) {
+            if (err) {
+                return;
+            }
+            wheel_.advance(clock::now(), [this](int id) { on_timeout((unsigned short) id); });
+            if (wheel_.empty()) {
+                ticking_ = false;
+            } else {
+                arm_tick();
+            }
+        });
+    }
+
+    // the send leaves the table, its lookup is returned
+    std::shared_ptr<lookup> release(unsigned short id) {
+        wheel_.cancel(id);
+        in_flight_--;
+        return std::move(pending_[id].state);
+    }
+
+    void on_timeout(unsigned short id) {
+        pending_send &p = pending_[id];
+        if (!p.state) {
+            return;
+        }
+        server_stats &stats = servers_[p.server.address()];
+        stats.srtt_us = std::min(std::max(stats.srtt_us * 2, (double) std::chrono::duration_cast<std::chrono::microseconds>(policy_.timeout).count()),
+                                 s_max_srtt_us);
+        if (trace_) {
+            trace(p.state, fmt::format("timeout from {}", p.server.address().to_string()));
+        }
+        send_next(release(id));
+    }
+
+    // asks for the address of one glueless nameserver, then carries on with it
+    void resolve_glueless(const std::shared_ptr<lookup> &state) {
+        if (state->glueless.empty() || state->depth >= s_max_depth) {
+            finish(state, resolve_status::error, nullptr, 0);
+            return;
+        }
+        std::string ns = std::move(state->glueless.front());
+        state->glueless.erase(state->glueless.begin());
+        auto nested = std::make_shared<lookup>();
+        nested->host = ns;
+        nested->qname = ns;
+        nested->query_type = transport_->socket().local_endpoint().protocol() == udp::v4() ? DNS::DNS_TYPE_A : DNS::DNS_TYPE_AAAA;
+        nested->sends = state->sends;
+        nested->depth = state->depth + 1;
+        nested->handler = [this, state, ns](const dns_result &result) {
+            std::vector<asio::ip::address> addresses;
+            DNS::DnsMessageView msg(result.packet, result.len);
+            for (const DNS::DnsRecordView &res : msg.answers()) {
+                std::array<unsigned char, 4> v4{};
+                std::array<unsigned char, 16> v6{};
+                if (res.a(v4)) {
+                    addresses.emplace_back(asio::ip::address_v4(v4));
+                } else if (res.aaaa(v6)) {
+                    addresses.emplace_back(asio::ip::address_v6(v6));
+                }
+            }
+            auto it = zones_.find(state->zone);
+            if (it != zones_.end()) {
+                for (nameserver &server : it->second.servers) {
+                    if (server.name == ns) {
+                        server.addresses.insert(server.addresses.end(), addresses.begin(), addresses.end());
+                    }
+                }
+            }
+            for (const auto &address : addresses) {
+                if (usable(address)) {
+                    state->candidates.push_back(address);
+                }
+            }
+            send_next(state);
+        };
+        if (trace_) {
+            trace(state, fmt::format("look up nameserver {}", ns));
+        }
+        start_stage(nested);
+    }
+
+    void on_packet(const udp::endpoint &from, const char *data, size_t len) {
+        DNS::DnsMessageView msg(data, (int) len);
+        if (!msg.valid() || !msg.response() || msg.questions().size() != 1) {
+            return;
+        }
+        pending_send &p = pending_[msg.id()];
+        if (!p.state || p.server != from) {
+            return;
+        }
+        DNS::DnsQuestionView question = *msg.questions().begin();
+        if (question.query_type != p.state->query_type || !question.host.equals(p.state->qname)) {
+            return;
+        }
+        auto elapsed = std::chrono::duration<double, std::micro>(clock::now() - p.sent_at).count();
+        server_stats &stats = servers_[from.address()];
+        stats.srtt_us = stats.srtt_us == 0 ? elapsed : stats.srtt_us * 7 / 8 + elapsed / 8;
+        on_response(release(msg.id()), from.address(), msg, data, (int) len);
+    }
+
+    void on_response(const std::shared_ptr<lookup> &state, const asio::ip::address &server, const DNS::DnsMessageView &msg,
+                     const char *data, int len) {
+        unsigned short rcode = msg.rcode();
+        if (rcode == DNS::DNS_RCODE_NXDOMAIN) {
+            finish(state, resolve_status::ok, data, len);
+            return;
+        }
+        if (rcode != DNS::DNS_RCODE_NOERROR) {
+            if (trace_) {
+                trace(state, fmt::format("rcode {} from {}", rcode, server.to_string()));
+            }
+            drop_candidate(state, server);
+            return;
+        }
+        // the CNAME chain inside this answer, then data for its end
+        std::string owner = state->qname;
+        for (int hops = 0; hops < msg.answers().size(); hops++) {
+            bool moved = false;
+            for (const DNS::DnsRecordView &res : msg.answers()) {
+                DNS::DnsNameView target;
+                if (res.domain_type == DNS::DNS_TYPE_CNAME && state->query_type != DNS::DNS_TYPE_CNAME && res.host.equals(owner) &&
+                    res.target(target)) {
+                    owner = name_string(target);
+                    moved = true;
+                    break;
+                }
+            }
+            if (!moved) {
+                break;
+            }
+        }
+        for (const DNS::DnsRecordView &res : msg.answers()) {
+            if (res.domain_type == state->query_type && res.host.equals(owner)) {
+                finish(state, resolve_status::ok, data, len);
+                return;
+            }
+        }
+        if (owner != state->qname) {
+            if (++state->cnames > s_max_cnames) {
+                finish(state, resolve_status::error, nullptr, 0);
+                return;
+            }
+            if (trace_) {
+                trace(state, fmt::format("alias for {}", owner));
+            }
+            state->qname = owner;
+            start_stage(state);
+            return;
+        }
+        if (msg.header().flags & DNS::DNS_FLAG_AA) {
+            // NODATA
+            finish(state, resolve_status::ok, data, len);
+            return;
+        }
+        if (!follow_referral(state, msg)) {
+            if (trace_) {
+                trace(state, fmt::format("lame answer from {}", server.to_string()));
+            }
+            drop_candidate(state, server);
+        }
+    }
+
+    // caches the delegation of a referral and moves on to it; false if it is not one
+    bool follow_referral(const std::shared_ptr<lookup> &state, const DNS::DnsMessageView &msg) {
+        std::string zone;
+        delegation d;
+        unsigned int ttl = UINT32_MAX;
+        for (const DNS::DnsRecordView &res : msg.authorities()) {
+            DNS::DnsNameView target;
+            if (res.domain_type != DNS::DNS_TYPE_NS || !res.target(target)) {
+                continue;
+            }
+            std::string owner = name_string(res.host);
+            // downward only, and toward the name asked for
+            if (!in_zone(state->qname, owner) || owner.size() <= state->zone.size() || !in_zone(owner, state->zone) ||
+                (!zone.empty() && owner != zone)) {
+                continue;
+            }
+            zone = owner;
+            ttl = std::min(ttl, res.ttl);
+            d.servers.push_back({name_string(target), {}});
+        }
+        if (d.servers.empty()) {
+            return false;
+        }
+        for (const DNS::DnsRecordView &res : msg.additionals()) {
+            std::array<unsigned char, 4> v4{};
+            std::array<unsigned char, 16> v6{};
+            asio::ip::address address;
+            if (res.a(v4)) {
+                address = asio::ip::address_v4(v4);
+            } else if (res.aaaa(v6)) {
+                address = asio::ip::address_v6(v6);
+            } else {
+                continue;
+            }
+            std::string owner = name_string(res.host);
+            // glue only from the parent zone's own namespace
+            if (!in_zone(owner, state->zone)) {
+                continue;
+            }
+            for (nameserver &ns : d.servers) {
+                if (ns.name == owner) {
+                    ns.addresses.push_back(address);
+                }
+            }
+        }
+        d.expires = clock::now() + std::chrono::seconds(std::clamp<unsigned int>(ttl, 1, dns_cache::s_max_ttl));
+        referrals_++;
+        if (trace_) {
+            trace(state, fmt::format("referral to {} with {} nameservers", zone, d.servers.size()));
+        }
+        zones_[zone] = std::move(d);
+        start_stage(state);
+        return true;
+    }
+
+    void drop_candidate(const std::shared_ptr<lookup> &state, const asio::ip::address &server) {
+        std::erase(state->candidates, server);
+        send_next(state);
+    }
+
+    void finish(const std::shared_ptr<lookup> &state, resolve_status status, const char *packet, int len) {
+        if (state->finished) {
+            return;
+        }
+        state->finished = true;
+        handler_type handler = std::move(state->handler);
+        handler(dns_result{state->host, state->query_type, status, packet, len, (unsigned int) *state->sends});
+        if (in_flight_ == 0 && receiving_) {
+            receiving_ = false;
+            transport_->stop_receive();
+        }
+    }
+
+    static constexpr double s_max_srtt_us = 10e6;
+
+    std::unique_ptr<dns_transport> transport_;
+    unsigned short port_;
+    dns_query_encoder encoder_;
+    retry_policy policy_;
+    std::mt19937 rng_;
+    bool trace_ = false;
+    bool receiving_ = false;
+    std::unordered_map<std::string, delegation> zones_;// lower case zone without trailing dot, "" is the root
+    std::map<asio::ip::address, server_stats> servers_;
+    std::vector<pending_send> pending_;
+    size_t in_flight_ = 0;
+    timing_wheel wheel_;
+    asio::steady_timer tick_timer_;
+    bool ticking_ = false;
+    size_t queries_sent_ = 0;
+    size_t referrals_ = 0;
+};
+
+#endif//DNS_CLIENT_ITERATIVE_RESOLVER_H
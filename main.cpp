@@ -1,11 +1,434 @@
+#include "address_resolver.h"
 #include "async_udp_client.h"
+#include "bulk_resolver.h"
+#include "dns_forwarder.h"
+#include "iterative_resolver.h"
+#include "metrics_exporter.h"
+#include "output_sink.h"
+#include "periodic_task.h"
+#include "ptr_sweep.h"
+#include "resolver_engine.h"
 #include <cmdline.h>
 
+#include <fstream>
+#include <memory>
+#include <sstream>
 #include <sys/ioctl.h>
 #include <string>
 
 using namespace std;
 
+struct bulk_options {
+    std::vector<udp::endpoint> servers;
+    size_t window = 1000;
+    size_t cache_size = 0;
+    std::string snapshot_path;
+    std::chrono::seconds snapshot_interval{60};
+    std::string metrics_path;
+    std::chrono::seconds metrics_interval{10};
+    DNS::OutputFormat format = DNS::OUTPUT_TSV;
+    resolver_engine_options engine;
+};
+
+static void format_result(fmt::memory_buffer &out, DNS::OutputFormat format, const dns_result &result) {
+    // resolve_status and the DNS::RESULT_ codes share their order
+    unsigned char status = static_cast<unsigned char>(result.status);
+    if (DNS::FormatDnsResult(out, format, result.host, status, result.packet, result.len) < 0) {
+        DNS::FormatDnsResult(out, format, result.host, DNS::RESULT_ERROR, nullptr, 0);
+    }
+}
+
+// resolv.conf nameservers of the first one's address family, unparsable entries skipped
+static void resolv_conf_servers(const resolv_conf &conf, unsigned short port, std::vector<udp::endpoint> &servers) {
+    for (const string &nameserver : conf.nameservers) {
+        asio::error_code err;
+        auto address = asio::ip::make_address(nameserver, err);
+        if (err || (!servers.empty() && address.is_v4() != servers.front().address().is_v4())) {
+            continue;
+        }
+        if (servers.size() < upstream_set::s_max_upstreams) {
+            servers.emplace_back(address, port);
+        }
+    }
+}
+
+// a single result on stdout, the table or one record of a streaming format
+static void print_result(DNS::OutputFormat format, std::string_view host, unsigned char status, const char *packet, int len) {
+    if (format == DNS::OUTPUT_TABLE) {
+        if (status == DNS::RESULT_OK) {
+            DNS::ParseDnsResponsePacket(packet, len);
+        } else {
+            fmt::print(stderr, "query {} {}\n", host, status == DNS::RESULT_TIMEOUT ? "timed out" : "failed");
+        }
+        return;
+    }
+    fmt::memory_buffer out;
+    if (DNS::FormatDnsResult(out, format, host, status, packet, len) < 0) {
+        DNS::FormatDnsResult(out, format, host, DNS::RESULT_ERROR, nullptr, 0);
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+}
+
+// comma separated addresses, all sharing one port and one address family
+static bool parse_servers(const string &list, unsigned short port, std::vector<udp::endpoint> &servers) {
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = std::min(list.find(',', begin), list.size());
+        asio::error_code err;
+        auto address = asio::ip::make_address(list.substr(begin, end - begin), err);
+        if (err) {
+            fmt::print(stderr, "bad dns server address: {}\n", list.substr(begin, end - begin));
+            return false;
+        }
+        servers.emplace_back(address, port);
+        if (servers.back().protocol() != servers.front().protocol()) {
+            fmt::print(stderr, "dns servers must all be ipv4 or all ipv6\n");
+            return false;
+        }
+        begin = end + 1;
+    }
+    if (servers.size() > upstream_set::s_max_upstreams) {
+        fmt::print(stderr, "at most {} dns servers\n", upstream_set::s_max_upstreams);
+        return false;
+    }
+    return true;
+}
+
+static void print_upstreams(const upstream_set &upstreams) {
+    for (const auto &u : upstreams.upstreams()) {
+        fmt::print(stderr, "upstream {}: srtt {:.1f}ms, {} sent ({} hedged), {} replies, {} timeouts\n",
+                   u.endpoint.address().to_string(), u.srtt_us / 1000, u.sent, u.hedges, u.replies, u.timeouts);
+    }
+}
+
+static bool next_host(std::istream &in, string &host) {
+    while (std::getline(in, host)) {
+        size_t first = host.find_first_not_of(" \t\r");
+        if (first == string::npos || host[first] == '#') {
+            continue;
+        }
+        size_t last = host.find_last_not_of(" \t\r");
+        host = host.substr(first, last - first + 1);
+        return true;
+    }
+    return false;
+}
+
+// warm start from the snapshot, then rewrite it periodically; null without a snapshot path
+static std::unique_ptr<periodic_task> start_snapshots(dns_cache *cache, const bulk_options &options) {
+    if (cache == nullptr || options.snapshot_path.empty()) {
+        return nullptr;
+    }
+    // a missing snapshot is a cold start, not an error
+    if (cache->load_snapshot(options.snapshot_path)) {
+        fmt::print(stderr, "warm start: {} cached responses in {}\n", cache->snapshot_size(), options.snapshot_path);
+    }
+    auto snapshotter = std::make_unique<periodic_task>(options.snapshot_interval, [cache, path = options.snapshot_path] {
+        if (!cache->save_snapshot(path)) {
+            fmt::print(stderr, "can not write cache snapshot {}\n", path);
+        }
+    });
+    snapshotter->start();
+    return snapshotter;
+}
+
+static int run_bulk(const string &source, bulk_options options) {
+    std::ifstream file;
+    if (source != "-") {
+        file.open(source);
+        if (!file) {
+            fmt::print(stderr, "can not open host list {}\n", source);
+            return -1;
+        }
+    }
+    std::istream &in = source == "-" ? std::cin : file;
+
+    std::unique_ptr<dns_cache> cache;
+    if (options.cache_size > 0) {
+        cache = std::make_unique<dns_cache>(options.cache_size);
+    }
+    std::unique_ptr<periodic_task> snapshotter = start_snapshots(cache.get(), options);
+    output_sink sink;
+
+    if (options.engine.threads <= 1) {
+        // single thread: names are read on the io thread, no hand-off at all
+        asio::io_context ios(1);
+        udp::socket sock(ios, udp::endpoint(options.servers.front().protocol(), 0));
+        dns_resolver resolver(make_udp_transport(std::move(sock), options.engine.batch), options.servers, options.window);
+        resolver.set_cache(cache.get());
+        resolver.set_hosts(options.engine.hosts);
+        resolver.set_search(options.engine.search);
+        resolver.set_retry_policy(options.engine.retry);
+        resolver.set_hedge_percentile(options.engine.hedge_percentile);
+        resolver.set_edns_payload(options.engine.edns_payload);
+        std::unique_ptr<metrics_exporter> exporter;
+        if (!options.metrics_path.empty()) {
+            exporter = std::make_unique<metrics_exporter>(options.metrics_path, options.metrics_interval,
+                                                          [&resolver] { return resolver.metrics().snapshot(); });
+            exporter->start();
+        }
+        output_buffer out(sink);
+        bulk_resolver bulk(resolver, in, options.window, DNS::DNS_TYPE_A, [&out, &options](const dns_result &result) {
+            format_result(out.buffer(), options.format, result);
+            out.commit();
+        });
+        bulk.start();
+        ios.run();
+        out.flush();
+        if (exporter) {
+            exporter->stop();
+        }
+        if (snapshotter) {
+            snapshotter->stop();
+        }
+        fmt::print(stderr, "bulk done: {} sent, {} completed\n", bulk.sent(), bulk.completed());
+        if (resolver.upstreams().size() > 1) {
+            print_upstreams(resolver.upstreams());
+        }
+        return 0;
+    }
+
+    options.engine.window = options.window;
+    options.engine.cache = cache.get();
+    std::vector<output_buffer> outs;
+    for (unsigned int i = 0; i < options.engine.threads; i++) {
+        outs.emplace_back(sink);
+    }
+    std::atomic<size_t> completed{0};
+    resolver_engine engine(options.servers, options.engine, [&outs, &completed, &options](unsigned int worker, const dns_result &result) {
+        format_result(outs[worker].buffer(), options.format, result);
+        outs[worker].commit();
+        completed.fetch_add(1, std::memory_order_relaxed);
+    });
+    std::unique_ptr<metrics_exporter> exporter;
+    if (!options.metrics_path.empty()) {
+        exporter = std::make_unique<metrics_exporter>(options.metrics_path, options.metrics_interval, [&engine] { return engine.metrics(); });
+        exporter->start();
+    }
+    engine.start();
+    size_t sent = 0;
+    string host;
+    while (next_host(in, host)) {
+        engine.submit(std::move(host), DNS::DNS_TYPE_A);
+        sent++;
+    }
+    engine.finish();
+    engine.join();
+    for (auto &out : outs) {
+        out.flush();
+    }
+    if (exporter) {
+        exporter->stop();
+    }
+    if (snapshotter) {
+        snapshotter->stop();
+    }
+    fmt::print(stderr, "bulk done: {} sent, {} completed, {} threads{}\n", sent, completed.load(), engine.threads(),
+               engine.shared_port() ? ", shared port" : "");
+    return 0;
+}
+
+// reverse lookups of every address in the blocks, paced by the token bucket
+static int run_ptr_sweep(const string &list, const bulk_options &options, const ptr_sweep::options &sweep_options) {
+    std::vector<cidr_block> blocks;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = std::min(list.find(',', begin), list.size());
+        cidr_block block;
+        if (!cidr_block::parse(list.substr(begin, end - begin), block)) {
+            fmt::print(stderr, "bad cidr block: {}\n", list.substr(begin, end - begin));
+            return -1;
+        }
+        blocks.push_back(block);
+        begin = end + 1;
+    }
+
+    asio::io_context ios(1);
+    udp::socket sock(ios, udp::endpoint(options.servers.front().protocol(), 0));
+    dns_resolver resolver(make_udp_transport(std::move(sock), options.engine.batch), options.servers, options.window);
+    resolver.set_retry_policy(options.engine.retry);
+    resolver.set_hedge_percentile(options.engine.hedge_percentile);
+    resolver.set_edns_payload(options.engine.edns_payload);
+    std::unique_ptr<metrics_exporter> exporter;
+    if (!options.metrics_path.empty()) {
+        exporter = std::make_unique<metrics_exporter>(options.metrics_path, options.metrics_interval,
+                                                      [&resolver] { return resolver.metrics().snapshot(); });
+        exporter->start();
+    }
+    output_sink sink;
+    output_buffer out(sink);
+    ptr_sweep sweep(resolver, std::move(blocks), sweep_options, [&out, &options](std::string_view address, const dns_result &result) {
+        // the swept address in the host column, the reverse name is in the answer records
+        dns_result row = result;
+        row.host = address;
+        format_result(out.buffer(), options.format, row);
+        out.commit();
+    });
+    sweep.start();
+    ios.run();
+    out.flush();
+    if (exporter) {
+        exporter->stop();
+    }
+    fmt::print(stderr, "ptr sweep done: {} sent, {} completed, {} backoffs, final rate {:.0f} qps\n", sweep.sent(), sweep.completed(),
+               sweep.backoffs(), sweep.rate());
+    return 0;
+}
+
+// "port", "address:port" or "[ipv6]:port"; a bare port listens on loopback
+static bool parse_listen(const string &text, udp::endpoint &endpoint) {
+    size_t colon = text.rfind(':');
+    string address = colon == string::npos ? "127.0.0.1" : text.substr(0, colon);
+    string port = colon == string::npos ? text : text.substr(colon + 1);
+    if (address.size() >= 2 && address.front() == '[' && address.back() == ']') {
+        address = address.substr(1, address.size() - 2);
+    }
+    asio::error_code err;
+    auto ip = asio::ip::make_address(address, err);
+    char *end = nullptr;
+    unsigned long number = strtoul(port.c_str(), &end, 10);
+    if (err || port.empty() || *end != 0 || number > 65535) {
+        fmt::print(stderr, "bad listen address: {}\n", text);
+        return false;
+    }
+    endpoint = udp::endpoint(ip, (unsigned short) number);
+    return true;
+}
+
+// caching forwarder until SIGINT or SIGTERM
+static int run_listen(const udp::endpoint &listen, bulk_options options) {
+    std::unique_ptr<dns_cache> cache;
+    if (options.cache_size > 0) {
+        cache = std::make_unique<dns_cache>(options.cache_size);
+    }
+    options.engine.window = options.window;
+    options.engine.cache = cache.get();
+    dns_forwarder forwarder(listen, options.servers, options.engine);
+    asio::error_code err;
+    if (!forwarder.open(err)) {
+        fmt::print(stderr, "can not listen on {}:{}: {}\n", listen.address().to_string(), listen.port(), err.message());
+        return -1;
+    }
+    std::unique_ptr<periodic_task> snapshotter = start_snapshots(cache.get(), options);
+    std::unique_ptr<metrics_exporter> exporter;
+    if (!options.metrics_path.empty()) {
+        exporter = std::make_unique<metrics_exporter>(options.metrics_path, options.metrics_interval, [&forwarder] { return forwarder.metrics(); });
+        exporter->start();
+    }
+    forwarder.start();
+    fmt::print(stderr, "forwarding {}:{} to {} upstream(s), {} threads, cache {}\n", forwarder.local_endpoint().address().to_string(),
+               forwarder.local_endpoint().port(), options.servers.size(), forwarder.threads(), options.cache_size);
+
+    asio::io_context ios(1);
+    asio::signal_set signals(ios, SIGINT, SIGTERM);
+    signals.async_wait([&forwarder](const asio::error_code &, int) { forwarder.stop(); });
+    ios.run();
+    forwarder.join();
+    if (exporter) {
+        exporter->stop();
+    }
+    if (snapshotter) {
+        snapshotter->stop();
+    }
+    dns_forwarder::stats totals = forwarder.totals();
+    fmt::print(stderr, "forwarder done: {} requests, {} replies, {} truncated, {} servfail, {} malformed, {} dropped\n", totals.requests,
+               totals.replies, totals.truncated, totals.servfails, totals.malformed, totals.dropped);
+    return 0;
+}
+
+// from the root hints down, no recursive server involved: one name, or bulk mode on one thread
+static int run_iterative(const string &source, bool bulk, const std::vector<asio::ip::address> &roots, unsigned short port,
+                         const retry_policy &retry, unsigned short edns_payload, size_t window, DNS::OutputFormat format, bool trace) {
+    std::ifstream file;
+    std::istringstream single(source);
+    if (bulk && source != "-") {
+        file.open(source);
+        if (!file) {
+            fmt::print(stderr, "can not open host list {}\n", source);
+            return -1;
+        }
+    }
+    std::istream &in = !bulk ? single : source == "-" ? std::cin : file;
+
+    asio::io_context ios(1);
+    udp::socket sock(ios, udp::endpoint(roots.front().is_v4() ? udp::v4() : udp::v6(), 0));
+    iterative_resolver resolver(make_udp_transport(std::move(sock), 0), roots, port);
+    resolver.set_retry_policy(retry);
+    resolver.set_edns_payload(edns_payload);
+    resolver.set_trace(trace);
+    output_sink sink;
+    output_buffer out(sink);
+    int ret = 0;
+    basic_bulk_resolver<iterative_resolver> lookups(resolver, in, window, DNS::DNS_TYPE_A, [&](const dns_result &result) {
+        if (bulk) {
+            format_result(out.buffer(), format, result);
+            out.commit();
+            return;
+        }
+        print_result(format, result.host, static_cast<unsigned char>(result.status), result.packet, result.len);
+        ret = result.status == resolve_status::ok ? 0 : -1;
+    });
+    lookups.start();
+    ios.run();
+    out.flush();
+    if (bulk || trace) {
+        fmt::print(stderr, "iterative done: {} names, {} queries, {} referrals, {} zones cached\n", lookups.completed(), resolver.queries_sent(),
+                   resolver.referrals(), resolver.zones());
+    }
+    return ret;
+}
+
+// A and AAAA in parallel, CNAMEs followed, addresses in connect order
+static int run_addresses(const string &host, const std::vector<udp::endpoint> &servers, const retry_policy &retry, unsigned short edns_payload,
+                         hosts_file *hosts, const resolv_conf &conf) {
+    asio::io_context ios(1);
+    udp::socket sock(ios, udp::endpoint(servers.front().protocol(), 0));
+    dns_resolver resolver(make_udp_transport(std::move(sock), 0), servers, 2 * std::max<size_t>(conf.search.size() + 1, 1));
+    resolver.set_retry_policy(retry);
+    resolver.set_edns_payload(edns_payload);
+    resolver.set_hosts(hosts);
+    resolver.set_search(conf);
+    address_resolver addresses(resolver);
+    int ret = -1;
+    addresses.async_resolve(host, [&ret](const address_result &result) {
+        if (result.status == resolve_status::timeout) {
+            fmt::print(stderr, "{}: timeout\n", result.host);
+            return;
+        }
+        if (!result.ok()) {
+            fmt::print(stderr, "{}: no address, rcode {}\n", result.host, result.rcode);
+            return;
+        }
+        if (result.canonical_name != result.host) {
+            fmt::print("{} is an alias for {}\n", result.host, result.canonical_name);
+        }
+        for (const auto &address : result.addresses) {
+            fmt::print("{}\t{}\t{}\n", result.canonical_name, result.ttl, address.to_string());
+        }
+        ret = 0;
+    });
+    ios.run();
+    return ret;
+}
+
+// a name with several search list candidates: all asked at once through the resolver
+static int run_search(const string &host, const std::vector<udp::endpoint> &servers, const retry_policy &retry, unsigned short edns_payload,
+                      const resolv_conf &conf, DNS::OutputFormat format) {
+    asio::io_context ios(1);
+    udp::socket sock(ios, udp::endpoint(servers.front().protocol(), 0));
+    dns_resolver resolver(make_udp_transport(std::move(sock), 0), servers, conf.search.size() + 1);
+    resolver.set_retry_policy(retry);
+    resolver.set_edns_payload(edns_payload);
+    resolver.set_search(conf);
+    int ret = -1;
+    resolver.async_resolve(host, DNS::DNS_TYPE_A, [&ret, format](const dns_result &result) {
+        print_result(format, result.host, static_cast<unsigned char>(result.status), result.packet, result.len);
+        ret = result.status == resolve_status::timeout ? -1 : 0;
+    });
+    ios.run();
+    return ret;
+}
+
 int main(int argc, char* argv[]) {
     string url;
     string dns_server;
@@ -13,7 +436,35 @@ int main(int argc, char* argv[]) {
 
     cmdline::parser parser;
     parser.add<string>("url", 'u', "query url", false);
-    parser.add<string>("server", 's', "dns server", false, "114.114.114.114");
+    parser.add<string>("server", 's', "dns server, bulk mode takes a comma separated list; without it the resolv.conf nameservers are used", false, "114.114.114.114");
+    parser.add<int>("port", 'p', "dns server port", false, DNS::DNS_UDP_PORT, cmdline::range(1, 65535));
+    parser.add<string>("bulk", 'b', "bulk mode, read host names from file (- for stdin)", false);
+    parser.add<string>("listen", 'l', "forwarder mode: serve DNS over udp on [address:]port with the bulk mode resolver options; --cache defaults to 1000000 here", false);
+    parser.add<string>("ptr", '\0', "ptr sweep: reverse resolve every address of these comma separated CIDR blocks, bulk mode options apply", false);
+    parser.add<int>("qps", '\0', "ptr sweep rate limit, lowered while timeouts or SERVFAIL rise and raised again up to this", false, 1000, cmdline::range(1, 10000000));
+    parser.add<int>("burst", '\0', "ptr sweep token bucket size", false, 100, cmdline::range(1, 1000000));
+    parser.add("fixed-rate", '\0', "ptr sweep keeps --qps instead of adapting it");
+    parser.add<int>("window", 'w', "bulk mode queries in flight", false, 1000, cmdline::range(1, 65535));
+    parser.add<int>("cache", '\0', "bulk mode cache entries, 0 disables the cache", false, 0, cmdline::range(0, 1 << 26));
+    parser.add<int>("timeout", '\0', "first retransmit timeout in ms, doubled on every retry; without it a resolv.conf timeout option is used", false, 1000, cmdline::range(1, 60000));
+    parser.add<int>("attempts", '\0', "sends per query before giving up; without it a resolv.conf attempts option is used", false, 3, cmdline::range(1, 16));
+    parser.add<int>("edns", '\0', "advertised EDNS0 udp payload size, 0 sends queries without an OPT record", false, DNS::DNS_EDNS_PAYLOAD_SIZE, cmdline::range(0, (int) DNS::DNS_MAX_EDNS_PAYLOAD_SIZE));
+    parser.add<int>("hedge", '\0', "bulk mode with several servers: copy a query to the next best server after this rtt percentile, 0 disables", false, 95, cmdline::range(0, 99));
+    parser.add<int>("threads", 't', "bulk mode worker threads", false, 1, cmdline::range(1, 256));
+    parser.add("pin", '\0', "pin bulk mode worker threads to cpus");
+    parser.add("reuse-port", '\0', "bulk mode workers share one local port (SO_REUSEPORT)");
+    parser.add<int>("batch", '\0', "bulk mode sendmmsg/recvmmsg batch size, 0 sends one datagram per syscall", false, 0, cmdline::range(0, 1024));
+    parser.add<string>("snapshot", '\0', "bulk mode with --cache: warm start from this cache snapshot and rewrite it periodically and at exit", false);
+    parser.add<int>("snapshot-interval", '\0', "seconds between cache snapshots, 0 writes only at exit", false, 60, cmdline::range(0, 86400));
+    parser.add<string>("metrics", '\0', "bulk mode: write prometheus metrics to this file periodically, on SIGUSR1 and at exit", false);
+    parser.add<int>("metrics-interval", '\0', "seconds between metrics snapshots, 0 writes only on SIGUSR1 and at exit", false, 10, cmdline::range(0, 86400));
+    parser.add<string>("format", '\0', "output format: table (single query only), tsv, jsonl or binary; default table for -u, tsv for bulk mode", false);
+    parser.add<string>("hosts", '\0', "hosts file answering the names it lists without any query", false, "/etc/hosts");
+    parser.add<string>("resolv-conf", '\0', "resolv.conf with the nameservers, search list, ndots, timeout and attempts", false, "/etc/resolv.conf");
+    parser.add("no-local", '\0', "ignore the hosts file and resolv.conf");
+    parser.add("iterative", '\0', "with -u or -b: resolve from the root hints, following referrals, instead of asking -s; -p is every nameserver's port and bulk mode runs on one thread");
+    parser.add<string>("root-hints", '\0', "root hints for --iterative, a named.root file or one address per line; default the IANA root servers", false);
+    parser.add("addresses", 'a', "with -u: look up A and AAAA in parallel, follow CNAMEs and print the addresses in RFC 6724 order");
     parser.add("verbose", 'v', "dns packet verbose info");
     parser.add("help", 'h', "usage instruction");
     parser.add("check", 'c', "check your terminal window size");
@@ -28,20 +479,155 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    // local sources: names in hosts never reach the network, resolv.conf fills in what the command line leaves out
+    resolv_conf conf;
+    std::unique_ptr<hosts_file> hosts;
+    if (!parser.exist("no-local")) {
+        resolv_conf::load(parser.get<string>("resolv-conf"), conf);
+        hosts = std::make_unique<hosts_file>(parser.get<string>("hosts"));
+        hosts->load();
+    }
+    std::vector<udp::endpoint> servers;
+    if (!parser.exist("server")) {
+        resolv_conf_servers(conf, parser.get<int>("port"), servers);
+    }
+    if (servers.empty() && !parse_servers(parser.get<string>("server"), parser.get<int>("port"), servers)) {
+        return -1;
+    }
+
+    retry_policy retry;
+    retry.timeout = std::chrono::milliseconds(parser.get<int>("timeout"));
+    retry.attempts = parser.get<int>("attempts");
+    if (!parser.exist("timeout") && conf.timeout > 0) {
+        retry.timeout = std::chrono::seconds(conf.timeout);
+    }
+    if (!parser.exist("attempts") && conf.attempts > 0) {
+        retry.attempts = conf.attempts;
+    }
+    // payloads below the 512 byte dns minimum make no sense, treat them as 512
+    unsigned short edns_payload = parser.get<int>("edns") == 0 ? 0 : std::max(parser.get<int>("edns"), 512);
+
+    DNS::OutputFormat format = parser.exist("bulk") || parser.exist("ptr") ? DNS::OUTPUT_TSV : DNS::OUTPUT_TABLE;
+    if (parser.exist("format") && !DNS::ParseOutputFormat(parser.get<string>("format"), format)) {
+        fmt::print(stderr, "unknown output format: {}\n", parser.get<string>("format"));
+        return -1;
+    }
+
+    if (parser.exist("iterative")) {
+        std::vector<asio::ip::address> roots;
+        if (parser.exist("root-hints")) {
+            if (!iterative_resolver::load_root_hints(parser.get<string>("root-hints"), roots)) {
+                fmt::print(stderr, "no root server addresses in {}\n", parser.get<string>("root-hints"));
+                return -1;
+            }
+            // one socket, one address family: the first hint's
+            std::erase_if(roots, [v4 = roots.front().is_v4()](const asio::ip::address &address) { return address.is_v4() != v4; });
+        } else {
+            roots = iterative_resolver::default_root_hints(false);
+        }
+        bool bulk = parser.exist("bulk");
+        if (!bulk && !parser.exist("url")) {
+            fmt::print(stderr, "--iterative needs -u or -b\n");
+            return -1;
+        }
+        if (bulk && format == DNS::OUTPUT_TABLE) {
+            fmt::print(stderr, "bulk mode writes tsv, jsonl or binary, the table is for single queries\n");
+            return -1;
+        }
+        return run_iterative(bulk ? parser.get<string>("bulk") : parser.get<string>("url"), bulk, roots, parser.get<int>("port"), retry,
+                             edns_payload, bulk ? parser.get<int>("window") : 1, format, parser.exist("verbose"));
+    }
+
+    if (parser.exist("bulk") || parser.exist("listen") || parser.exist("ptr")) {
+        if (!parser.exist("listen") && format == DNS::OUTPUT_TABLE) {
+            fmt::print(stderr, "bulk mode writes tsv, jsonl or binary, the table is for single queries\n");
+            return -1;
+        }
+        bulk_options options;
+        options.format = format;
+        options.servers = servers;
+        options.engine.hosts = hosts.get();
+        options.engine.search = conf;
+        options.window = parser.get<int>("window");
+        options.cache_size = parser.get<int>("cache");
+        if (parser.exist("listen") && !parser.exist("cache")) {
+            options.cache_size = 1000000;
+        }
+        options.engine.threads = parser.get<int>("threads");
+        options.engine.pin_cpus = parser.exist("pin");
+        options.engine.reuse_port = parser.exist("reuse-port");
+        options.engine.batch = parser.get<int>("batch");
+        options.engine.retry = retry;
+        options.engine.hedge_percentile = parser.get<int>("hedge") / 100.0;
+        options.engine.edns_payload = edns_payload;
+        if (parser.exist("snapshot")) {
+            if (options.cache_size == 0) {
+                fmt::print(stderr, "--snapshot needs a cache, set --cache\n");
+                return -1;
+            }
+            options.snapshot_path = parser.get<string>("snapshot");
+            options.snapshot_interval = std::chrono::seconds(parser.get<int>("snapshot-interval"));
+        }
+        if (parser.exist("metrics")) {
+            options.metrics_path = parser.get<string>("metrics");
+            options.metrics_interval = std::chrono::seconds(parser.get<int>("metrics-interval"));
+        }
+        if (parser.exist("ptr")) {
+            ptr_sweep::options sweep_options;
+            sweep_options.qps = parser.get<int>("qps");
+            sweep_options.burst = parser.get<int>("burst");
+            sweep_options.window = options.window;
+            sweep_options.adaptive = !parser.exist("fixed-rate");
+            return run_ptr_sweep(parser.get<string>("ptr"), options, sweep_options);
+        }
+        if (parser.exist("listen")) {
+            udp::endpoint listen;
+            if (!parse_listen(parser.get<string>("listen"), listen)) {
+                return -1;
+            }
+            return run_listen(listen, options);
+        }
+        return run_bulk(parser.get<string>("bulk"), options);
+    }
+
     url = parser.get<string>("url");
     if (url.empty()) {
         fmt::print(stderr, "If you don't use the -c parameter, you have to use -u for dns querying.\n");
         fmt::print(stderr, parser.usage());
         return -1;
     }
-    dns_server = parser.get<string>("server");
+    if (parser.exist("addresses")) {
+        return run_addresses(url, servers, retry, edns_payload, hosts.get(), conf);
+    }
+    if (hosts) {
+        char buf[DNS::DNS_MAX_EDNS_PAYLOAD_SIZE];
+        int len = hosts->answer(url, DNS::DNS_TYPE_A, 0, buf, sizeof(buf));
+        if (len > 0) {
+            print_result(format, url, DNS::RESULT_OK, buf, len);
+            return 0;
+        }
+    }
+    std::vector<string> names = conf.candidates(url);
+    if (names.size() > 1) {
+        return run_search(url, servers, retry, edns_payload, conf, format);
+    }
+    if (!names.empty()) {
+        url = names.front();
+    }
+    // a single query only goes to the first server of a list
+    dns_server = servers.front().address().to_string();
     verbose = parser.exist("verbose");
     if(verbose) {
         fmt::print("query url: {} \ndns server: {}\n", url, dns_server);
     }
 
-    async_udp_client client(dns_server);
-    client.query(url, verbose);
+    async_udp_client client(dns_server, parser.get<int>("port"));
+    client.set_retry_policy(retry);
+    client.set_edns_payload(edns_payload);
+    client.set_output_format(format);
+    if (!client.query(url, verbose)) {
+        return -1;
+    }
 
     return 0;
 }
\ No newline at end of file
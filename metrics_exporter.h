@@ -0,0 +1,104 @@
+#ifndef DNS_CLIENT_METRICS_EXPORTER_H
+#define DNS_CLIENT_METRICS_EXPORTER_H
+
+#include "asio.hpp"
+#include "resolver_metrics.h"
+#include <fmt/format.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Writes a Prometheus text snapshot to a file every interval and on SIGUSR1, from a thread
+// of its own, so the resolver threads never wait on it. The file is written next to the
+// target and renamed over it, a scraper (e.g. the node_exporter textfile collector) never
+// reads half a snapshot.
+class metrics_exporter {
+public:
+    // collect is called on the exporter thread and must only read the metrics
+    using collect_type = std::function<metrics_snapshot()>;
+
+    metrics_exporter(std::string path, std::chrono::seconds interval, collect_type collect)
+        : path_(std::move(path)), interval_(interval), collect_(std::move(collect)), timer_(ios_), signals_(ios_, SIGUSR1) {}
+
+    metrics_exporter(const metrics_exporter &) = delete;
+    metrics_exporter &operator=(const metrics_exporter &) = delete;
+
+    ~metrics_exporter() { stop(); }
+
+    void start() {
+        wait_signal();
+        if (interval_.count() > 0) {
+            arm_timer();
+        }
+        thread_ = std::thread([this] { ios_.run(); });
+    }
+
+    // stops the thread and writes the final snapshot
+    void stop() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        asio::post(ios_, [this] {
+            asio::error_code ignored;
+            timer_.cancel();
+            signals_.cancel(ignored);
+        });
+        thread_.join();
+        dump();
+    }
+
+    bool dump() {
+        fmt::memory_buffer out;
+        format_prometheus(out, collect_());
+        std::string tmp = path_ + ".tmp";
+        FILE *file = fopen(tmp.c_str(), "w");
+        if (file == nullptr) {
+            fmt::print(stderr, "can not write metrics to {}\n", tmp);
+            return false;
+        }
+        bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path_.c_str()) != 0) {
+            fmt::print(stderr, "can not write metrics to {}\n", path_);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void arm_timer() {
+        timer_.expires_after(interval_);
+        timer_.async_wait([this](const asio::error_code &err) {
+            if (err) {
+                return;
+            }
+            dump();
+            arm_timer();
+        });
+    }
+
+    void wait_signal() {
+        signals_.async_wait([this](const asio::error_code &err, int) {
+            if (err) {
+                return;
+            }
+            dump();
+            wait_signal();
+        });
+    }
+
+    std::string path_;
+    std::chrono::seconds interval_;
+    collect_type collect_;
+    asio::io_context ios_{1};
+    asio::steady_timer timer_;
+    asio::signal_set signals_;
+    std::thread thread_;
+};
+
+#endif//DNS_CLIENT_METRICS_EXPORTER_H
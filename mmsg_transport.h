@@ -0,0 +1,203 @@
+#ifndef DNS_CLIENT_MMSG_TRANSPORT_H
+#define DNS_CLIENT_MMSG_TRANSPORT_H
+
+#include "dns_transport.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <vector>
+
+// Batched Linux transport. Outgoing queries are copied into a contiguous ring of
+// fixed size slots and flushed with one sendmmsg, either when the batch is full or once
+// the current handler returns. Readiness comes from the asio reactor; replies are then
+// drained with recvmmsg into preallocated slots, batch datagrams per syscall.
+class mmsg_udp_transport : public dns_transport {
+public:
+    static constexpr size_t s_slot_size = 4096;
+
+    mmsg_udp_transport(udp::socket sock, size_t batch)
+        : sock_(std::move(sock)),
+          batch_(batch < 1 ? 1 : batch),
+          tx_buf_(batch_ * s_slot_size),
+          tx_iov_(batch_),
+          tx_addr_(batch_),
+          tx_msgs_(batch_),
+          rx_buf_(batch_ * s_slot_size),
+          rx_iov_(batch_),
+          rx_addr_(batch_),
+          rx_msgs_(batch_) {
+        sock_.non_blocking(true);
+        for (size_t i = 0; i < batch_; i++) {
+            tx_iov_[i].iov_base = tx_buf_.data() + i * s_slot_size;
+            tx_msgs_[i].msg_hdr.msg_iov = &tx_iov_[i];
+            tx_msgs_[i].msg_hdr.msg_iovlen = 1;
+            tx_msgs_[i].msg_hdr.msg_name = &tx_addr_[i];
+
+            rx_iov_[i].iov_base = rx_buf_.data() + i * s_slot_size;
+            rx_iov_[i].iov_len = s_slot_size;
+            rx_msgs_[i].msg_hdr.msg_iov = &rx_iov_[i];
+            rx_msgs_[i].msg_hdr.msg_iovlen = 1;
+            rx_msgs_[i].msg_hdr.msg_name = &rx_addr_[i];
+        }
+    }
+
+    bool send(const char *data, size_t len, const udp::endpoint &to) override {
+        if (len > s_slot_size) {
+            return false;
+        }
+        if (tx_cnt_ == batch_) {
+            flush();
+            if (tx_cnt_ == batch_) {
+                // socket buffer full and ring full, the caller's timeout takes over
+                return false;
+            }
+        }
+        size_t i = tx_cnt_++;
+        memcpy(tx_iov_[i].iov_base, data, len);
+        tx_iov_[i].iov_len = len;
+        memcpy(&tx_addr_[i], to.data(), to.size());
+        tx_msgs_[i].msg_hdr.msg_namelen = to.size();
+        if (!flush_posted_) {
+            flush_posted_ = true;
+            asio::post(sock_.get_executor(), [this] {
+                flush_posted_ = false;
+                flush();
+            });
+        }
+        return true;
+    }
+
+    void start_receive() override {
+        receiving_ = true;
+        if (!waiting_ && !delivering_) {
+            wait_read();
+        }
+    }
+
+    void stop_receive() override {
+        receiving_ = false;
+        if (waiting_) {
+            sock_.cancel();
+        }
+    }
+
+    udp::socket &socket() override { return sock_; }
+
+private:
+    void flush() {
+        size_t sent = 0;
+        while (sent < tx_cnt_) {
+            int n = sendmmsg(sock_.native_handle(), tx_msgs_.data() + sent, tx_cnt_ - sent, MSG_DONTWAIT);
+            if (n > 0) {
+                sent += n;
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            // the first message failed, drop it and go on with the rest
+            report_error(true, asio::error_code(errno, asio::error::get_system_category()));
+            sent++;
+        }
+        if (sent > 0 && sent < tx_cnt_) {
+            // keep the unsent tail at the front of the ring
+            for (size_t i = sent; i < tx_cnt_; i++) {
+                size_t dst = i - sent;
+                memcpy(tx_iov_[dst].iov_base, tx_iov_[i].iov_base, tx_iov_[i].iov_len);
+                tx_iov_[dst].iov_len = tx_iov_[i].iov_len;
+                tx_addr_[dst] = tx_addr_[i];
+                tx_msgs_[dst].msg_hdr.msg_namelen = tx_msgs_[i].msg_hdr.msg_namelen;
+            }
+        }
+        tx_cnt_ -= sent;
+        if (tx_cnt_ > 0 && !write_waiting_) {
+            write_waiting_ = true;
+            sock_.async_wait(udp::socket::wait_write, [this](const asio::error_code &err) {
+                write_waiting_ = false;
+                // stop_receive's cancel() takes this wait down too, the batch still has to go out
+                if (err && err != asio::error::operation_aborted) {
+                    tx_cnt_ = 0;
+                    return;
+                }
+                flush();
+            });
+        }
+    }
+
+    void wait_read() {
+        waiting_ = true;
+        sock_.async_wait(udp::socket::wait_read, [this](const asio::error_code &err) {
+            waiting_ = false;
+            // a start_receive between stop_receive's cancel and this handler found waiting_ still set
+            if (err == asio::error::operation_aborted) {
+                if (receiving_) {
+                    wait_read();
+                }
+                return;
+            }
+            if (!err) {
+                drain();
+            } else {
+                report_error(false, err);
+            }
+            if (receiving_) {
+                wait_read();
+            }
+        });
+    }
+
+    void drain() {
+        delivering_ = true;
+        for (;;) {
+            for (size_t i = 0; i < batch_; i++) {
+                rx_msgs_[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+            }
+            int n = recvmmsg(sock_.native_handle(), rx_msgs_.data(), batch_, MSG_DONTWAIT, nullptr);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    report_error(false, asio::error_code(errno, asio::error::get_system_category()));
+                }
+                break;
+            }
+            for (int i = 0; i < n; i++) {
+                udp::endpoint from;
+                memcpy(from.data(), &rx_addr_[i], rx_msgs_[i].msg_hdr.msg_namelen);
+                from.resize(rx_msgs_[i].msg_hdr.msg_namelen);
+                handler_(from, static_cast<const char *>(rx_iov_[i].iov_base), rx_msgs_[i].msg_len);
+            }
+            if ((size_t) n < batch_) {
+                break;
+            }
+        }
+        delivering_ = false;
+    }
+
+private:
+    udp::socket sock_;
+    size_t batch_;
+
+    std::vector<char> tx_buf_;
+    std::vector<iovec> tx_iov_;
+    std::vector<sockaddr_storage> tx_addr_;
+    std::vector<mmsghdr> tx_msgs_;
+    size_t tx_cnt_ = 0;
+    bool flush_posted_ = false;
+    bool write_waiting_ = false;
+
+    std::vector<char> rx_buf_;
+    std::vector<iovec> rx_iov_;
+    std::vector<sockaddr_storage> rx_addr_;
+    std::vector<mmsghdr> rx_msgs_;
+    bool receiving_ = false;
+    bool waiting_ = false;
+    bool delivering_ = false;
+};
+
+#endif//DNS_CLIENT_MMSG_TRANSPORT_H
@@ -0,0 +1,66 @@
+#ifndef DNS_CLIENT_OUTPUT_SINK_H
+#define DNS_CLIENT_OUTPUT_SINK_H
+
+#include <fmt/format.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <mutex>
+#include <unistd.h>
+
+// shared file descriptor, whole chunks are written under one lock so lines never interleave
+class output_sink {
+public:
+    explicit output_sink(int fd = STDOUT_FILENO) : fd_(fd) {}
+
+    void write(const char *data, size_t len) {
+        std::lock_guard lock(mutex_);
+        while (len > 0) {
+            ssize_t n = ::write(fd_, data, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            data += n;
+            len -= n;
+        }
+    }
+
+private:
+    int fd_;
+    std::mutex mutex_;
+};
+
+// per thread staging buffer in front of an output_sink, flushed in large writes
+class output_buffer {
+public:
+    static constexpr size_t s_flush_size = 256 * 1024;
+
+    explicit output_buffer(output_sink &sink) : sink_(&sink) {}
+    output_buffer(output_buffer &&) = default;
+    ~output_buffer() { flush(); }
+
+    fmt::memory_buffer &buffer() { return buf_; }
+
+    // call after each complete record
+    void commit() {
+        if (buf_.size() >= s_flush_size) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (buf_.size() > 0) {
+            sink_->write(buf_.data(), buf_.size());
+            buf_.clear();
+        }
+    }
+
+private:
+    output_sink *sink_;
+    fmt::memory_buffer buf_;
+};
+
+#endif//DNS_CLIENT_OUTPUT_SINK_H
@@ -0,0 +1,58 @@
+#ifndef DNS_CLIENT_PERIODIC_TASK_H
+#define DNS_CLIENT_PERIODIC_TASK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// runs a task every interval (never for 0) on a thread of its own; stop() runs it one last time
+class periodic_task {
+public:
+    periodic_task(std::chrono::seconds interval, std::function<void()> task) : interval_(interval), task_(std::move(task)) {}
+
+    periodic_task(const periodic_task &) = delete;
+    periodic_task &operator=(const periodic_task &) = delete;
+
+    ~periodic_task() { stop(); }
+
+    void start() {
+        thread_ = std::thread([this] {
+            std::unique_lock lock(mutex_);
+            if (interval_.count() == 0) {
+                cv_.wait(lock, [this] { return stopping_; });
+                return;
+            }
+            while (!cv_.wait_for(lock, interval_, [this] { return stopping_; })) {
+                lock.unlock();
+                task_();
+                lock.lock();
+            }
+        });
+    }
+
+    void stop() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+        task_();
+    }
+
+private:
+    std::chrono::seconds interval_;
+    std::function<void()> task_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+#endif//DNS_CLIENT_PERIODIC_TASK_H
@@ -0,0 +1,237 @@
+#ifndef DNS_CLIENT_PTR_SWEEP_H
+#define DNS_CLIENT_PTR_SWEEP_H
+
+#include "dns_resolver.h"
+#include "token_bucket.h"
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// one CIDR block, walked address by address without materializing it
+class cidr_block {
+public:
+    // "10.0.0.0/16", "2001:db8::/120", or a bare address; host bits of the base are ignored
+    static bool parse(std::string_view text, cidr_block &block) {
+        size_t slash = text.find('/');
+        asio::error_code err;
+        auto address = asio::ip::make_address(std::string(text.substr(0, slash)), err);
+        if (err) {
+            return false;
+        }
+        block = cidr_block();
+        block.v4_ = address.is_v4();
+        unsigned int bits = block.v4_ ? 32 : 128;
+        unsigned int prefix = bits;
+        if (slash != std::string_view::npos) {
+            std::string_view digits = text.substr(slash + 1);
+            if (digits.empty() || digits.size() > 3 || digits.find_first_not_of("0123456789") != std::string_view::npos) {
+                return false;
+            }
+            prefix = std::stoi(std::string(digits));
+            if (prefix > bits) {
+                return false;
+            }
+        }
+        block.prefix_ = prefix;
+        if (block.v4_) {
+            auto bytes = address.to_v4().to_bytes();
+            std::copy(bytes.begin(), bytes.end(), block.current_.begin());
+        } else {
+            block.current_ = address.to_v6().to_bytes();
+        }
+        // clear the host bits
+        for (unsigned int i = prefix; i < bits; i++) {
+            block.current_[i / 8] &= (unsigned char) ~(0x80 >> (i % 8));
+        }
+        return true;
+    }
+
+    bool is_v4() const { return v4_; }
+
+    // the next address as text and its reverse lookup name, false once the block is done
+    bool next(std::string &address, std::string &name) {
+        if (done_) {
+            return false;
+        }
+        size_t len = v4_ ? 4 : 16;
+        name.clear();
+        if (v4_) {
+            asio::ip::address_v4::bytes_type bytes{current_[0], current_[1], current_[2], current_[3]};
+            address = asio::ip::address_v4(bytes).to_string();
+            fmt::format_to(std::back_inserter(name), "{}.{}.{}.{}.in-addr.arpa", current_[3], current_[2], current_[1], current_[0]);
+        } else {
+            address = asio::ip::address_v6(current_).to_string();
+            static const char digits[] = "0123456789abcdef";
+            for (size_t i = len; i-- > 0;) {
+                name.push_back(digits[current_[i] & 0x0f]);
+                name.push_back('.');
+                name.push_back(digits[current_[i] >> 4]);
+                name.push_back('.');
+            }
+            name += "ip6.arpa";
+        }
+        // a carry into the prefix bits means every host address was handed out
+        unsigned int bits = v4_ ? 32 : 128;
+        for (unsigned int i = bits; i-- > prefix_;) {
+            unsigned char mask = (unsigned char) (0x80 >> (i % 8));
+            current_[i / 8] ^= mask;
+            if (current_[i / 8] & mask) {
+                return true;
+            }
+        }
+        done_ = true;
+        return true;
+    }
+
+private:
+    std::array<unsigned char, 16> current_{};
+    unsigned int prefix_ = 0;
+    bool v4_ = true;
+    bool done_ = false;
+};
+
+// Reverse (PTR) sweep over CIDR blocks: names are generated as they are sent, paced by a
+// token bucket and capped at `window` lookups in flight.
+// The rate adapts AIMD style: every adapt interval with enough results, a share of bad
+// results (timeouts, SERVFAIL, REFUSED, or a retransmit before the reply) above the backoff
+// threshold cuts the rate, otherwise it grows by a fixed step back toward the configured qps.
+class ptr_sweep {
+public:
+    using clock = token_bucket::clock;
+    // address is the swept address, the result carries its reverse name
+    using handler_type = std::function<void(std::string_view address, const dns_result &)>;
+
+    struct options {
+        double qps = 1000;// upper bound, the starting rate
+        double burst = 100;
+        size_t window = 1000;
+        bool adaptive = true;
+    };
+
+    static constexpr auto s_adapt_interval = std::chrono::milliseconds(500);
+    static constexpr size_t s_min_samples = 20;
+    static constexpr double s_backoff_threshold = 0.02;
+    static constexpr double s_backoff_factor = 0.7;
+    static constexpr double s_increase_step = 0.05;// of the configured qps per interval
+    static constexpr double s_min_share = 0.01;// the rate never drops below this share of qps
+
+    ptr_sweep(dns_resolver &resolver, std::vector<cidr_block> blocks, const options &opts, handler_type handler)
+        : resolver_(resolver),
+          blocks_(std::move(blocks)),
+          options_(opts),
+          bucket_(opts.qps, opts.burst),
+          timer_(resolver.get_executor()),
+          handler_(std::move(handler)),
+          window_start_(clock::now()) {}
+
+    void start() { fill(); }
+
+    size_t sent() const { return sent_; }
+    size_t completed() const { return completed_; }
+    size_t backoffs() const { return backoffs_; }
+    double rate() const { return bucket_.rate(); }
+
+private:
+    bool next_name(std::string &address, std::string &name) {
+        while (block_ < blocks_.size()) {
+            if (blocks_[block_].next(address, name)) {
+                return true;
+            }
+            block_++;
+        }
+        return false;
+    }
+
+    void fill() {
+        if (filling_ || waiting_) {
+            return;
+        }
+        filling_ = true;
+        clock::time_point now = clock::now();
+        std::string address;
+        std::string name;
+        while (outstanding_ < options_.window && block_ < blocks_.size()) {
+            if (!bucket_.try_take(now)) {
+                waiting_ = true;
+                timer_.expires_after(bucket_.wait_time(now));
+                timer_.async_wait([this](const asio::error_code &err) {
+                    waiting_ = false;
+                    if (!err) {
+                        fill();
+                    }
+                });
+                break;
+            }
+            if (!next_name(address, name)) {
+                break;
+            }
+            outstanding_++;
+            sent_++;
+            // absolute, no search list expansion
+            name.push_back('.');
+            resolver_.async_resolve(std::move(name), DNS::DNS_TYPE_PTR, [this, address](const dns_result &result) {
+                on_result(address, result);
+            });
+            now = clock::now();
+        }
+        filling_ = false;
+    }
+
+    void on_result(std::string_view address, const dns_result &result) {
+        outstanding_--;
+        completed_++;
+        samples_++;
+        bool bad = result.status != resolve_status::ok || result.attempts > 1;
+        if (!bad) {
+            unsigned short rcode = DNS::DnsMessageView(result.packet, result.len).rcode();
+            bad = rcode == DNS::DNS_RCODE_SERVFAIL || rcode == DNS::DNS_RCODE_REFUSED;
+        }
+        if (bad) {
+            bad_++;
+        }
+        handler_(address, result);
+        adapt();
+        fill();
+    }
+
+    void adapt() {
+        clock::time_point now = clock::now();
+        if (!options_.adaptive || now - window_start_ < s_adapt_interval || samples_ < s_min_samples) {
+            return;
+        }
+        double rate = bucket_.rate();
+        if ((double) bad_ / samples_ > s_backoff_threshold) {
+            rate = std::max(rate * s_backoff_factor, options_.qps * s_min_share);
+            backoffs_++;
+        } else {
+            rate = std::min(rate + options_.qps * s_increase_step, options_.qps);
+        }
+        bucket_.set_rate(rate, now);
+        window_start_ = now;
+        samples_ = 0;
+        bad_ = 0;
+    }
+
+private:
+    dns_resolver &resolver_;
+    std::vector<cidr_block> blocks_;
+    size_t block_ = 0;
+    options options_;
+    token_bucket bucket_;
+    asio::steady_timer timer_;
+    handler_type handler_;
+    size_t outstanding_ = 0;
+    size_t sent_ = 0;
+    size_t completed_ = 0;
+    size_t backoffs_ = 0;
+    bool filling_ = false;
+    bool waiting_ = false;
+    // current adapt interval
+    clock::time_point window_start_;
+    size_t samples_ = 0;
+    size_t bad_ = 0;
+};
+
+#endif//DNS_CLIENT_PTR_SWEEP_H
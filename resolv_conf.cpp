@@ -0,0 +1,107 @@
+#include "resolv_conf.h"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+
+namespace {
+    std::vector<std::string_view> split_fields(std::string_view line) {
+        std::vector<std::string_view> fields;
+        size_t pos = 0;
+        while (pos < line.size()) {
+            while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r')) {
+                pos++;
+            }
+            size_t begin = pos;
+            while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t' && line[pos] != '\r') {
+                pos++;
+            }
+            if (pos > begin) {
+                fields.push_back(line.substr(begin, pos - begin));
+            }
+        }
+        return fields;
+    }
+
+    // "name:value" with the value clamped to max, false if the option is not name
+    bool parse_option(std::string_view option, std::string_view name, unsigned int max, unsigned int &value) {
+        if (option.size() <= name.size() + 1 || option.substr(0, name.size()) != name || option[name.size()] != ':') {
+            return false;
+        }
+        option.remove_prefix(name.size() + 1);
+        unsigned int parsed = 0;
+        if (std::from_chars(option.data(), option.data() + option.size(), parsed).ec != std::errc()) {
+            return false;
+        }
+        value = std::min(parsed, max);
+        return true;
+    }
+}
+
+bool resolv_conf::load(const std::string &path, resolv_conf &conf) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    parse(text.str(), conf);
+    return true;
+}
+
+void resolv_conf::parse(std::string_view text, resolv_conf &conf) {
+    while (!text.empty()) {
+        size_t eol = std::min(text.find('\n'), text.size());
+        std::string_view line = text.substr(0, eol);
+        text.remove_prefix(std::min(eol + 1, text.size()));
+        line = line.substr(0, std::min(line.find('#'), line.find(';')));
+
+        std::vector<std::string_view> fields = split_fields(line);
+        if (fields.size() < 2) {
+            continue;
+        }
+        if (fields[0] == "nameserver") {
+            conf.nameservers.emplace_back(fields[1]);
+        } else if (fields[0] == "search" || fields[0] == "domain") {
+            conf.search.clear();
+            for (size_t i = 1; i < fields.size() && conf.search.size() < s_max_search; i++) {
+                std::string domain(fields[i]);
+                while (!domain.empty() && domain.back() == '.') {
+                    domain.pop_back();
+                }
+                // "search ." only means: no search domains
+                if (!domain.empty()) {
+                    conf.search.push_back(std::move(domain));
+                }
+            }
+        } else if (fields[0] == "options") {
+            for (size_t i = 1; i < fields.size(); i++) {
+                parse_option(fields[i], "ndots", 15, conf.ndots) || parse_option(fields[i], "timeout", 30, conf.timeout) ||
+                        parse_option(fields[i], "attempts", 5, conf.attempts);
+            }
+        }
+    }
+}
+
+std::vector<std::string> resolv_conf::candidates(std::string_view host) const {
+    std::vector<std::string> names;
+    if (host.empty()) {
+        return names;
+    }
+    if (host.back() == '.') {
+        names.emplace_back(host.substr(0, host.size() - 1));
+        return names;
+    }
+    bool name_first = (unsigned int) std::count(host.begin(), host.end(), '.') >= ndots;
+    if (name_first) {
+        names.emplace_back(host);
+    }
+    for (const std::string &domain : search) {
+        names.push_back(std::string(host) + "." + domain);
+    }
+    if (!name_first) {
+        names.emplace_back(host);
+    }
+    return names;
+}
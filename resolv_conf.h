@@ -0,0 +1,30 @@
+#ifndef DNS_CLIENT_RESOLV_CONF_H
+#define DNS_CLIENT_RESOLV_CONF_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// the parts of resolv.conf(5) the client uses: nameserver, search / domain (the last one
+// wins) and the ndots, timeout and attempts options. Option values are clamped like glibc
+// does; timeout and attempts stay 0 when the file does not set them.
+struct resolv_conf {
+    static constexpr size_t s_max_search = 6;
+
+    std::vector<std::string> nameservers;
+    std::vector<std::string> search;// without trailing dots
+    unsigned int ndots = 1;
+    unsigned int timeout = 0;// seconds
+    unsigned int attempts = 0;
+
+    // false if the file can not be read, conf keeps the defaults then
+    static bool load(const std::string &path, resolv_conf &conf);
+    static void parse(std::string_view text, resolv_conf &conf);
+
+    // names to ask for host, in the order their answers are preferred: a trailing dot means
+    // the name only, fewer than ndots dots puts the search domains first, otherwise the name
+    // comes first
+    std::vector<std::string> candidates(std::string_view host) const;
+};
+
+#endif//DNS_CLIENT_RESOLV_CONF_H
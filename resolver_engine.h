@@ -0,0 +1,280 @@
+#ifndef DNS_CLIENT_RESOLVER_ENGINE_H
+#define DNS_CLIENT_RESOLVER_ENGINE_H
+
+#include "dns_resolver.h"
+#include "mmsg_transport.h"
+#include "spsc_ring.h"
+#ifdef DNS_CLIENT_IO_URING
+#include "uring_transport.h"
+#endif
+
+#include <atomic>
+#include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+struct resolver_engine_options {
+    unsigned int threads = 1;
+    size_t window = 1000;// queries in flight over all workers
+    bool pin_cpus = false;
+    // all workers share one local port; replies are steered to the owning worker by transaction id
+    bool reuse_port = false;
+    unsigned short local_port = 0;
+    // 0 keeps the one datagram per syscall asio path, otherwise sendmmsg/recvmmsg batches of this size
+    size_t batch = 0;
+    dns_cache *cache = nullptr;
+    hosts_file *hosts = nullptr;
+    resolv_conf search;// search domains and ndots, nameservers and the rest are ignored
+    retry_policy retry;
+    double hedge_percentile = 0.95;
+    unsigned short edns_payload = DNS::DNS_EDNS_PAYLOAD_SIZE;
+};
+
+// per-packet asio transport, or the batched one when batch > 0.
+// Built with io_uring, that transport comes first (batch sets its ring depth) and the epoll
+// ones are the fallback for kernels without it.
+inline std::unique_ptr<dns_transport> make_udp_transport(udp::socket sock, size_t batch) {
+#ifdef DNS_CLIENT_IO_URING
+    asio::error_code err;
+    if (auto transport = uring_udp_transport::create(sock, (unsigned int) batch, err)) {
+        return transport;
+    }
+    static std::atomic<bool> reported{false};
+    if (!reported.exchange(true)) {
+        fmt::print(stderr, "io_uring unavailable ({}), using epoll\n", err.message());
+    }
+#endif
+    if (batch > 0) {
+        return std::make_unique<mmsg_udp_transport>(std::move(sock), batch);
+    }
+    return std::make_unique<asio_udp_transport>(std::move(sock));
+}
+
+// calling thread onto cpu index, wrapping around the cpu count
+inline void pin_to_cpu(unsigned int index) {
+    unsigned int cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// N worker threads, each with its own io_context, socket and dns_resolver.
+// One producer thread submits names; they are spread round robin over per-worker
+// lock-free rings, so no lock is shared between workers. The handler runs on the
+// worker thread that owns the query and gets the worker index for per-thread output.
+class resolver_engine {
+public:
+    using handler_type = std::function<void(unsigned int worker, const dns_result &)>;
+
+    // every worker tracks the upstreams' rtts on its own
+    resolver_engine(const std::vector<udp::endpoint> &servers, const resolver_engine_options &options, handler_type handler)
+        : servers_(servers), options_(options), handler_(std::move(handler)) {
+        unsigned int cnt = std::max(options_.threads, 1u);
+        size_t window = std::max<size_t>(options_.window / cnt, 1);
+        for (unsigned int i = 0; i < cnt; i++) {
+            workers_.push_back(std::make_unique<worker>(i, window));
+        }
+        shared_port_ = options_.reuse_port && cnt > 1 && open_shared_port();
+        for (unsigned int i = 0; i < cnt; i++) {
+            worker &w = *workers_[i];
+            if (shared_port_) {
+                w.resolver = std::make_unique<dns_resolver>(make_udp_transport(std::move(w.shared_sock), options_.batch), servers_, window, cnt, i);
+            } else {
+                udp::socket sock(w.ios, udp::endpoint(protocol(), 0));
+                w.resolver = std::make_unique<dns_resolver>(make_udp_transport(std::move(sock), options_.batch), servers_, window);
+            }
+            w.window = w.resolver->capacity();
+            w.resolver->set_cache(options_.cache);
+            w.resolver->set_hosts(options_.hosts);
+            w.resolver->set_search(options_.search);
+            w.resolver->set_retry_policy(options_.retry);
+            w.resolver->set_hedge_percentile(options_.hedge_percentile);
+            w.resolver->set_edns_payload(options_.edns_payload);
+        }
+    }
+
+    resolver_engine(const resolver_engine &) = delete;
+    resolver_engine &operator=(const resolver_engine &) = delete;
+
+    ~resolver_engine() {
+        finish();
+        join();
+    }
+
+    void start() {
+        for (unsigned int i = 0; i < workers_.size(); i++) {
+            workers_[i]->thread = std::thread([this, i] { run_worker(i); });
+        }
+    }
+
+    // producer side, call from one thread only. blocks while every worker ring is full.
+    void submit(std::string host, unsigned short query_type) {
+        query q{std::move(host), query_type};
+        for (;;) {
+            for (size_t tries = 0; tries < workers_.size(); tries++) {
+                worker &w = *workers_[next_];
+                next_ = (next_ + 1) % workers_.size();
+                if (w.ring.push(std::move(q))) {
+                    wake(w);
+                    return;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // no more submits; workers exit once their rings and in-flight queries are drained
+    void finish() {
+        for (auto &w : workers_) {
+            if (!w->input_done.exchange(true, std::memory_order_release)) {
+                wake(*w);
+            }
+        }
+    }
+
+    void join() {
+        for (auto &w : workers_) {
+            if (w->thread.joinable()) {
+                w->thread.join();
+            }
+        }
+    }
+
+    unsigned int threads() const { return workers_.size(); }
+    // every worker's metrics merged, safe to call from any thread while the workers run
+    metrics_snapshot metrics() const {
+        metrics_snapshot merged;
+        for (const auto &w : workers_) {
+            merged.merge(w->resolver->metrics().snapshot());
+        }
+        return merged;
+    }
+    bool shared_port() const { return shared_port_; }
+
+private:
+    struct query {
+        std::string host;
+        unsigned short query_type = 0;
+    };
+
+    struct worker {
+        worker(unsigned int index, size_t window)
+            : index(index), ios(1), guard(asio::make_work_guard(ios)), ring(std::max<size_t>(window * 2, 1024)), window(window) {}
+
+        unsigned int index;
+        asio::io_context ios;
+        asio::executor_work_guard<asio::io_context::executor_type> guard;
+        std::unique_ptr<dns_resolver> resolver;
+        udp::socket shared_sock{ios};
+        spsc_ring<query> ring;
+        std::atomic<bool> wake_pending{false};
+        std::atomic<bool> input_done{false};
+        size_t window;
+        size_t outstanding = 0;
+        bool draining = false;
+        std::thread thread;
+    };
+
+    using reuse_port_option = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+    // Every worker binds the same port with SO_REUSEPORT. Without steering the kernel would
+    // hash replies by 4-tuple, and with a single upstream they would all land on one socket.
+    // The classic BPF program returns id % N, worker i only uses ids with id % N == i,
+    // and the socket index in the group is the bind order, so each reply reaches its owner.
+    bool open_shared_port() {
+        asio::error_code err;
+        unsigned short port = options_.local_port;
+        for (size_t i = 0; i < workers_.size(); i++) {
+            udp::socket &sock = workers_[i]->shared_sock;
+            sock.open(protocol(), err);
+            if (!err) {
+                sock.set_option(reuse_port_option(true), err);
+            }
+            if (!err) {
+                sock.bind(udp::endpoint(protocol(), port), err);
+            }
+            if (err) {
+                fmt::print(stderr, "reuse port setup failed: {}, falling back to one port per worker\n", err.message());
+                close_shared_port();
+                return false;
+            }
+            port = sock.local_endpoint().port();
+        }
+        // udp payload starts at offset 0, the transaction id is the first half word
+        sock_filter code[] = {
+                {BPF_LD | BPF_H | BPF_ABS, 0, 0, 0},
+                {BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned int) workers_.size()},
+                {BPF_RET | BPF_A, 0, 0, 0},
+        };
+        sock_fprog prog{sizeof(code) / sizeof(code[0]), code};
+        if (setsockopt(workers_[0]->shared_sock.native_handle(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+            fmt::print(stderr, "SO_ATTACH_REUSEPORT_CBPF failed, falling back to one port per worker\n");
+            close_shared_port();
+            return false;
+        }
+        return true;
+    }
+
+    udp protocol() const { return servers_.front().protocol(); }
+
+    void close_shared_port() {
+        for (auto &w : workers_) {
+            asio::error_code ignored;
+            w->shared_sock.close(ignored);
+        }
+    }
+
+    void wake(worker &w) {
+        if (!w.wake_pending.exchange(true)) {
+            asio::post(w.ios, [this, &w] {
+                w.wake_pending.store(false);
+                drain(w);
+            });
+        }
+    }
+
+    void drain(worker &w) {
+        if (w.draining) {
+            return;
+        }
+        w.draining = true;
+        // read the flag before looking at the ring, every push happens before it is set
+        bool done = w.input_done.load(std::memory_order_acquire);
+        query q;
+        while (w.outstanding < w.window && w.ring.pop(q)) {
+            w.outstanding++;
+            w.resolver->async_resolve(std::move(q.host), q.query_type, [this, &w](const dns_result &result) {
+                w.outstanding--;
+                handler_(w.index, result);
+                drain(w);
+            });
+        }
+        w.draining = false;
+        if (done && w.outstanding == 0 && w.ring.empty()) {
+            w.guard.reset();
+        }
+    }
+
+    void run_worker(unsigned int index) {
+        if (options_.pin_cpus) {
+            pin_to_cpu(index);
+        }
+        workers_[index]->ios.run();
+    }
+
+private:
+    std::vector<udp::endpoint> servers_;
+    resolver_engine_options options_;
+    handler_type handler_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    size_t next_ = 0;
+    bool shared_port_ = false;
+};
+
+#endif//DNS_CLIENT_RESOLVER_ENGINE_H
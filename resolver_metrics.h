@@ -0,0 +1,292 @@
+#ifndef DNS_CLIENT_RESOLVER_METRICS_H
+#define DNS_CLIENT_RESOLVER_METRICS_H
+
+#include "asio.hpp"
+#include "dns.h"
+#include <fmt/format.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using asio::ip::udp;
+
+// Counter with a single writer: only the thread owning the resolver adds to it, any thread
+// may read. A relaxed load and store instead of fetch_add compiles to a plain add, no
+// locked instruction, and a reader never sees a torn value.
+class metric_counter {
+public:
+    void add(uint64_t n = 1) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    uint64_t load() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+class metric_gauge {
+public:
+    void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    // single writer, like metric_counter::add
+    void add(int64_t n) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    int64_t load() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+// Latency histogram with fixed power of two buckets, 16us up to 134s, so histograms of
+// different threads and upstreams merge by adding their buckets. Bucket i counts samples
+// <= 16us << i, the last one everything above (+Inf).
+class latency_histogram {
+public:
+    static constexpr size_t s_buckets = 24;
+    static constexpr uint64_t s_first_bound_us = 16;
+
+    void record(uint64_t us) {
+        size_t index = std::bit_width((us - (us > 0)) / s_first_bound_us);
+        counts_[index < s_buckets ? index : s_buckets].add();
+        sum_us_.add(us);
+    }
+
+    uint64_t bucket(size_t index) const { return counts_[index].load(); }
+    uint64_t sum_us() const { return sum_us_.load(); }
+    static uint64_t bound_us(size_t index) { return s_first_bound_us << index; }
+
+private:
+    std::array<metric_counter, s_buckets + 1> counts_;
+    metric_counter sum_us_;
+};
+
+struct upstream_metrics {
+    metric_counter sent;// every datagram or tcp message, retransmits and hedges included
+    metric_counter retransmits;
+    metric_counter hedges;
+    metric_counter tcp_sent;
+    metric_counter responses;// accepted replies, truncated ones included
+    metric_counter truncated;
+    metric_counter timeouts;// per attempt
+    std::array<metric_counter, 16> rcodes;
+    latency_histogram latency;// unambiguous rtt samples only, like the srtt
+    metric_gauge in_flight;// queries waiting on this upstream, hedged copies included
+};
+
+// plain copy of the metrics, merged over threads; what the exporter formats
+struct metrics_snapshot {
+    struct upstream {
+        std::string address;
+        uint64_t sent = 0;
+        uint64_t retransmits = 0;
+        uint64_t hedges = 0;
+        uint64_t tcp_sent = 0;
+        uint64_t responses = 0;
+        uint64_t truncated = 0;
+        uint64_t timeouts = 0;
+        std::array<uint64_t, 16> rcodes{};
+        std::array<uint64_t, latency_histogram::s_buckets + 1> latency{};
+        uint64_t latency_sum_us = 0;
+        int64_t in_flight = 0;
+    };
+
+    uint64_t queries = 0;
+    uint64_t cache_hits = 0;
+    uint64_t coalesced = 0;
+    uint64_t hosts_answers = 0;
+    uint64_t searches = 0;
+    uint64_t answered = 0;
+    uint64_t timeouts = 0;
+    uint64_t errors = 0;
+    uint64_t send_errors = 0;
+    uint64_t receive_errors = 0;
+    int64_t in_flight = 0;
+    int64_t pending = 0;
+    std::vector<upstream> upstreams;
+
+    // upstreams are matched by address, so resolvers with different server lists merge too
+    void merge(const metrics_snapshot &other) {
+        queries += other.queries;
+        cache_hits += other.cache_hits;
+        coalesced += other.coalesced;
+        hosts_answers += other.hosts_answers;
+        searches += other.searches;
+        answered += other.answered;
+        timeouts += other.timeouts;
+        errors += other.errors;
+        send_errors += other.send_errors;
+        receive_errors += other.receive_errors;
+        in_flight += other.in_flight;
+        pending += other.pending;
+        for (const upstream &u : other.upstreams) {
+            upstream *into = nullptr;
+            for (upstream &mine : upstreams) {
+                if (mine.address == u.address) {
+                    into = &mine;
+                    break;
+                }
+            }
+            if (into == nullptr) {
+                upstreams.push_back(u);
+                continue;
+            }
+            into->sent += u.sent;
+            into->retransmits += u.retransmits;
+            into->hedges += u.hedges;
+            into->tcp_sent += u.tcp_sent;
+            into->responses += u.responses;
+            into->truncated += u.truncated;
+            into->timeouts += u.timeouts;
+            for (size_t i = 0; i < u.rcodes.size(); i++) {
+                into->rcodes[i] += u.rcodes[i];
+            }
+            for (size_t i = 0; i < u.latency.size(); i++) {
+                into->latency[i] += u.latency[i];
+            }
+            into->latency_sum_us += u.latency_sum_us;
+            into->in_flight += u.in_flight;
+        }
+    }
+};
+
+// Metrics of one dns_resolver, written only by the thread running it. Cheap enough to be
+// always on: an increment is a load, an add and a store to a line nobody else writes.
+class resolver_metrics {
+public:
+    explicit resolver_metrics(const std::vector<udp::endpoint> &servers) : upstreams_(std::make_unique<upstream_metrics[]>(servers.size())) {
+        for (const auto &server : servers) {
+            addresses_.push_back(server.address().is_v6() ? fmt::format("[{}]:{}", server.address().to_string(), server.port())
+                                                          : fmt::format("{}:{}", server.address().to_string(), server.port()));
+        }
+    }
+
+    upstream_metrics &upstream(int index) { return upstreams_[index]; }
+
+    metric_counter queries;// started, cache hits and coalesced lookups excluded
+    metric_counter cache_hits;
+    metric_counter coalesced;// attached to an identical query in flight
+    metric_counter hosts_answers;// answered from the hosts file
+    metric_counter searches;// expanded with the search list, each candidate counts as a query
+    metric_counter answered;
+    metric_counter timeouts;// gave up after every attempt
+    metric_counter errors;
+    metric_counter send_errors;
+    metric_counter receive_errors;
+    metric_gauge in_flight;
+    metric_gauge pending;
+
+    // safe from any thread
+    metrics_snapshot snapshot() const {
+        metrics_snapshot s;
+        s.queries = queries.load();
+        s.cache_hits = cache_hits.load();
+        s.coalesced = coalesced.load();
+        s.hosts_answers = hosts_answers.load();
+        s.searches = searches.load();
+        s.answered = answered.load();
+        s.timeouts = timeouts.load();
+        s.errors = errors.load();
+        s.send_errors = send_errors.load();
+        s.receive_errors = receive_errors.load();
+        s.in_flight = in_flight.load();
+        s.pending = pending.load();
+        for (size_t i = 0; i < addresses_.size(); i++) {
+            const upstream_metrics &m = upstreams_[i];
+            metrics_snapshot::upstream u;
+            u.address = addresses_[i];
+            u.sent = m.sent.load();
+            u.retransmits = m.retransmits.load();
+            u.hedges = m.hedges.load();
+            u.tcp_sent = m.tcp_sent.load();
+            u.responses = m.responses.load();
+            u.truncated = m.truncated.load();
+            u.timeouts = m.timeouts.load();
+            for (size_t r = 0; r < u.rcodes.size(); r++) {
+                u.rcodes[r] = m.rcodes[r].load();
+            }
+            for (size_t b = 0; b < u.latency.size(); b++) {
+                u.latency[b] = m.latency.bucket(b);
+            }
+            u.latency_sum_us = m.latency.sum_us();
+            u.in_flight = m.in_flight.load();
+            s.upstreams.push_back(std::move(u));
+        }
+        return s;
+    }
+
+private:
+    std::vector<std::string> addresses_;
+    std::unique_ptr<upstream_metrics[]> upstreams_;
+};
+
+// Prometheus text exposition format 0.0.4
+inline void format_prometheus(fmt::memory_buffer &out, const metrics_snapshot &s) {
+    static const char *const rcode_names[16] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED", "YXDOMAIN", "YXRRSET",
+                                                "NXRRSET", "NOTAUTH", "NOTZONE", "11", "12", "13", "14", "15"};
+    auto it = std::back_inserter(out);
+    auto header = [&it](const char *name, const char *type, const char *help) {
+        fmt::format_to(it, "# HELP dns_client_{} {}\n# TYPE dns_client_{} {}\n", name, help, name, type);
+    };
+    auto single = [&it, &header](const char *name, const char *type, const char *help, auto value) {
+        header(name, type, help);
+        fmt::format_to(it, "dns_client_{} {}\n", name, value);
+    };
+    auto per_upstream = [&it, &header, &s](const char *name, const char *help, uint64_t metrics_snapshot::upstream::*field) {
+        header(name, "counter", help);
+        for (const auto &u : s.upstreams) {
+            fmt::format_to(it, "dns_client_{}{{upstream=\"{}\"}} {}\n", name, u.address, u.*field);
+        }
+    };
+
+    single("queries_total", "counter", "Queries started, cache hits and coalesced lookups excluded.", s.queries);
+    single("cache_hits_total", "counter", "Queries answered from the cache.", s.cache_hits);
+    single("coalesced_total", "counter", "Lookups that joined an identical query in flight.", s.coalesced);
+    single("hosts_answers_total", "counter", "Lookups answered from the hosts file.", s.hosts_answers);
+    single("searches_total", "counter", "Lookups expanded with the resolv.conf search list.", s.searches);
+    single("answered_total", "counter", "Queries completed with a response.", s.answered);
+    single("timeouts_total", "counter", "Queries given up after every attempt.", s.timeouts);
+    single("errors_total", "counter", "Queries failed without a response.", s.errors);
+    single("send_errors_total", "counter", "Datagrams the socket refused.", s.send_errors);
+    single("receive_errors_total", "counter", "Failed socket reads.", s.receive_errors);
+    single("in_flight", "gauge", "Queries waiting for a response.", s.in_flight);
+    single("pending", "gauge", "Queries waiting for a free slot.", s.pending);
+
+    per_upstream("upstream_sent_total", "Queries sent, retransmits, hedges and tcp included.", &metrics_snapshot::upstream::sent);
+    per_upstream("upstream_retransmits_total", "Queries sent again after a timeout.", &metrics_snapshot::upstream::retransmits);
+    per_upstream("upstream_hedges_total", "Copies of slow queries sent to this upstream.", &metrics_snapshot::upstream::hedges);
+    per_upstream("upstream_tcp_sent_total", "Queries sent over tcp.", &metrics_snapshot::upstream::tcp_sent);
+    per_upstream("upstream_truncated_total", "Responses with the TC bit set.", &metrics_snapshot::upstream::truncated);
+    per_upstream("upstream_timeouts_total", "Attempts without a response in time.", &metrics_snapshot::upstream::timeouts);
+
+    header("upstream_in_flight", "gauge", "Queries waiting for a response from this upstream, hedged copies included.");
+    for (const auto &u : s.upstreams) {
+        fmt::format_to(it, "dns_client_upstream_in_flight{{upstream=\"{}\"}} {}\n", u.address, u.in_flight);
+    }
+
+    header("upstream_responses_total", "counter", "Responses accepted, by rcode.");
+    for (const auto &u : s.upstreams) {
+        for (size_t r = 0; r < u.rcodes.size(); r++) {
+            if (u.rcodes[r] > 0 || r == DNS::DNS_RCODE_NOERROR) {
+                fmt::format_to(it, "dns_client_upstream_responses_total{{upstream=\"{}\",rcode=\"{}\"}} {}\n", u.address,
+                               rcode_names[r], u.rcodes[r]);
+            }
+        }
+    }
+
+    header("upstream_rtt_seconds", "histogram", "Round trip time of unambiguous responses.");
+    for (const auto &u : s.upstreams) {
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < latency_histogram::s_buckets; b++) {
+            cumulative += u.latency[b];
+            fmt::format_to(it, "dns_client_upstream_rtt_seconds_bucket{{upstream=\"{}\",le=\"{}\"}} {}\n", u.address,
+                           latency_histogram::bound_us(b) / 1e6, cumulative);
+        }
+        cumulative += u.latency[latency_histogram::s_buckets];
+        fmt::format_to(it, "dns_client_upstream_rtt_seconds_bucket{{upstream=\"{}\",le=\"+Inf\"}} {}\n", u.address, cumulative);
+        fmt::format_to(it, "dns_client_upstream_rtt_seconds_sum{{upstream=\"{}\"}} {}\n", u.address, u.latency_sum_us / 1e6);
+        fmt::format_to(it, "dns_client_upstream_rtt_seconds_count{{upstream=\"{}\"}} {}\n", u.address, cumulative);
+    }
+}
+
+#endif//DNS_CLIENT_RESOLVER_METRICS_H
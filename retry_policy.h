@@ -0,0 +1,26 @@
+#ifndef DNS_CLIENT_RETRY_POLICY_H
+#define DNS_CLIENT_RETRY_POLICY_H
+
+#include <algorithm>
+#include <chrono>
+
+// per-query retransmit policy: the first send waits `timeout`, every retransmit waits
+// `backoff` times longer than the one before, capped at max_timeout.
+// The query gives up after `attempts` sends.
+struct retry_policy {
+    std::chrono::milliseconds timeout{1000};
+    double backoff = 2.0;
+    unsigned int attempts = 3;
+    std::chrono::milliseconds max_timeout{10000};
+
+    // how long to wait for a reply after send number `attempt` (1 based)
+    std::chrono::milliseconds timeout_for(unsigned int attempt) const {
+        double ms = (double) timeout.count();
+        for (unsigned int i = 1; i < attempt && ms < (double) max_timeout.count(); i++) {
+            ms *= backoff;
+        }
+        return std::min(std::chrono::milliseconds((long long) ms), std::max(max_timeout, timeout));
+    }
+};
+
+#endif//DNS_CLIENT_RETRY_POLICY_H
@@ -0,0 +1,65 @@
+#ifndef DNS_CLIENT_SPSC_RING_H
+#define DNS_CLIENT_SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// bounded lock-free queue for exactly one producer thread and one consumer thread
+template<class T>
+class spsc_ring {
+public:
+    explicit spsc_ring(size_t capacity) {
+        size_t cap = 2;
+        while (cap < capacity) {
+            cap <<= 1;
+        }
+        items_.resize(cap);
+        mask_ = cap - 1;
+    }
+
+    spsc_ring(const spsc_ring &) = delete;
+    spsc_ring &operator=(const spsc_ring &) = delete;
+
+    bool push(T &&item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_) {
+                return false;
+            }
+        }
+        items_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        item = std::move(items_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire); }
+
+private:
+    static constexpr size_t s_line = 64;
+
+    std::vector<T> items_;
+    size_t mask_ = 0;
+    // producer and consumer indexes live on separate cache lines
+    alignas(s_line) std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;
+    alignas(s_line) std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;
+};
+
+#endif//DNS_CLIENT_SPSC_RING_H
@@ -0,0 +1,331 @@
+#ifndef DNS_CLIENT_TCP_POOL_H
+#define DNS_CLIENT_TCP_POOL_H
+
+#include <utility>
+#include "asio.hpp"
+#include "dns.h"
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using asio::ip::tcp;
+
+// DNS over TCP (RFC 7766) with a small pool of persistent connections per upstream.
+// Every message carries the 2-byte length prefix. Queries are pipelined: they are written
+// back to back without waiting, and replies are matched by transaction id in whatever
+// order the server sends them. Queued queries are coalesced into one write.
+// A query given up on stays on its connection: its late reply is read and discarded, so the
+// stream stays in step. A connection only keeps a read outstanding while it has queries in
+// flight, or for s_linger after the last one was given up, so an idle pool does not keep
+// the io_context running. A connection the server closed while idle fails on next use; its
+// queries then go out once more on a fresh connection before failures are reported.
+class tcp_pool {
+public:
+    // one reply message, data is only valid during the call
+    using receive_handler = std::function<void(int upstream, const char *data, size_t len)>;
+    // the query with this id was lost with its connection
+    using failure_handler = std::function<void(int upstream, unsigned short query_id)>;
+
+    // how long a connection keeps reading for the late replies of given up queries
+    static constexpr auto s_linger = std::chrono::seconds(1);
+
+    tcp_pool(asio::any_io_executor executor, std::vector<tcp::endpoint> servers, size_t connections = 2, size_t pipeline = 64)
+        : executor_(std::move(executor)),
+          servers_(std::move(servers)),
+          pools_(servers_.size()),
+          failing_(servers_.size(), false),
+          max_connections_(std::max<size_t>(connections, 1)),
+          pipeline_(std::max<size_t>(pipeline, 1)) {}
+
+    tcp_pool(const tcp_pool &) = delete;
+    tcp_pool &operator=(const tcp_pool &) = delete;
+
+    ~tcp_pool() { close(); }
+
+    void set_handlers(receive_handler on_receive, failure_handler on_failure) {
+        on_receive_ = std::move(on_receive);
+        on_failure_ = std::move(on_failure);
+    }
+
+    // queue a query to the upstream. the packet is copied.
+    void send(int upstream, const char *packet, size_t len) {
+        if (len < DNS::DNS_HEADER_SIZE || len > 65535) {
+            return;
+        }
+        std::shared_ptr<connection> conn = pick(upstream);
+        // an idle connection may have been closed by the server in the meantime
+        if (conn->state == connection::open && !conn->reading) {
+            conn->probing = true;
+        }
+        size_t begin = conn->out.size();
+        conn->out.push_back((char) (len >> 8));
+        conn->out.push_back((char) len);
+        conn->out.append(packet, len);
+        if (conn->probing) {
+            conn->replay.append(conn->out, begin, std::string::npos);
+        }
+        conn->outstanding.push_back(message_id(packet));
+        if (conn->state == connection::open) {
+            flush(conn);
+            read_length(conn);
+        }
+    }
+
+    // the query got its answer elsewhere or was given up, stop waiting for it
+    void forget(unsigned short query_id) {
+        for (auto &pool : pools_) {
+            for (size_t i = 0; i < pool.size(); i++) {
+                std::shared_ptr<connection> conn = pool[i];
+                auto it = std::find(conn->outstanding.begin(), conn->outstanding.end(), query_id);
+                if (it == conn->outstanding.end()) {
+                    continue;
+                }
+                conn->outstanding.erase(it);
+                // its reply may still come, it is read and thrown away
+                conn->discarded.push_back(query_id);
+                if (conn->discarded.size() > pipeline_) {
+                    conn->discarded.erase(conn->discarded.begin());
+                }
+                linger(conn);
+                return;
+            }
+        }
+    }
+
+    void close() {
+        for (auto &pool : pools_) {
+            while (!pool.empty()) {
+                drop(pool.back(), false);
+            }
+        }
+    }
+
+    size_t connections() const {
+        size_t cnt = 0;
+        for (const auto &pool : pools_) {
+            cnt += pool.size();
+        }
+        return cnt;
+    }
+    size_t opened() const { return opened_; }
+
+private:
+    struct connection {
+        enum state_type { connecting, open, closed };
+
+        explicit connection(const asio::any_io_executor &executor, int upstream) : sock(executor), linger(executor), upstream(upstream) {}
+
+        tcp::socket sock;
+        asio::steady_timer linger;
+        int upstream;
+        state_type state = connecting;
+        std::string out;    // framed queries waiting for the next write
+        std::string writing;// framed queries of the write in progress
+        bool reading = false;
+        std::vector<unsigned short> outstanding;
+        std::vector<unsigned short> discarded;// given up, a late reply is dropped
+        // reused after idling and no reply since: framed copies of its queries for a retry
+        bool probing = false;
+        std::string replay;
+        unsigned char len_buf[2] = {0};
+        std::vector<char> msg;
+    };
+
+    static unsigned short message_id(const char *msg) {
+        return (unsigned short) (((unsigned char) msg[0] << 8) | (unsigned char) msg[1]);
+    }
+
+    // least loaded connection with room in its pipeline, a new one while the pool is not full
+    std::shared_ptr<connection> pick(int upstream) {
+        auto &pool = pools_[upstream];
+        std::shared_ptr<connection> best;
+        for (auto &conn : pool) {
+            if (!best || conn->outstanding.size() < best->outstanding.size()) {
+                best = conn;
+            }
+        }
+        if (best && (best->outstanding.size() < pipeline_ || pool.size() >= max_connections_)) {
+            return best;
+        }
+        return open(upstream);
+    }
+
+    std::shared_ptr<connection> open(int upstream) {
+        auto &pool = pools_[upstream];
+        auto conn = std::make_shared<connection>(executor_, upstream);
+        pool.push_back(conn);
+        opened_++;
+        conn->sock.async_connect(servers_[upstream], [this, conn](const asio::error_code &err) {
+            if (conn->state == connection::closed) {
+                return;
+            }
+            if (err) {
+                // reported once until the server accepts a connection again
+                if (!failing_[conn->upstream]) {
+                    fmt::print(stderr, "tcp connect to {} failed: {}\n", servers_[conn->upstream].address().to_string(), err.message());
+                    failing_[conn->upstream] = true;
+                }
+                drop(conn, true);
+                return;
+            }
+            failing_[conn->upstream] = false;
+            asio::error_code ignored;
+            conn->sock.set_option(tcp::no_delay(true), ignored);
+            conn->state = connection::open;
+            flush(conn);
+            read_length(conn);
+        });
+        return conn;
+    }
+
+    void flush(const std::shared_ptr<connection> &conn) {
+        if (!conn->writing.empty() || conn->out.empty()) {
+            return;
+        }
+        conn->writing.swap(conn->out);
+        asio::async_write(conn->sock, asio::buffer(conn->writing), [this, conn](const asio::error_code &err, size_t) {
+            if (conn->state == connection::closed) {
+                return;
+            }
+            if (err) {
+                fail(conn);
+                return;
+            }
+            conn->writing.clear();
+            flush(conn);
+        });
+    }
+
+    void read_length(const std::shared_ptr<connection> &conn) {
+        if (conn->reading || (conn->outstanding.empty() && conn->discarded.empty())) {
+            return;
+        }
+        conn->reading = true;
+        asio::async_read(conn->sock, asio::buffer(conn->len_buf), [this, conn](const asio::error_code &err, size_t) {
+            if (conn->state == connection::closed) {
+                return;
+            }
+            size_t len = (conn->len_buf[0] << 8) | conn->len_buf[1];
+            if (err || len < DNS::DNS_HEADER_SIZE) {
+                fail(conn);
+                return;
+            }
+            conn->msg.resize(len);
+            asio::async_read(conn->sock, asio::buffer(conn->msg), [this, conn](const asio::error_code &err, size_t) {
+                if (conn->state == connection::closed) {
+                    return;
+                }
+                if (err) {
+                    fail(conn);
+                    return;
+                }
+                conn->reading = false;
+                conn->probing = false;
+                conn->replay.clear();
+                unsigned short id = message_id(conn->msg.data());
+                auto it = std::find(conn->outstanding.begin(), conn->outstanding.end(), id);
+                if (it != conn->outstanding.end()) {
+                    conn->outstanding.erase(it);
+                    on_receive_(conn->upstream, conn->msg.data(), conn->msg.size());
+                } else {
+                    conn->discarded.erase(std::remove(conn->discarded.begin(), conn->discarded.end(), id), conn->discarded.end());
+                }
+                if (conn->state != connection::closed) {
+                    linger(conn);
+                    read_length(conn);
+                }
+            });
+        });
+    }
+
+    // with nothing but given up queries left, the read goes on for s_linger at most,
+    // then the connection is closed: the read can not be stopped between two messages
+    void linger(const std::shared_ptr<connection> &conn) {
+        if (!conn->outstanding.empty()) {
+            return;
+        }
+        if (conn->discarded.empty()) {
+            conn->linger.cancel();
+            return;
+        }
+        conn->linger.expires_after(s_linger);
+        conn->linger.async_wait([this, conn](const asio::error_code &err) {
+            if (!err && conn->outstanding.empty()) {
+                drop(conn, false);
+            }
+        });
+    }
+
+    // a reused connection that fails before its first reply was most likely closed by the
+    // server while idle: its queries go out again on a fresh connection, once
+    void fail(const std::shared_ptr<connection> &conn) {
+        if (conn->state == connection::closed) {
+            return;
+        }
+        if (!conn->probing || conn->replay.empty()) {
+            drop(conn, true);
+            return;
+        }
+        std::string replay;
+        replay.swap(conn->replay);
+        std::vector<unsigned short> outstanding;
+        outstanding.swap(conn->outstanding);
+        int upstream = conn->upstream;
+        drop(conn, false);
+        std::shared_ptr<connection> fresh;
+        for (size_t pos = 0; pos + 2 + DNS::DNS_HEADER_SIZE <= replay.size();) {
+            size_t len = ((unsigned char) replay[pos] << 8) | (unsigned char) replay[pos + 1];
+            unsigned short id = message_id(replay.data() + pos + 2);
+            if (std::find(outstanding.begin(), outstanding.end(), id) != outstanding.end()) {
+                if (!fresh) {
+                    fresh = open(upstream);
+                }
+                fresh->out.append(replay, pos, len + 2);
+                fresh->outstanding.push_back(id);
+                outstanding.erase(std::find(outstanding.begin(), outstanding.end(), id));
+            }
+            pos += len + 2;
+        }
+        for (unsigned short id : outstanding) {
+            on_failure_(upstream, id);
+        }
+    }
+
+    // close the connection; with report set every query still on it is failed
+    void drop(std::shared_ptr<connection> conn, bool report) {
+        if (conn->state == connection::closed) {
+            return;
+        }
+        conn->state = connection::closed;
+        asio::error_code ignored;
+        conn->sock.close(ignored);
+        conn->linger.cancel();
+        auto &pool = pools_[conn->upstream];
+        pool.erase(std::remove(pool.begin(), pool.end(), conn), pool.end());
+        std::vector<unsigned short> lost;
+        lost.swap(conn->outstanding);
+        if (report) {
+            for (unsigned short id : lost) {
+                on_failure_(conn->upstream, id);
+            }
+        }
+    }
+
+private:
+    asio::any_io_executor executor_;
+    std::vector<tcp::endpoint> servers_;
+    std::vector<std::vector<std::shared_ptr<connection>>> pools_;
+    std::vector<bool> failing_;
+    size_t max_connections_;
+    size_t pipeline_;
+    size_t opened_ = 0;
+    receive_handler on_receive_;
+    failure_handler on_failure_;
+};
+
+#endif//DNS_CLIENT_TCP_POOL_H
@@ -0,0 +1,163 @@
+// dns_cache: ttl of positive answers, negative caching from the SOA (RFC 2308),
+// what is refused, CLOCK eviction, and ttls aged by the time spent in the cache
+#include "../dns.h"
+#include "../dns_cache.h"
+#include "../dns_message.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static wire response(const char *host, unsigned short flags, unsigned short an, unsigned short ns) {
+    wire w;
+    w.header(0x4242, flags, 1, an, ns, 0).name(host).u16(DNS::DNS_TYPE_A).u16(DNS::DNS_CLASS_IN);
+    return w;
+}
+
+static wire positive(const char *host, vector<unsigned int> ttls) {
+    wire w = response(host, 0x8180, (unsigned short) ttls.size(), 0);
+    for (unsigned int ttl : ttls) {
+        w.pointer(12).rr(DNS::DNS_TYPE_A, ttl, 4).u32(0x7f000001);
+    }
+    return w;
+}
+
+// NXDOMAIN, or NODATA when rcode is 0, with an optional SOA in the authority section
+static wire negative(const char *host, unsigned short rcode, bool soa, unsigned int soa_ttl = 0, unsigned int minimum = 0) {
+    wire w = response(host, 0x8180 | rcode, 0, soa ? 1 : 0);
+    if (soa) {
+        w.pointer(12).rr(DNS::DNS_TYPE_SOA, soa_ttl, 24).pointer(12).pointer(12).u32(1).u32(7200).u32(900).u32(86400).u32(minimum);
+    }
+    return w;
+}
+
+// ttl of every record of a cached response, in order
+static vector<unsigned int> ttls(const char *packet, int len) {
+    vector<unsigned int> out;
+    for (const DNS::DnsRecordView &rr : DNS::DnsMessageView(packet, len).records()) {
+        out.push_back(rr.ttl);
+    }
+    return out;
+}
+
+static void test_positive() {
+    dns_cache cache(1000, 4);
+    char buf[DNS::DNS_MAX_EDNS_PAYLOAD_SIZE];
+    wire w = positive("a.test", {300, 120, 600});
+    CHECK(cache.insert("a.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, w.data(), w.size()));
+    CHECK_EQ(cache.size(), 1u);
+
+    // names are case insensitive and the trailing dot is optional
+    int len = cache.lookup("A.Test.", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf));
+    CHECK_EQ(len, w.size());
+    CHECK(ttls(buf, len) == (vector<unsigned int>{300, 120, 600}));
+    CHECK_EQ(cache.lookup("a.test", DNS::DNS_TYPE_AAAA, DNS::DNS_CLASS_IN, buf, sizeof(buf)), -1);
+    CHECK_EQ(cache.lookup("b.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf)), -1);
+    CHECK_EQ(cache.lookup("a.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, w.size() - 1), -1);
+
+    // the lowest answer ttl decides
+    unsigned int ttl = 0;
+    CHECK_EQ(DNS::GetCacheTtl(w.data(), w.size(), ttl), 0);
+    CHECK_EQ(ttl, 120u);
+
+    // a zero ttl answer is not kept
+    wire zero = positive("zero.test", {300, 0});
+    CHECK(!cache.insert("zero.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, zero.data(), zero.size()));
+
+    // neither are truncated, SERVFAIL or malformed responses
+    wire tc = positive("tc.test", {300});
+    tc.str()[2] |= 0x02;
+    CHECK(!cache.insert("tc.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, tc.data(), tc.size()));
+    wire servfail = negative("fail.test", DNS::DNS_RCODE_SERVFAIL, true, 300, 300);
+    CHECK(!cache.insert("fail.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, servfail.data(), servfail.size()));
+    CHECK(!cache.insert("a.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, w.data(), w.size() - 2));
+    CHECK_EQ(cache.size(), 1u);
+}
+
+static void test_negative() {
+    dns_cache cache(1000, 4);
+    char buf[DNS::DNS_MAX_EDNS_PAYLOAD_SIZE];
+    unsigned int ttl = 0;
+
+    // NXDOMAIN is kept for min(SOA ttl, SOA minimum)
+    wire nx = negative("nx.test", DNS::DNS_RCODE_NXDOMAIN, true, 3600, 60);
+    CHECK_EQ(DNS::GetCacheTtl(nx.data(), nx.size(), ttl), 0);
+    CHECK_EQ(ttl, 60u);
+    wire nx_short = negative("nx.test", DNS::DNS_RCODE_NXDOMAIN, true, 30, 900);
+    CHECK_EQ(DNS::GetCacheTtl(nx_short.data(), nx_short.size(), ttl), 0);
+    CHECK_EQ(ttl, 30u);
+    CHECK(cache.insert("nx.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, nx.data(), nx.size()));
+    int len = cache.lookup("nx.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf));
+    CHECK_EQ(len, nx.size());
+    CHECK_EQ(DNS::DnsMessageView(buf, len).rcode(), DNS::DNS_RCODE_NXDOMAIN);
+
+    // NODATA the same way
+    wire nodata = negative("nodata.test", DNS::DNS_RCODE_NOERROR, true, 300, 300);
+    CHECK(cache.insert("nodata.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, nodata.data(), nodata.size()));
+    CHECK_EQ(cache.lookup("nodata.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf)), nodata.size());
+
+    // without a SOA there is nothing to bound the negative ttl
+    wire bare_nx = negative("bare.test", DNS::DNS_RCODE_NXDOMAIN, false);
+    CHECK_EQ(DNS::GetCacheTtl(bare_nx.data(), bare_nx.size(), ttl), -1);
+    CHECK(!cache.insert("bare.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, bare_nx.data(), bare_nx.size()));
+    wire bare_nodata = negative("bare.test", DNS::DNS_RCODE_NOERROR, false);
+    CHECK(!cache.insert("bare.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, bare_nodata.data(), bare_nodata.size()));
+    CHECK_EQ(cache.size(), 2u);
+}
+
+static void test_eviction() {
+    // one shard of 8 entries
+    dns_cache cache(8, 1);
+    char buf[DNS::DNS_MAX_EDNS_PAYLOAD_SIZE];
+    wire hot = positive("hot.test", {300});
+    CHECK(cache.insert("hot.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, hot.data(), hot.size()));
+    // a stream of new names that are never asked for again, while hot.test keeps being hit
+    for (int i = 0; i < 200; i++) {
+        string host = "cold" + to_string(i) + ".test";
+        wire cold = positive(host.c_str(), {300});
+        CHECK(cache.insert(host, DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, cold.data(), cold.size()));
+        CHECK_EQ(cache.lookup("hot.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf)), hot.size());
+        CHECK(cache.size() <= 8u);
+    }
+    CHECK_EQ(cache.size(), 8u);
+    // the newest names are still there, the oldest were evicted
+    CHECK(cache.lookup("cold199.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf)) > 0);
+    CHECK_EQ(cache.lookup("cold0.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf)), -1);
+
+    cache.clear();
+    CHECK_EQ(cache.size(), 0u);
+    CHECK(cache.insert("hot.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, hot.data(), hot.size()));
+    CHECK_EQ(cache.lookup("hot.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf)), hot.size());
+}
+
+static void test_aging() {
+    dns_cache cache(1000, 4);
+    char buf[DNS::DNS_MAX_EDNS_PAYLOAD_SIZE];
+    wire aged = positive("aged.test", {300, 2});
+    wire expiring = positive("expiring.test", {1});
+    wire nx = negative("nx.test", DNS::DNS_RCODE_NXDOMAIN, true, 3600, 1);
+    CHECK(cache.insert("aged.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, aged.data(), aged.size()));
+    CHECK(cache.insert("expiring.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, expiring.data(), expiring.size()));
+    CHECK(cache.insert("nx.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, nx.data(), nx.size()));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+
+    // every record ttl goes down by the whole seconds spent in the cache
+    int len = cache.lookup("aged.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf));
+    CHECK_EQ(len, aged.size());
+    CHECK(ttls(buf, len) == (vector<unsigned int>{299, 1}));
+    CHECK_EQ(cache.lookup("expiring.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf)), -1);
+    CHECK_EQ(cache.lookup("nx.test", DNS::DNS_TYPE_A, DNS::DNS_CLASS_IN, buf, sizeof(buf)), -1);
+}
+
+int main() {
+    test_positive();
+    test_negative();
+    test_eviction();
+    test_aging();
+    return test_result("dns_cache_test");
+}
@@ -0,0 +1,233 @@
+// DnsMessageView / DnsNameView against hand built packets, mostly malformed ones:
+// compression loops and forward pointers, overlong names, truncated rdata and section
+// counts that promise more than the packet holds
+#include "../dns.h"
+#include "../dns_message.h"
+#include "test_util.h"
+
+#include <array>
+#include <string>
+
+using namespace std;
+
+static wire question(const char *host, unsigned short an = 0, unsigned short ns = 0, unsigned short ar = 0) {
+    wire w;
+    w.header(0x1234, 0x8180, 1, an, ns, ar).name(host).u16(DNS::DNS_TYPE_A).u16(DNS::DNS_CLASS_IN);
+    return w;
+}
+
+static void test_well_formed() {
+    wire w;
+    w.header(0x1234, 0x8180, 1, 2, 0, 0).name("www.example.com").u16(DNS::DNS_TYPE_A).u16(DNS::DNS_CLASS_IN);
+    // www.example.com CNAME web.example.com, web.example.com A 93.184.216.34
+    w.pointer(12).rr(DNS::DNS_TYPE_CNAME, 300, 6);
+    int target = w.size();
+    w.u8(3).raw("web").pointer(16);
+    w.pointer(target).rr(DNS::DNS_TYPE_A, 60, 4).u8(93).u8(184).u8(216).u8(34);
+
+    DNS::DnsMessageView msg(w.data(), w.size());
+    CHECK(msg.valid());
+    CHECK_EQ(msg.id(), 0x1234);
+    CHECK(msg.response());
+    CHECK(!msg.truncated());
+    CHECK_EQ(msg.rcode(), DNS::DNS_RCODE_NOERROR);
+    CHECK_EQ(msg.length(), w.size());
+    CHECK_EQ(msg.questions().size(), 1);
+    DNS::DnsQuestionView q = *msg.questions().begin();
+    CHECK(q.host.equals("WWW.Example.com."));
+    CHECK(!q.host.equals("www.example.co"));
+    CHECK(!q.host.equals("www.example.com.cn"));
+    CHECK_EQ(q.query_type, DNS::DNS_TYPE_A);
+
+    CHECK_EQ(msg.answers().size(), 2);
+    auto it = msg.answers().begin();
+    DNS::DnsRecordView cname = *it;
+    DNS::DnsNameView name;
+    CHECK(cname.target(name));
+    CHECK_EQ(name.str(), "web.example.com");
+    CHECK_EQ(cname.ttl, 300u);
+    DNS::DnsRecordView a = *++it;
+    CHECK_EQ(a.host.str(), "web.example.com");
+    array<unsigned char, 4> addr{};
+    CHECK(a.a(addr));
+    CHECK(addr == (array<unsigned char, 4>{93, 184, 216, 34}));
+    CHECK_EQ(a.ttl, 60u);
+    CHECK(!a.target(name));
+}
+
+static void test_pointer_loops() {
+    // the question name points at itself
+    wire self;
+    self.header(1, 0x8180, 1, 0, 0, 0).pointer(12).u16(DNS::DNS_TYPE_A).u16(DNS::DNS_CLASS_IN);
+    DNS::DnsMessageView msg(self.data(), self.size());
+    CHECK(msg.valid());
+    DNS::DnsNameView host = (*msg.questions().begin()).host;
+    CHECK(!host.valid());
+    CHECK(!host.equals(""));
+    char buf[256];
+    CHECK_EQ(host.to_string(buf, sizeof(buf)), -1);
+    CHECK_EQ(host.to_wire(buf, sizeof(buf)), -1);
+
+    // owner and CNAME target point at each other
+    wire w = question("a.test", 1);
+    int owner = w.size();
+    w.pointer(owner + 12).rr(DNS::DNS_TYPE_CNAME, 300, 2).pointer(owner);
+    DNS::DnsMessageView loop(w.data(), w.size());
+    CHECK(loop.valid());
+    DNS::DnsRecordView rr = *loop.answers().begin();
+    DNS::DnsNameView target;
+    CHECK(rr.target(target));
+    CHECK(!target.valid());
+    CHECK(target.str().empty());
+    CHECK(!rr.host.valid());
+
+    // a chain of backward pointers is fine
+    wire chain = question("a.test", 1);
+    int first = chain.size();
+    chain.u8(1).raw("b").pointer(12).rr(DNS::DNS_TYPE_CNAME, 300, 4).u8(1).raw("c").pointer(first);
+    DNS::DnsMessageView ok(chain.data(), chain.size());
+    CHECK(ok.valid());
+    rr = *ok.answers().begin();
+    CHECK(rr.target(target));
+    CHECK_EQ(target.str(), "c.b.a.test");
+}
+
+static void test_forward_pointer() {
+    // the name after the question section is valid, but a pointer may only jump backwards
+    wire w;
+    w.header(1, 0x8180, 1, 0, 0, 0).pointer(18).u16(DNS::DNS_TYPE_A).u16(DNS::DNS_CLASS_IN);
+    int later = w.size();
+    w.name("a.test");
+    DNS::DnsMessageView msg(w.data(), w.size());
+    CHECK(msg.valid());
+    CHECK_EQ(msg.length(), later);
+    CHECK_EQ(later, 18);
+    CHECK(DNS::DnsNameView(msg.bytes(), later).valid());
+    DNS::DnsNameView host = (*msg.questions().begin()).host;
+    CHECK(!host.valid());
+    CHECK(!host.equals("a.test"));
+}
+
+static void test_long_names() {
+    string l63(63, 'x');
+    string l62(62, 'y');
+    string l61(61, 'z');
+    char buf[512];
+
+    // 255 bytes on the wire is the limit
+    wire max = question((l63 + "." + l63 + "." + l63 + "." + l61).c_str());
+    DNS::DnsMessageView msg(max.data(), max.size());
+    CHECK(msg.valid());
+    DNS::DnsNameView host = (*msg.questions().begin()).host;
+    CHECK(host.valid());
+    CHECK_EQ(host.to_string(buf, sizeof(buf)), 253);
+    CHECK_EQ(host.to_wire(buf, sizeof(buf)), 255);
+
+    wire over = question((l63 + "." + l63 + "." + l63 + "." + l62).c_str());
+    DNS::DnsMessageView too_long(over.data(), over.size());
+    CHECK(too_long.valid());
+    host = (*too_long.questions().begin()).host;
+    CHECK(!host.valid());
+    CHECK_EQ(host.to_string(buf, sizeof(buf)), -1);
+    CHECK(host.str().empty());
+
+    // the limit holds for the expanded name, across compression pointers
+    wire base = question((l63 + "." + l63 + "." + l63).c_str(), 2);
+    base.u8(61).raw(l61).pointer(12).rr(DNS::DNS_TYPE_A, 60, 4).u32(0x7f000001);
+    base.u8(62).raw(l62).pointer(12).rr(DNS::DNS_TYPE_A, 60, 4).u32(0x7f000001);
+    DNS::DnsMessageView compressed(base.data(), base.size());
+    CHECK(compressed.valid());
+    auto it = compressed.answers().begin();
+    CHECK((*it).host.valid());
+    CHECK(!(*++it).host.valid());
+
+    // a label longer than 63 sets the reserved 0x40 bit
+    wire reserved;
+    reserved.header(1, 0x8180, 1, 0, 0, 0).u8(64).raw(string(64, 'r')).u8(0).u16(DNS::DNS_TYPE_A).u16(DNS::DNS_CLASS_IN);
+    CHECK(!DNS::DnsMessageView(reserved.data(), reserved.size()).valid());
+    CHECK(!DNS::DnsNameView(DNS::ByteSpan(reinterpret_cast<const std::byte *>(reserved.data()), reserved.size()), 12).valid());
+}
+
+static void test_truncated_rdata() {
+    // rdlength runs past the end of the packet
+    wire cut = question("a.test", 1);
+    cut.pointer(12).rr(DNS::DNS_TYPE_A, 60, 4).u8(10).u8(0);
+    DNS::DnsMessageView msg(cut.data(), cut.size());
+    CHECK(!msg.valid());
+    CHECK(msg.answers().empty());
+    unsigned int ttl = 0;
+    CHECK_EQ(DNS::GetCacheTtl(cut.data(), cut.size(), ttl), -1);
+
+    // record header cut short
+    wire header_cut = question("a.test", 1);
+    header_cut.pointer(12).u16(DNS::DNS_TYPE_A).u16(DNS::DNS_CLASS_IN).u16(0);
+    CHECK(!DNS::DnsMessageView(header_cut.data(), header_cut.size()).valid());
+
+    // rdata inside the packet but with the wrong size for its type
+    wire w = question("a.test", 5);
+    w.pointer(12).rr(DNS::DNS_TYPE_A, 60, 3).u8(10).u8(0).u8(0);
+    w.pointer(12).rr(DNS::DNS_TYPE_AAAA, 60, 4).u32(0x20010db8);
+    w.pointer(12).rr(DNS::DNS_TYPE_CNAME, 60, 3).u8(3).raw("fo");// name continues past rdlength
+    w.pointer(12).rr(DNS::DNS_TYPE_MX, 60, 2).u16(10);
+    w.pointer(12).rr(DNS::DNS_TYPE_SOA, 60, 14).pointer(12).pointer(12).u32(1).u32(2).u16(3);
+    DNS::DnsMessageView short_rdata(w.data(), w.size());
+    CHECK(short_rdata.valid());
+    CHECK_EQ(short_rdata.length(), w.size());
+    auto it = short_rdata.answers().begin();
+    array<unsigned char, 4> a{};
+    CHECK(!(*it).a(a));
+    array<unsigned char, 16> aaaa{};
+    CHECK(!(*++it).aaaa(aaaa));
+    DNS::DnsNameView target;
+    CHECK(!(*++it).target(target));
+    unsigned short preference = 0;
+    CHECK(!(*++it).mx(preference, target));
+    DNS::DnsSoaView soa{};
+    CHECK(!(*++it).soa(soa));
+}
+
+static void test_section_counts() {
+    char small[DNS::DNS_HEADER_SIZE] = {0};
+    CHECK(!DNS::DnsMessageView(small, DNS::DNS_HEADER_SIZE - 1).valid());
+    CHECK(!DNS::DnsMessageView(small, -1).valid());
+    CHECK(DNS::DnsMessageView(small, DNS::DNS_HEADER_SIZE).valid());
+
+    // a bare header promising a question
+    wire header;
+    header.header(1, 0x8180, 0xffff, 0, 0, 0);
+    DNS::DnsMessageView msg(header.data(), header.size());
+    CHECK(!msg.valid());
+    CHECK(msg.questions().empty());
+
+    // one answer present, more counted in every section
+    wire answers = question("a.test", 3);
+    answers.pointer(12).rr(DNS::DNS_TYPE_A, 60, 4).u32(0x7f000001);
+    CHECK(!DNS::DnsMessageView(answers.data(), answers.size()).valid());
+    wire authorities = question("a.test", 1, 1);
+    authorities.pointer(12).rr(DNS::DNS_TYPE_A, 60, 4).u32(0x7f000001);
+    CHECK(!DNS::DnsMessageView(authorities.data(), authorities.size()).valid());
+    wire additionals = question("a.test", 1, 0, 0xffff);
+    additionals.pointer(12).rr(DNS::DNS_TYPE_A, 60, 4).u32(0x7f000001);
+    DNS::DnsMessageView extra(additionals.data(), additionals.size());
+    CHECK(!extra.valid());
+    CHECK(extra.records().empty());
+    DNS::DnsOptView opt{};
+    CHECK(!extra.edns(opt));
+    string copy = additionals.str();
+    CHECK_EQ(DNS::StripOptRecord(copy.data(), (int) copy.size()), -1);
+
+    // a compression pointer cut in half by the end of the packet
+    wire pointer_cut;
+    pointer_cut.header(1, 0x8180, 1, 0, 0, 0).u8(1).raw("a").u8(0xc0);
+    CHECK(!DNS::DnsMessageView(pointer_cut.data(), pointer_cut.size()).valid());
+}
+
+int main() {
+    test_well_formed();
+    test_pointer_loops();
+    test_forward_pointer();
+    test_long_names();
+    test_truncated_rdata();
+    test_section_counts();
+    return test_result("dns_message_test");
+}
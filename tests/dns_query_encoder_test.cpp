@@ -0,0 +1,130 @@
+// dns_query_encoder: same bytes as BuildDnsQueryPacket, one entry per canonical name
+#include "../dns.h"
+#include "../dns_message.h"
+#include "../dns_query_encoder.h"
+#include "test_util.h"
+
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+static void test_matches_builder(size_t entries) {
+    dns_query_encoder encoder(entries, DNS::DNS_EDNS_PAYLOAD_SIZE);
+    char expected[DNS::DNS_MAX_QUERY_SIZE];
+    char buf[DNS::DNS_MAX_QUERY_SIZE];
+    for (const char *host : {"example.com", "a.b.c.d.example.org", "x"}) {
+        int want = DNS::BuildDnsQueryPacket(host, expected, 0, sizeof(expected), 0x1234, DNS::DNS_TYPE_AAAA, DNS::DNS_EDNS_PAYLOAD_SIZE);
+        // cold and cached encodes give the same packet
+        for (int round = 0; round < 3; round++) {
+            int len = encoder.encode(host, DNS::DNS_TYPE_AAAA, 0x1234, buf, sizeof(buf));
+            CHECK_EQ(len, want);
+            CHECK(len > 0 && memcmp(buf, expected, len) == 0);
+        }
+    }
+    int len = encoder.encode("example.com", DNS::DNS_TYPE_A, 0xbeef, buf, sizeof(buf));
+    DNS::DnsMessageView msg(buf, len);
+    CHECK(msg.valid());
+    CHECK_EQ(msg.id(), 0xbeef);
+    CHECK_EQ((*msg.questions().begin()).query_type, DNS::DNS_TYPE_A);
+    CHECK_EQ(encoder.encode("example.com", DNS::DNS_TYPE_A, 1, buf, len - 1), -1);
+}
+
+static void test_canonical(size_t entries) {
+    dns_query_encoder encoder(entries);
+    char lower[DNS::DNS_MAX_QUERY_SIZE];
+    char buf[DNS::DNS_MAX_QUERY_SIZE];
+    int len = encoder.encode("example.com", DNS::DNS_TYPE_A, 7, lower, sizeof(lower));
+    for (const char *spelling : {"Example.COM", "example.com.", "EXAMPLE.com.", "example.com"}) {
+        for (int round = 0; round < 2; round++) {
+            CHECK_EQ(encoder.encode(spelling, DNS::DNS_TYPE_A, 7, buf, sizeof(buf)), len);
+            CHECK(memcmp(buf, lower, len) == 0);
+        }
+    }
+    CHECK(encoder.size() <= 1u);
+}
+
+// every length around the 8 byte steps, labels of any size, and the bytes next to A-Z
+static void test_lengths() {
+    dns_query_encoder encoder;
+    const string alphabet = "AZaz09-_@[`{\x80\xc1\xff";
+    char expected[DNS::DNS_MAX_QUERY_SIZE];
+    char buf[DNS::DNS_MAX_QUERY_SIZE];
+    unsigned int seed = 1;
+    for (int size = 1; size <= 253; size++) {
+        string host;
+        string lower;
+        for (int i = 0; i < size; i++) {
+            seed = seed * 1103515245 + 12345;
+            // a dot now and then, never two in a row or at either end
+            bool dot = i > 0 && i < size - 1 && host.back() != '.' && (seed >> 16) % 5 == 0;
+            char ch = dot ? '.' : alphabet[(seed >> 16) % alphabet.size()];
+            host += ch;
+            lower += (char) (ch >= 'A' && ch <= 'Z' ? ch + 'a' - 'A' : ch);
+        }
+        int want = DNS::BuildDnsQueryPacket(lower.c_str(), expected, 0, sizeof(expected), 42, DNS::DNS_TYPE_A, 0);
+        int len = encoder.encode(host, DNS::DNS_TYPE_A, 42, buf, sizeof(buf));
+        CHECK_EQ(len, want);
+        CHECK(len <= 0 || memcmp(buf, expected, len) == 0);
+    }
+}
+
+static void test_invalid() {
+    dns_query_encoder encoder(1024);
+    char buf[DNS::DNS_MAX_QUERY_SIZE];
+    for (const char *host : {"", ".", "a..b", ".a", "a.b.."}) {
+        CHECK_EQ(encoder.encode(host, DNS::DNS_TYPE_A, 1, buf, sizeof(buf)), -1);
+    }
+    CHECK_EQ(encoder.encode(string(64, 'a') + ".com", DNS::DNS_TYPE_A, 1, buf, sizeof(buf)), -1);
+    CHECK(encoder.encode(string(63, 'a') + ".com", DNS::DNS_TYPE_A, 1, buf, sizeof(buf)) > 0);
+    string too_long;
+    while (too_long.size() < 254) {
+        too_long += "abcdefg.";
+    }
+    CHECK_EQ(encoder.encode(too_long + "com", DNS::DNS_TYPE_A, 1, buf, sizeof(buf)), -1);
+    CHECK_EQ(encoder.size(), 0u);
+}
+
+static void test_admission() {
+    dns_query_encoder encoder(16);
+    char hot[DNS::DNS_MAX_QUERY_SIZE];
+    char buf[DNS::DNS_MAX_QUERY_SIZE];
+    // a name is cached on its second miss
+    int len = encoder.encode("hot.example.com", DNS::DNS_TYPE_A, 1, hot, sizeof(hot));
+    CHECK_EQ(encoder.size(), 0u);
+    encoder.encode("hot.example.com", DNS::DNS_TYPE_A, 1, buf, sizeof(buf));
+    CHECK_EQ(encoder.size(), 1u);
+    // one-shot names pass through without taking any slot
+    for (int i = 0; i < 1000; i++) {
+        string host = "once-" + to_string(i) + ".example.com";
+        int want = DNS::BuildDnsQueryPacket(host.c_str(), hot + 256, 0, 256, 9, DNS::DNS_TYPE_A, 0);
+        CHECK_EQ(encoder.encode(host, DNS::DNS_TYPE_A, 9, buf, sizeof(buf)), want);
+        CHECK(memcmp(buf, hot + 256, want) == 0);
+    }
+    CHECK_EQ(encoder.size(), 1u);
+    CHECK_EQ(encoder.encode("HOT.example.com.", DNS::DNS_TYPE_A, 1, buf, sizeof(buf)), len);
+    CHECK(memcmp(buf, hot, len) == 0);
+    // a different type is a different template
+    CHECK(encoder.encode("hot.example.com", DNS::DNS_TYPE_AAAA, 1, buf, sizeof(buf)) == len);
+    CHECK(buf[DNS::DNS_HEADER_SIZE + 17] == 0 && buf[DNS::DNS_HEADER_SIZE + 18] == DNS::DNS_TYPE_AAAA);
+
+    // names whose template does not fit a slot are assembled every time
+    string wide(60, 'w');
+    string host = wide + "." + wide + ".example";
+    for (int i = 0; i < 3; i++) {
+        CHECK(encoder.encode(host, DNS::DNS_TYPE_A, 1, buf, sizeof(buf)) > 0);
+    }
+    CHECK_EQ(encoder.size(), 1u);
+}
+
+int main() {
+    // plain and with the template cache
+    for (size_t entries : {0, 1024}) {
+        test_matches_builder(entries);
+        test_canonical(entries);
+    }
+    test_lengths();
+    test_invalid();
+    test_admission();
+    return test_result("dns_query_encoder_test");
+}
@@ -0,0 +1,94 @@
+// cidr_block: parsing and the address by address walk with its reverse names
+#include "../ptr_sweep.h"
+#include "test_util.h"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static vector<pair<string, string>> walk(const char *text) {
+    vector<pair<string, string>> out;
+    cidr_block block;
+    if (!cidr_block::parse(text, block)) {
+        return out;
+    }
+    string address, name;
+    while (block.next(address, name)) {
+        out.emplace_back(address, name);
+    }
+    return out;
+}
+
+static void test_parse() {
+    cidr_block block;
+    CHECK(cidr_block::parse("10.0.0.0/8", block));
+    CHECK(block.is_v4());
+    CHECK(cidr_block::parse("2001:db8::/32", block));
+    CHECK(!block.is_v4());
+    CHECK(cidr_block::parse("192.0.2.1", block));
+    CHECK(cidr_block::parse("0.0.0.0/0", block));
+
+    CHECK(!cidr_block::parse("10.0.0.0/33", block));
+    CHECK(!cidr_block::parse("::/129", block));
+    CHECK(!cidr_block::parse("10.0.0.0/", block));
+    CHECK(!cidr_block::parse("10.0.0.0/-1", block));
+    CHECK(!cidr_block::parse("10.0.0.0/8a", block));
+    CHECK(!cidr_block::parse("10.0.0.0/0008", block));
+    CHECK(!cidr_block::parse("10.0.0/24", block));
+    CHECK(!cidr_block::parse("example.com/24", block));
+    CHECK(!cidr_block::parse("", block));
+}
+
+static void test_v4() {
+    auto addresses = walk("192.0.2.0/30");
+    CHECK(addresses == (vector<pair<string, string>>{{"192.0.2.0", "0.2.0.192.in-addr.arpa"},
+                                                     {"192.0.2.1", "1.2.0.192.in-addr.arpa"},
+                                                     {"192.0.2.2", "2.2.0.192.in-addr.arpa"},
+                                                     {"192.0.2.3", "3.2.0.192.in-addr.arpa"}}));
+
+    // host bits of the base are ignored
+    CHECK(walk("192.0.2.2/30") == addresses);
+
+    // a bare address and a /32 are one address
+    CHECK_EQ(walk("198.51.100.7").size(), 1u);
+    CHECK(walk("198.51.100.7/32") == (vector<pair<string, string>>{{"198.51.100.7", "7.100.51.198.in-addr.arpa"}}));
+
+    // the carry crosses octets and stops at the prefix
+    auto big = walk("10.0.0.0/23");
+    CHECK_EQ(big.size(), 512u);
+    CHECK_EQ(big[255].first, "10.0.0.255");
+    CHECK_EQ(big[256].first, "10.0.1.0");
+    CHECK_EQ(big.back().first, "10.0.1.255");
+    CHECK_EQ(big.back().second, "255.1.0.10.in-addr.arpa");
+
+    // the last block of the address space ends without wrapping to 0.0.0.0
+    auto top = walk("255.255.255.254/31");
+    CHECK(top == (vector<pair<string, string>>{{"255.255.255.254", "254.255.255.255.in-addr.arpa"},
+                                               {"255.255.255.255", "255.255.255.255.in-addr.arpa"}}));
+}
+
+static void test_v6() {
+    auto addresses = walk("2001:db8::/126");
+    CHECK_EQ(addresses.size(), 4u);
+    CHECK_EQ(addresses[0].first, "2001:db8::");
+    CHECK_EQ(addresses[0].second, "0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa");
+    CHECK_EQ(addresses[3].first, "2001:db8::3");
+    CHECK_EQ(addresses[3].second, "3.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa");
+
+    // nibbles above the lowest byte
+    auto wide = walk("2001:db8::ff00/120");
+    CHECK_EQ(wide.size(), 256u);
+    CHECK_EQ(wide.back().first, "2001:db8::ffff");
+    CHECK_EQ(wide.back().second, "f.f.f.f.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa");
+
+    auto top = walk("ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff/128");
+    CHECK_EQ(top.size(), 1u);
+}
+
+int main() {
+    test_parse();
+    test_v4();
+    test_v6();
+    return test_result("ptr_sweep_test");
+}
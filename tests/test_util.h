@@ -0,0 +1,76 @@
+#ifndef DNS_CLIENT_TEST_UTIL_H
+#define DNS_CLIENT_TEST_UTIL_H
+
+#include <fmt/format.h>
+
+#include <string>
+#include <string_view>
+
+// minimal checks: a failed one is reported with its line and the test keeps going,
+// the process exit code tells ctest whether every check passed
+static int g_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fmt::print(stderr, "{}:{}: CHECK({}) failed\n", __FILE__, __LINE__, #cond); \
+            g_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        if (!((a) == (b))) { \
+            fmt::print(stderr, "{}:{}: CHECK_EQ({}, {}) failed\n", __FILE__, __LINE__, #a, #b); \
+            g_failures++; \
+        } \
+    } while (0)
+
+inline int test_result(const char *name) {
+    if (g_failures == 0) {
+        fmt::print("{}: all checks passed\n", name);
+        return 0;
+    }
+    fmt::print(stderr, "{}: {} checks failed\n", name, g_failures);
+    return 1;
+}
+
+// hand assembled wire bytes, nothing is checked so malformed packets are easy to build
+class wire {
+public:
+    wire &u8(unsigned int v) {
+        bytes_.push_back((char) v);
+        return *this;
+    }
+    wire &u16(unsigned int v) { return u8(v >> 8).u8(v); }
+    wire &u32(unsigned int v) { return u16(v >> 16).u16(v & 0xffff); }
+    wire &raw(std::string_view data) {
+        bytes_ += data;
+        return *this;
+    }
+    // uncompressed name, labels split on dots, no length checks
+    wire &name(std::string_view host) {
+        while (!host.empty()) {
+            size_t dot = host.find('.');
+            std::string_view label = host.substr(0, dot);
+            u8((unsigned int) label.size()).raw(label);
+            host = dot == std::string_view::npos ? std::string_view() : host.substr(dot + 1);
+        }
+        return u8(0);
+    }
+    wire &pointer(unsigned int offset) { return u16(0xc000 | offset); }
+    wire &header(unsigned short id, unsigned short flags, unsigned short qd, unsigned short an, unsigned short ns, unsigned short ar) {
+        return u16(id).u16(flags).u16(qd).u16(an).u16(ns).u16(ar);
+    }
+    // type, class, ttl and rdlength of a record, the owner name comes before it
+    wire &rr(unsigned short type, unsigned int ttl, unsigned short rdlength) { return u16(type).u16(1).u32(ttl).u16(rdlength); }
+
+    int size() const { return (int) bytes_.size(); }
+    const char *data() const { return bytes_.data(); }
+    std::string &str() { return bytes_; }
+
+private:
+    std::string bytes_;
+};
+
+#endif//DNS_CLIENT_TEST_UTIL_H
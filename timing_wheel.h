@@ -0,0 +1,130 @@
+#ifndef DNS_CLIENT_TIMING_WHEEL_H
+#define DNS_CLIENT_TIMING_WHEEL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hashed timing wheel (Varghese & Lauck, scheme 6) over a fixed set of timer ids 0..capacity-1.
+// Each bucket is an intrusive doubly linked list threaded through per-id nodes, so arm and
+// cancel are O(1) with no allocation. A timer lands in bucket deadline_tick % buckets and only
+// fires once the wheel has reached its tick, later rounds are skipped while walking the bucket.
+// Deadlines are rounded up to the tick, a timer never fires early.
+class timing_wheel {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit timing_wheel(size_t capacity, clock::duration tick = std::chrono::milliseconds(10), size_t buckets = 4096)
+        : tick_(tick), origin_(clock::now()), nodes_(capacity) {
+        size_t cnt = 1;
+        while (cnt < buckets) {
+            cnt <<= 1;
+        }
+        heads_.assign(cnt, -1);
+        mask_ = cnt - 1;
+        due_.reserve(capacity);
+    }
+
+    void arm(int id, clock::time_point deadline) {
+        cancel(id);
+        uint64_t tick = to_tick(deadline);
+        if (tick <= current_) {
+            tick = current_ + 1;
+        }
+        node &n = nodes_[id];
+        n.tick = tick;
+        n.armed = true;
+        int &head = heads_[tick & mask_];
+        n.prev = -1;
+        n.next = head;
+        if (head >= 0) {
+            nodes_[head].prev = id;
+        }
+        head = id;
+        size_++;
+    }
+
+    void cancel(int id) {
+        nodes_[id].due = false;
+        unlink(id);
+    }
+
+    bool armed(int id) const { return nodes_[id].armed; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    clock::duration tick() const { return tick_; }
+
+    // move the wheel up to now and call expired(id) for every due timer.
+    // due timers are collected first, so the callback may arm or cancel anything;
+    // a due timer that is cancelled or re-armed by an earlier callback does not fire.
+    template<class Expired>
+    void advance(clock::time_point now, Expired &&expired) {
+        uint64_t target = (uint64_t) ((now - origin_) / tick_);
+        due_.clear();
+        while (current_ < target && size_ > due_.size()) {
+            current_++;
+            for (int id = heads_[current_ & mask_]; id >= 0; id = nodes_[id].next) {
+                if (nodes_[id].tick <= current_) {
+                    due_.push_back(id);
+                }
+            }
+        }
+        current_ = target > current_ ? target : current_;
+        for (int id : due_) {
+            unlink(id);
+            nodes_[id].due = true;
+        }
+        for (int id : due_) {
+            if (nodes_[id].due) {
+                nodes_[id].due = false;
+                expired(id);
+            }
+        }
+    }
+
+private:
+    struct node {
+        int prev = -1;
+        int next = -1;
+        uint64_t tick = 0;
+        bool armed = false;
+        bool due = false;
+    };
+
+    void unlink(int id) {
+        node &n = nodes_[id];
+        if (!n.armed) {
+            return;
+        }
+        if (n.prev >= 0) {
+            nodes_[n.prev].next = n.next;
+        } else {
+            heads_[n.tick & mask_] = n.next;
+        }
+        if (n.next >= 0) {
+            nodes_[n.next].prev = n.prev;
+        }
+        n.armed = false;
+        size_--;
+    }
+
+    uint64_t to_tick(clock::time_point deadline) const {
+        auto elapsed = deadline - origin_;
+        if (elapsed.count() <= 0) {
+            return 0;
+        }
+        return (uint64_t) ((elapsed + tick_ - clock::duration(1)) / tick_);
+    }
+
+    clock::duration tick_;
+    clock::time_point origin_;
+    uint64_t current_ = 0;
+    size_t mask_ = 0;
+    size_t size_ = 0;
+    std::vector<int> heads_;
+    std::vector<node> nodes_;
+    std::vector<int> due_;
+};
+
+#endif//DNS_CLIENT_TIMING_WHEEL_H
@@ -0,0 +1,59 @@
+#ifndef DNS_CLIENT_TOKEN_BUCKET_H
+#define DNS_CLIENT_TOKEN_BUCKET_H
+
+#include <algorithm>
+#include <chrono>
+
+// Token bucket pacer: tokens accrue at rate per second up to burst, one send costs one token.
+// Refilled lazily from the elapsed time on every call, so it needs no timer of its own.
+class token_bucket {
+public:
+    using clock = std::chrono::steady_clock;
+
+    token_bucket(double rate, double burst)
+        : rate_(std::max(rate, s_min_rate)), burst_(std::max(burst, 1.0)), tokens_(burst_), last_(clock::now()) {}
+
+    // takes effect from now on, tokens already earned are kept
+    void set_rate(double rate, clock::time_point now = clock::now()) {
+        refill(now);
+        rate_ = std::max(rate, s_min_rate);
+    }
+    double rate() const { return rate_; }
+    double burst() const { return burst_; }
+
+    bool try_take(clock::time_point now = clock::now()) {
+        refill(now);
+        if (tokens_ < 1) {
+            return false;
+        }
+        tokens_ -= 1;
+        return true;
+    }
+
+    // time until the next token is available, zero if one is
+    clock::duration wait_time(clock::time_point now = clock::now()) {
+        refill(now);
+        if (tokens_ >= 1) {
+            return clock::duration::zero();
+        }
+        auto wait = std::chrono::duration<double>((1 - tokens_) / rate_);
+        return std::chrono::ceil<clock::duration>(wait);
+    }
+
+private:
+    static constexpr double s_min_rate = 0.01;
+
+    void refill(clock::time_point now) {
+        if (now > last_) {
+            tokens_ = std::min(burst_, tokens_ + std::chrono::duration<double>(now - last_).count() * rate_);
+            last_ = now;
+        }
+    }
+
+    double rate_;
+    double burst_;
+    double tokens_;
+    clock::time_point last_;
+};
+
+#endif//DNS_CLIENT_TOKEN_BUCKET_H
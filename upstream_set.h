@@ -0,0 +1,155 @@
+#ifndef DNS_CLIENT_UPSTREAM_SET_H
+#define DNS_CLIENT_UPSTREAM_SET_H
+
+#include <utility>
+#include "asio.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using asio::ip::udp;
+
+// Upstream servers of one resolver with a smoothed rtt per server, BIND style:
+// srtt = 0.7 srtt + 0.3 rtt on every reply, a timeout counts as an rtt of the time waited,
+// and every server that is passed over has its srtt decayed by 2%, so a server that
+// went bad is probed again once the others have been used for a while.
+// Untried servers start with a tiny random srtt and are probed first.
+// Not thread safe, every resolver keeps its own set.
+class upstream_set {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t s_max_upstreams = 64;
+
+    struct upstream {
+        udp::endpoint endpoint;
+        double srtt_us = 0;
+        unsigned int failures = 0;// timeouts since the last reply
+        size_t sent = 0;
+        size_t replies = 0;
+        size_t timeouts = 0;
+        size_t hedges = 0;// hedged copies sent to this server
+        bool measured = false;
+    };
+
+    explicit upstream_set(const std::vector<udp::endpoint> &servers) {
+        std::mt19937 rng(std::random_device{}());
+        std::uniform_real_distribution<double> initial(1, 32);
+        for (size_t i = 0; i < servers.size() && i < s_max_upstreams; i++) {
+            upstreams_.push_back({servers[i], initial(rng)});
+        }
+        samples_.resize(s_sample_cnt);
+    }
+
+    size_t size() const { return upstreams_.size(); }
+    const upstream &operator[](size_t index) const { return upstreams_[index]; }
+    const std::vector<upstream> &upstreams() const { return upstreams_; }
+
+    int find(const udp::endpoint &from) const {
+        for (size_t i = 0; i < upstreams_.size(); i++) {
+            if (upstreams_[i].endpoint == from) {
+                return (int) i;
+            }
+        }
+        return -1;
+    }
+
+    // best scored server other than `exclude`, -1 if there is none
+    int select(int exclude = -1) {
+        if (upstreams_.size() == 1) {
+            return exclude == 0 ? -1 : 0;
+        }
+        int best = -1;
+        for (size_t i = 0; i < upstreams_.size(); i++) {
+            if ((int) i != exclude && (best < 0 || score(i) < score(best))) {
+                best = (int) i;
+            }
+        }
+        for (size_t i = 0; i < upstreams_.size(); i++) {
+            if ((int) i != best && (int) i != exclude) {
+                upstreams_[i].srtt_us *= s_decay;
+            }
+        }
+        return best;
+    }
+
+    void on_send(int index, bool hedge) {
+        upstreams_[index].sent++;
+        upstreams_[index].hedges += hedge;
+    }
+
+    // rtt is only known for a reply to a query sent once (Karn), otherwise pass a negative one
+    void on_reply(int index, clock::duration rtt) {
+        upstream &u = upstreams_[index];
+        u.replies++;
+        u.failures = 0;
+        if (rtt.count() >= 0) {
+            double us = (double) std::chrono::duration_cast<std::chrono::microseconds>(rtt).count();
+            smooth(u, us);
+            add_sample(us);
+        }
+    }
+
+    // the server has not answered within `waited`; its rtt is at least that
+    void on_slow(int index, clock::duration waited) {
+        upstream &u = upstreams_[index];
+        smooth(u, std::max(u.srtt_us, (double) std::chrono::duration_cast<std::chrono::microseconds>(waited).count()));
+    }
+
+    void on_timeout(int index, clock::duration waited) {
+        upstreams_[index].timeouts++;
+        upstreams_[index].failures++;
+        on_slow(index, waited);
+    }
+
+    // the given percentile of recent reply rtts over all servers, or `fallback` before any reply
+    clock::duration hedge_delay(double percentile, clock::duration fallback) {
+        size_t cnt = std::min(sample_total_, s_sample_cnt);
+        if (cnt == 0) {
+            return fallback;
+        }
+        if (percentile != hedge_percentile_ || sample_total_ - hedge_total_ >= s_refresh_cnt || hedge_total_ == 0) {
+            scratch_.assign(samples_.begin(), samples_.begin() + cnt);
+            size_t nth = std::min(cnt - 1, (size_t) (percentile * (double) cnt));
+            std::nth_element(scratch_.begin(), scratch_.begin() + nth, scratch_.end());
+            hedge_us_ = scratch_[nth];
+            hedge_percentile_ = percentile;
+            hedge_total_ = sample_total_;
+        }
+        return std::chrono::microseconds((long long) hedge_us_);
+    }
+
+private:
+    static constexpr size_t s_sample_cnt = 1024;
+    static constexpr size_t s_refresh_cnt = 64;
+    static constexpr double s_decay = 0.98;
+
+    double score(size_t index) const {
+        const upstream &u = upstreams_[index];
+        return u.srtt_us * (1 + std::min(u.failures, 5u));
+    }
+
+    static void smooth(upstream &u, double us) {
+        u.srtt_us = u.measured ? 0.7 * u.srtt_us + 0.3 * us : us;
+        u.measured = true;
+    }
+
+    void add_sample(double us) {
+        samples_[sample_total_ % s_sample_cnt] = (uint32_t) std::min(us, 4e9);
+        sample_total_++;
+    }
+
+    std::vector<upstream> upstreams_;
+    std::vector<uint32_t> samples_;// ring of recent rtts in microseconds
+    std::vector<uint32_t> scratch_;
+    size_t sample_total_ = 0;
+    size_t hedge_total_ = 0;
+    double hedge_percentile_ = 0;
+    double hedge_us_ = 0;
+};
+
+#endif//DNS_CLIENT_UPSTREAM_SET_H
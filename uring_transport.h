@@ -0,0 +1,450 @@
+#ifndef DNS_CLIENT_URING_TRANSPORT_H
+#define DNS_CLIENT_URING_TRANSPORT_H
+
+#include "dns_transport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// io_uring transport (Linux 6.0+, built with -DDNS_CLIENT_IO_URING=ON), talking to the
+// kernel through the raw syscalls, no liburing needed.
+// Replies come from one multishot recvmsg that stays armed across datagrams and picks its
+// buffers from a ring of fixed size slots registered with the kernel (a provided buffer
+// ring), each slot handed back once its datagram has been delivered. Sends are sendmsg
+// entries queued on the submission ring and submitted with one io_uring_enter once the
+// current handler returns, like the sendmmsg flush of mmsg_udp_transport.
+// The asio reactor only waits for the ring fd to become readable, completions are then
+// reaped straight from the mapped completion ring.
+class uring_udp_transport : public dns_transport {
+public:
+    static constexpr size_t s_slot_size = 4096;
+    static constexpr unsigned int s_recv_slots = 1024;// power of two
+    static constexpr unsigned int s_default_depth = 256;
+
+    // null with err set if the kernel lacks io_uring or the features used here, sock is left as it was
+    static std::unique_ptr<uring_udp_transport> create(udp::socket &sock, unsigned int depth, asio::error_code &err) {
+        std::unique_ptr<uring_udp_transport> transport(new uring_udp_transport(sock.get_executor()));
+        if (!transport->init(depth == 0 ? s_default_depth : depth, err)) {
+            return nullptr;
+        }
+        transport->sock_ = std::move(sock);
+        return transport;
+    }
+
+    ~uring_udp_transport() override {
+        if (ring_fd_ >= 0) {
+            close_ring();
+        }
+        if (ring_ != MAP_FAILED) {
+            munmap(ring_, ring_size_);
+        }
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (buf_ring_ != MAP_FAILED) {
+            munmap(buf_ring_, buf_ring_size_);
+        }
+    }
+
+    bool send(const char *data, size_t len, const udp::endpoint &to) override {
+        if (len > s_slot_size) {
+            return false;
+        }
+        if (free_slots_.empty()) {
+            submit();
+            reap();
+            if (free_slots_.empty()) {
+                // every slot still with the kernel, the caller's timeout takes over
+                return false;
+            }
+        }
+        io_uring_sqe *sqe = get_sqe();
+        if (sqe == nullptr) {
+            return false;
+        }
+        unsigned int index = free_slots_.back();
+        free_slots_.pop_back();
+        send_slot &slot = slots_[index];
+        memcpy(slot.iov.iov_base, data, len);
+        slot.iov.iov_len = len;
+        memcpy(&slot.addr, to.data(), to.size());
+        slot.msg.msg_namelen = to.size();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = sock_.native_handle();
+        sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+        sqe->len = 1;
+        sqe->user_data = index;
+        sends_in_flight_++;
+        schedule_submit();
+        arm_wait();
+        return true;
+    }
+
+    void start_receive() override {
+        receiving_ = true;
+        if (!recv_armed_) {
+            arm_recv();
+        }
+        schedule_submit();
+        arm_wait();
+    }
+
+    void stop_receive() override {
+        receiving_ = false;
+        if (recv_armed_) {
+            if (io_uring_sqe *sqe = get_sqe()) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = s_recv_tag;
+                sqe->user_data = s_cancel_tag;
+                submit();
+            }
+        }
+        // the cancel's completions are reaped on the next start_receive
+        if (waiting_ && sends_in_flight_ == 0) {
+            ring_wait_.cancel();
+        }
+    }
+
+    udp::socket &socket() override { return sock_; }
+
+private:
+    static constexpr uint64_t s_recv_tag = ~0ull;
+    static constexpr uint64_t s_cancel_tag = ~0ull - 1;
+    static constexpr unsigned short s_buffer_group = 0;
+
+    struct send_slot {
+        msghdr msg{};
+        iovec iov{};
+        sockaddr_storage addr{};
+    };
+
+    explicit uring_udp_transport(const udp::socket::executor_type &executor) : sock_(executor), ring_wait_(executor) {}
+
+    bool init(unsigned int depth, asio::error_code &err) {
+        if (!kernel_supported(err)) {
+            return false;
+        }
+        io_uring_params params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = 4 * depth + s_recv_slots;
+        ring_fd_ = (int) syscall(__NR_io_uring_setup, depth, &params);
+        if (ring_fd_ < 0) {
+            err = asio::error_code(errno, asio::error::get_system_category());
+            return false;
+        }
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+            err = asio::error::operation_not_supported;
+            return false;
+        }
+        ring_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned int), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+        if (ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+            err = asio::error_code(errno, asio::error::get_system_category());
+            return false;
+        }
+        char *ring = static_cast<char *>(ring_);
+        sq_entries_ = params.sq_entries;
+        sq_head_ = reinterpret_cast<unsigned int *>(ring + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned int *>(ring + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned int *>(ring + params.sq_off.ring_mask);
+        unsigned int *sq_array = reinterpret_cast<unsigned int *>(ring + params.sq_off.array);
+        for (unsigned int i = 0; i < sq_entries_; i++) {
+            sq_array[i] = i;
+        }
+        cq_head_ = reinterpret_cast<unsigned int *>(ring + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned int *>(ring + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned int *>(ring + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(ring + params.cq_off.cqes);
+        sq_local_tail_ = *sq_tail_;
+
+        buf_ring_size_ = s_recv_slots * sizeof(io_uring_buf);
+        buf_ring_ = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf_ring_ == MAP_FAILED) {
+            err = asio::error_code(errno, asio::error::get_system_category());
+            return false;
+        }
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+        reg.ring_entries = s_recv_slots;
+        reg.bgid = s_buffer_group;
+        if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            err = asio::error_code(errno, asio::error::get_system_category());
+            return false;
+        }
+        rx_buf_.resize(s_recv_slots * s_slot_size);
+        for (unsigned int i = 0; i < s_recv_slots; i++) {
+            recycle(i);
+        }
+        publish_buffers();
+        // the header, sender address and payload of every datagram land in one slot
+        recv_msg_.msg_namelen = sizeof(sockaddr_storage);
+
+        tx_buf_.resize(depth * s_slot_size);
+        slots_.resize(depth);
+        for (unsigned int i = 0; i < depth; i++) {
+            slots_[i].iov.iov_base = tx_buf_.data() + i * s_slot_size;
+            slots_[i].msg.msg_iov = &slots_[i].iov;
+            slots_[i].msg.msg_iovlen = 1;
+            slots_[i].msg.msg_name = &slots_[i].addr;
+            free_slots_.push_back(depth - 1 - i);
+        }
+        ring_wait_.assign(ring_fd_, err);
+        return !err;
+    }
+
+    // SINGLE_ISSUER is 6.0, as are multishot recvmsg and the buffer ring: a kernel that takes it has them all.
+    // Only a probe, the real ring goes without it since workers are set up on one thread and run on another.
+    static bool kernel_supported(asio::error_code &err) {
+        static const int probe = [] {
+            io_uring_params params{};
+            params.flags = IORING_SETUP_SINGLE_ISSUER;
+            int fd = (int) syscall(__NR_io_uring_setup, 1, &params);
+            if (fd < 0) {
+                return errno;
+            }
+            close(fd);
+            return 0;
+        }();
+        if (probe != 0) {
+            err = asio::error_code(probe, asio::error::get_system_category());
+        }
+        return probe == 0;
+    }
+
+    // the kernel may still write into the slots until the receive is gone, so wait for it
+    void close_ring() {
+        receiving_ = false;
+        bool cancelled = false;
+        while (sq_head_ != nullptr && (recv_armed_ || sends_in_flight_ > 0)) {
+            if (recv_armed_ && !cancelled) {
+                if (io_uring_sqe *sqe = get_sqe()) {
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr = s_recv_tag;
+                    sqe->user_data = s_cancel_tag;
+                    cancelled = true;
+                }
+            }
+            std::atomic_ref<unsigned int>(*sq_tail_).store(sq_local_tail_, std::memory_order_release);
+            int n = (int) syscall(__NR_io_uring_enter, ring_fd_, to_submit_, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                break;
+            }
+            to_submit_ -= std::max(n, 0);
+            reap();
+        }
+        asio::error_code ignored;
+        ring_wait_.cancel(ignored);
+        ring_wait_.release();
+        close(ring_fd_);
+        ring_fd_ = -1;
+    }
+
+    io_uring_sqe *get_sqe() {
+        if (sq_local_tail_ - std::atomic_ref<unsigned int>(*sq_head_).load(std::memory_order_acquire) >= sq_entries_) {
+            submit();
+            if (sq_local_tail_ - std::atomic_ref<unsigned int>(*sq_head_).load(std::memory_order_acquire) >= sq_entries_) {
+                return nullptr;
+            }
+        }
+        io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes_) + (sq_local_tail_ & sq_mask_);
+        memset(sqe, 0, sizeof(*sqe));
+        sq_local_tail_++;
+        to_submit_++;
+        return sqe;
+    }
+
+    void submit() {
+        if (to_submit_ == 0) {
+            return;
+        }
+        std::atomic_ref<unsigned int>(*sq_tail_).store(sq_local_tail_, std::memory_order_release);
+        for (;;) {
+            int n = (int) syscall(__NR_io_uring_enter, ring_fd_, to_submit_, 0, 0, nullptr, 0);
+            if (n >= 0) {
+                to_submit_ -= n;
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            // EBUSY/EAGAIN: completions have to be reaped first, the next flush retries
+            if (errno != EBUSY && errno != EAGAIN) {
+                report_error(true, asio::error_code(errno, asio::error::get_system_category()));
+            }
+            return;
+        }
+    }
+
+    // one io_uring_enter for everything queued while the current handler ran
+    void schedule_submit() {
+        if (!submit_posted_) {
+            submit_posted_ = true;
+            asio::post(sock_.get_executor(), [this] {
+                submit_posted_ = false;
+                submit();
+            });
+        }
+    }
+
+    void arm_recv() {
+        io_uring_sqe *sqe = get_sqe();
+        if (sqe == nullptr) {
+            return;
+        }
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = sock_.native_handle();
+        sqe->addr = reinterpret_cast<uint64_t>(&recv_msg_);
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = s_buffer_group;
+        sqe->user_data = s_recv_tag;
+        recv_armed_ = true;
+    }
+
+    bool completions_ready() const {
+        return std::atomic_ref<unsigned int>(*cq_tail_).load(std::memory_order_acquire) != *cq_head_;
+    }
+
+    // the reactor registers the ring fd edge triggered, a completion that came while nobody
+    // waited has no readiness left to report, so those are reaped from a posted handler
+    void arm_wait() {
+        if (waiting_ || (!receiving_ && sends_in_flight_ == 0)) {
+            return;
+        }
+        waiting_ = true;
+        auto on_ready = [this](const asio::error_code &err) {
+            waiting_ = false;
+            // a start_receive or send between stop_receive's cancel and this handler found waiting_ still set
+            if (err == asio::error::operation_aborted) {
+                arm_wait();
+                return;
+            }
+            reap();
+            arm_wait();
+        };
+        if (completions_ready()) {
+            asio::post(sock_.get_executor(), [on_ready] { on_ready({}); });
+        } else {
+            ring_wait_.async_wait(asio::posix::stream_descriptor::wait_read, on_ready);
+        }
+    }
+
+    void reap() {
+        unsigned int head = *cq_head_;
+        for (;;) {
+            if (head == std::atomic_ref<unsigned int>(*cq_tail_).load(std::memory_order_acquire)) {
+                break;
+            }
+            // copied and consumed first: the handler may send, and a send may reap
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            std::atomic_ref<unsigned int>(*cq_head_).store(++head, std::memory_order_release);
+            if (cqe.user_data == s_recv_tag) {
+                on_recv(cqe);
+            } else if (cqe.user_data != s_cancel_tag) {
+                on_sent(cqe);
+            }
+            head = *cq_head_;
+        }
+        publish_buffers();
+        if (receiving_ && !recv_armed_) {
+            arm_recv();
+            schedule_submit();
+        }
+    }
+
+    void on_recv(const io_uring_cqe &cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            recv_armed_ = false;
+        }
+        if (cqe.res >= 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+            unsigned int bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            char *slot = rx_buf_.data() + (size_t) bid * s_slot_size;
+            const auto *out = reinterpret_cast<const io_uring_recvmsg_out *>(slot);
+            const char *name = slot + sizeof(io_uring_recvmsg_out);
+            const char *payload = name + recv_msg_.msg_namelen;
+            size_t room = (size_t) cqe.res - (payload - slot);
+            if (receiving_ && !(out->flags & MSG_TRUNC) && out->namelen <= sizeof(sockaddr_storage)) {
+                udp::endpoint from;
+                memcpy(from.data(), name, out->namelen);
+                from.resize(out->namelen);
+                handler_(from, payload, std::min<size_t>(out->payloadlen, room));
+            }
+            recycle(bid);
+        } else if (cqe.res < 0 && cqe.res != -ECANCELED && cqe.res != -ENOBUFS) {
+            report_error(false, asio::error_code(-cqe.res, asio::error::get_system_category()));
+        }
+    }
+
+    void on_sent(const io_uring_cqe &cqe) {
+        sends_in_flight_--;
+        free_slots_.push_back((unsigned int) cqe.user_data);
+        if (cqe.res < 0) {
+            report_error(true, asio::error_code(-cqe.res, asio::error::get_system_category()));
+        }
+    }
+
+    // the tail shares its bytes with the first entry's resv field, so entries are written field by field
+    void recycle(unsigned int bid) {
+        io_uring_buf &buf = buf_ring_bufs()[buf_tail_ & (s_recv_slots - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(rx_buf_.data() + (size_t) bid * s_slot_size);
+        buf.len = s_slot_size;
+        buf.bid = (unsigned short) bid;
+        buf_tail_++;
+    }
+
+    void publish_buffers() {
+        auto *ring = static_cast<io_uring_buf_ring *>(buf_ring_);
+        std::atomic_ref<unsigned short>(ring->tail).store(buf_tail_, std::memory_order_release);
+    }
+
+    // not io_uring_buf_ring::bufs: in C++ the header's flexible array wrapper shifts it by the size of an empty struct
+    io_uring_buf *buf_ring_bufs() { return static_cast<io_uring_buf *>(buf_ring_); }
+
+    udp::socket sock_;
+    asio::posix::stream_descriptor ring_wait_;// the ring fd, only ever waited on
+    int ring_fd_ = -1;
+
+    void *ring_ = MAP_FAILED;
+    size_t ring_size_ = 0;
+    void *sqes_ = MAP_FAILED;
+    size_t sqes_size_ = 0;
+    unsigned int sq_entries_ = 0;
+    unsigned int *sq_head_ = nullptr;
+    unsigned int *sq_tail_ = nullptr;
+    unsigned int sq_mask_ = 0;
+    unsigned int sq_local_tail_ = 0;
+    unsigned int to_submit_ = 0;
+    unsigned int *cq_head_ = nullptr;
+    unsigned int *cq_tail_ = nullptr;
+    unsigned int cq_mask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+    bool submit_posted_ = false;
+    bool waiting_ = false;
+
+    void *buf_ring_ = MAP_FAILED;
+    size_t buf_ring_size_ = 0;
+    unsigned short buf_tail_ = 0;
+    std::vector<char> rx_buf_;
+    msghdr recv_msg_{};
+    bool receiving_ = false;
+    bool recv_armed_ = false;
+
+    std::vector<char> tx_buf_;
+    std::vector<send_slot> slots_;
+    std::vector<unsigned int> free_slots_;
+    unsigned int sends_in_flight_ = 0;
+};
+
+#endif//DNS_CLIENT_URING_TRANSPORT_H